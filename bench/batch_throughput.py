@@ -0,0 +1,63 @@
+#!/usr/bin/env python3
+"""Compare scripts per second of one bin/exe process per script against bin/exe --batch."""
+
+import argparse
+import os
+import struct
+import subprocess
+import tempfile
+import time
+
+FRAME = struct.Struct('=IIII')  # struct server_frame
+FRAME_EXIT = 3
+
+
+def read_results(output):
+    """Map each script id to its exit code, from the frames --batch writes."""
+    results = {}
+    offset = 0
+    while offset < len(output):
+        frame_id, frame_type, length, _ = FRAME.unpack_from(output, offset)
+        offset += FRAME.size
+        if frame_type == FRAME_EXIT:
+            results[frame_id] = struct.unpack_from('=i', output, offset)[0]
+        offset += length
+    return results
+
+
+def main():
+    this_dir = os.path.dirname(os.path.abspath(__file__))
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--exe', default=os.path.join(this_dir, '..', 'bin', 'exe'))
+    parser.add_argument('--scripts', '-n', type=int, default=1000)
+    parser.add_argument('--script', default='print "hello"\n')
+    args = parser.parse_args()
+
+    with tempfile.TemporaryDirectory() as tmp:
+        paths = []
+        for i in range(args.scripts):
+            path = os.path.join(tmp, 'script{}.lua'.format(i))
+            with open(path, 'w') as f:
+                f.write(args.script)
+            paths.append(path)
+        manifest = os.path.join(tmp, 'manifest')
+        with open(manifest, 'w') as f:
+            f.write(''.join(path + '\n' for path in paths))
+
+        start = time.perf_counter()
+        for path in paths:
+            subprocess.run([args.exe, path], stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        elapsed = time.perf_counter() - start
+        print('one process per script: {:8.1f} scripts/s'.format(args.scripts / elapsed))
+
+        start = time.perf_counter()
+        output = subprocess.run([args.exe, '--batch', manifest], stdout=subprocess.PIPE,
+                                check=True).stdout
+        elapsed = time.perf_counter() - start
+        results = read_results(output)
+        assert len(results) == args.scripts and not any(results.values())
+        print('--batch:                {:8.1f} scripts/s'.format(args.scripts / elapsed))
+
+
+if __name__ == '__main__':
+    main()
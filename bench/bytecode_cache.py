@@ -0,0 +1,63 @@
+#!/usr/bin/env python3
+"""Measure how much of a large script's run time --cache-dir saves by skipping the parser."""
+
+import argparse
+import os
+import statistics
+import subprocess
+import tempfile
+import time
+
+
+def large_script(functions):
+    # Lots of code that is parsed but barely run, like a script that inlines big libraries.
+    lines = ['local M = {}\n']
+    for i in range(functions):
+        lines.append('function M.f{0}(a, b)\n'
+                     '  local t = {{a, b, "{0}", x = a * {0}, y = b .. "{0}"}}\n'
+                     '  if a > b then return t.x + #t else return #t.y end\n'
+                     'end\n'.format(i))
+    lines.append('print(M.f0(1, 2))\n')
+    return ''.join(lines).encode('utf-8')
+
+
+def time_runs(command, script_path, iterations):
+    samples = []
+    for _ in range(iterations):
+        start = time.perf_counter()
+        subprocess.run(command + [script_path], check=True, stdout=subprocess.DEVNULL)
+        samples.append(time.perf_counter() - start)
+    return statistics.median(samples)
+
+
+def main():
+    this_dir = os.path.dirname(os.path.abspath(__file__))
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--exe', default=os.path.join(this_dir, '..', 'bin', 'exe'))
+    parser.add_argument('--iterations', '-n', type=int, default=20)
+    parser.add_argument('--functions', type=int, default=20000,
+                        help='Number of top-level functions in the generated script.')
+    args = parser.parse_args()
+
+    with tempfile.TemporaryDirectory() as tmp:
+        script_path = os.path.join(tmp, 'script.lua')
+        cache_dir = os.path.join(tmp, 'cache')
+        os.mkdir(cache_dir)
+        with open(script_path, 'wb') as f:
+            f.write(large_script(args.functions))
+        print('script size: {} bytes'.format(os.path.getsize(script_path)))
+
+        uncached = time_runs([args.exe], script_path, args.iterations)
+        print('no cache:   {:8.3f} ms'.format(uncached * 1e3))
+
+        start = time.perf_counter()
+        subprocess.run([args.exe, '--cache-dir', cache_dir, script_path], check=True,
+                       stdout=subprocess.DEVNULL)
+        print('cache miss: {:8.3f} ms'.format((time.perf_counter() - start) * 1e3))
+
+        cached = time_runs([args.exe, '--cache-dir', cache_dir], script_path, args.iterations)
+        print('cache hit:  {:8.3f} ms'.format(cached * 1e3))
+
+
+if __name__ == '__main__':
+    main()
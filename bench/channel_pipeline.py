@@ -0,0 +1,180 @@
+#!/usr/bin/env python3
+"""Compare items per second through pipelines of 2-8 stages connected by resumer.Channel
+against the same pipelines built from Lua table queues and Resumers."""
+
+import argparse
+import os
+import statistics
+import subprocess
+import tempfile
+import time
+
+# Stage 1 produces the numbers 1..items, the middle stages pass them on, and the last sums them.
+
+NATIVE = '''
+local scheduler = resumer.Scheduler()
+local batch = {batch}
+local links = {{}}
+for i = 1, {stages} - 1 do links[i] = resumer.Channel({capacity}) end
+scheduler:spawn(function ()
+  local out = links[1]
+  if batch == 1 then
+    for i = 1, {items} do out:send(i) end
+  else
+    local values = {{}}
+    for i = 1, {items}, batch do
+      local n = math.min(batch, {items} - i + 1)
+      for j = 1, n do values[j] = i + j - 1 end
+      out:send_many(unpack(values, 1, n))
+    end
+  end
+  out:close()
+end)
+for s = 2, {stages} - 1 do
+  scheduler:spawn(function ()
+    local input, out = links[s - 1], links[s]
+    if batch == 1 then
+      for value in input.recv, input do out:send(value) end
+    else
+      while true do
+        local values = {{input:recv_many(batch)}}
+        if values[1] == nil then break end
+        out:send_many(unpack(values))
+      end
+    end
+    out:close()
+  end)
+end
+local sum = 0
+scheduler:spawn(function ()
+  local input = links[{stages} - 1]
+  while true do
+    local values = {{input:recv_many(batch)}}
+    if values[1] == nil then break end
+    for i = 1, #values do sum = sum + values[i] end
+  end
+end)
+scheduler:run()
+assert(sum == {items} * ({items} + 1) / 2)
+'''
+
+# Modelled on the hand-rolled schedulers in tests/resumer/: table queues, with the tasks
+# waiting on each end kept in lists and moved to a Lua ready queue.
+LUA = '''
+local ready, head, tail = {{}}, 1, 0
+local current
+local function wake(thread)
+  tail = tail + 1
+  ready[tail] = thread
+end
+local function spawn(f)
+  local thread = {{}}
+  thread.resumer = resumer.Resumer(f)
+  wake(thread)
+end
+local function Queue()
+  return {{items = {{}}, first = 1, last = 0, receivers = {{}}, senders = {{}}}}
+end
+local function send(q, value)
+  while q.last - q.first + 1 >= {capacity} do
+    q.senders[#q.senders + 1] = current
+    current.resumer()
+  end
+  q.last = q.last + 1
+  q.items[q.last] = value
+  local receiver = table.remove(q.receivers, 1)
+  if receiver then wake(receiver) end
+end
+local function recv(q)
+  while q.first > q.last do
+    if q.closed then return nil end
+    q.receivers[#q.receivers + 1] = current
+    current.resumer()
+  end
+  local value = q.items[q.first]
+  q.items[q.first] = nil
+  q.first = q.first + 1
+  local sender = table.remove(q.senders, 1)
+  if sender then wake(sender) end
+  return value
+end
+local function close(q)
+  q.closed = true
+  for _, receiver in ipairs(q.receivers) do wake(receiver) end
+  q.receivers = {{}}
+end
+local links = {{}}
+for i = 1, {stages} - 1 do links[i] = Queue() end
+spawn(function ()
+  for i = 1, {items} do send(links[1], i) end
+  close(links[1])
+end)
+for s = 2, {stages} - 1 do
+  spawn(function ()
+    while true do
+      local value = recv(links[s - 1])
+      if value == nil then break end
+      send(links[s], value)
+    end
+    close(links[s])
+  end)
+end
+local sum = 0
+spawn(function ()
+  while true do
+    local value = recv(links[{stages} - 1])
+    if value == nil then break end
+    sum = sum + value
+  end
+end)
+while head <= tail do
+  current = ready[head]
+  ready[head] = nil
+  head = head + 1
+  current.resumer()
+end
+assert(sum == {items} * ({items} + 1) / 2)
+'''
+
+
+def time_script(exe, source, iterations):
+    with tempfile.NamedTemporaryFile('w', suffix='.lua') as f:
+        f.write(source)
+        f.flush()
+        samples = []
+        for _ in range(iterations):
+            start = time.perf_counter()
+            subprocess.run([exe, '-t', '0', '-m', '0', f.name], check=True)
+            samples.append(time.perf_counter() - start)
+    return statistics.median(samples)
+
+
+def main():
+    this_dir = os.path.dirname(os.path.abspath(__file__))
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--exe', default=os.path.join(this_dir, '..', 'bin', 'exe'))
+    parser.add_argument('--iterations', '-n', type=int, default=3)
+    parser.add_argument('--items', type=int, default=200000)
+    parser.add_argument('--capacity', type=int, default=64)
+    parser.add_argument('--batch', type=int, default=64)
+    args = parser.parse_args()
+
+    variants = (
+        ('lua', LUA, 1),
+        ('channel', NATIVE, 1),
+        ('channel x{}'.format(args.batch), NATIVE, args.batch),
+    )
+    for stages in (2, 4, 8):
+        for name, template, batch in variants:
+            def script(items):
+                return template.format(stages=stages, items=items, capacity=args.capacity,
+                                       batch=batch)
+            # Subtract the cost of starting up, measured with no items.
+            base = time_script(args.exe, script(0), args.iterations)
+            total = time_script(args.exe, script(args.items), args.iterations)
+            print('{} stages  {:12} {:12.0f} items/s'.format(
+                stages, name, args.items / max(total - base, 1e-9)))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,161 @@
+/*
+  Measure how fast a host can stream messages into a sandboxed script, over a --channel and
+  over a pipe to the script's stdin. Build with `make bin/channel-throughput`, then run
+  bin/channel-throughput [exe [messages [message size]]].
+*/
+
+#define _GNU_SOURCE
+
+#include "../src/channel_ring.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#define RING_SIZE (1 << 20)
+#define MEMFD 3
+#define DOORBELL 4
+
+static const char channel_script[] =
+  "local c = channel.open('bench')\n"
+  "local n = 0\n"
+  "while c:recv() do n = n + 1 end\n"
+  "c:send(tostring(n))\n";
+
+static const char pipe_script[] =
+  "local n = 0\n"
+  "while true do\n"
+  "  local header = io.read(4)\n"
+  "  if header == nil then break end\n"
+  "  local a, b, c, d = header:byte(1, 4)\n"
+  "  io.read(a + b * 256 + c * 65536 + d * 16777216)\n"
+  "  n = n + 1\n"
+  "end\n"
+  "io.write(n)\n";
+
+
+static double now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+
+static void fail(const char *message) {
+  perror(message);
+  exit(1);
+}
+
+
+static char *write_script(const char *source) {
+  static char paths[2][32];
+  static int next = 0;
+  char *path = paths[next++];
+  strcpy(path, "/tmp/channel-benchXXXXXX");
+  int fd = mkstemp(path);
+  if (fd == -1 || write(fd, source, strlen(source)) != (ssize_t) strlen(source)) fail("script");
+  close(fd);
+  return path;
+}
+
+
+static double run_channel(const char *exe, long messages, uint32_t size, char *message) {
+  int memfd = memfd_create("channel", 0);
+  if (memfd == -1 || ftruncate(memfd, channel_region_size(RING_SIZE))) fail("memfd");
+  void *mapping = mmap(NULL, channel_region_size(RING_SIZE), PROT_READ | PROT_WRITE, MAP_SHARED,
+                       memfd, 0);
+  if (mapping == MAP_FAILED) fail("mmap");
+  channel_region_init(mapping, RING_SIZE);
+  int doorbell[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, doorbell)) fail("socketpair");
+  char *script = write_script(channel_script);
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(doorbell[0]);
+    if (dup2(memfd, MEMFD) == -1 || dup2(doorbell[1], DOORBELL) == -1) fail("dup2");
+    execl(exe, exe, "-t", "0", "-m", "0", "--channel", "bench=3:4", script, (char *) NULL);
+    fail("exec");
+  }
+  close(doorbell[1]);
+  close(memfd);
+  fcntl(doorbell[0], F_SETFL, O_NONBLOCK);
+  struct channel channel;
+  if (!channel_attach(&channel, mapping, channel_region_size(RING_SIZE), doorbell[0])) {
+    fail("channel_attach");
+  }
+
+  double start = now();
+  for (long i = 0; i < messages; ++i) {
+    if (channel_send(&channel, message, size)) fail("channel_send");
+  }
+  channel_close(&channel, CHANNEL_TO_SANDBOX);
+  char reply[32];
+  ssize_t n = channel_recv(&channel, reply, sizeof(reply) - 1);
+  double elapsed = now() - start;
+  if (n < 0 || (reply[n] = '\0', atol(reply) != messages)) {
+    fprintf(stderr, "channel: script received %s messages\n", n < 0 ? "no" : reply);
+    exit(1);
+  }
+  waitpid(pid, NULL, 0);
+  unlink(script);
+  return elapsed;
+}
+
+
+static double run_pipe(const char *exe, long messages, uint32_t size, char *message) {
+  int to_script[2], from_script[2];
+  if (pipe(to_script) || pipe(from_script)) fail("pipe");
+  char *script = write_script(pipe_script);
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    if (dup2(to_script[0], 0) == -1 || dup2(from_script[1], 1) == -1) fail("dup2");
+    close(to_script[1]);
+    close(from_script[0]);
+    execl(exe, exe, "-t", "0", "-m", "0", script, (char *) NULL);
+    fail("exec");
+  }
+  close(to_script[0]);
+  close(from_script[1]);
+
+  // One write per message, as a host streaming messages as they come would do.
+  double start = now();
+  memcpy(message, &size, sizeof(size));
+  for (long i = 0; i < messages; ++i) {
+    if (write(to_script[1], message, sizeof(size) + size) != (ssize_t) (sizeof(size) + size)) {
+      fail("write");
+    }
+  }
+  close(to_script[1]);
+  char reply[32];
+  ssize_t n = read(from_script[0], reply, sizeof(reply) - 1);
+  double elapsed = now() - start;
+  if (n <= 0 || (reply[n] = '\0', atol(reply) != messages)) {
+    fprintf(stderr, "pipe: script received %s messages\n", n <= 0 ? "no" : reply);
+    exit(1);
+  }
+  waitpid(pid, NULL, 0);
+  unlink(script);
+  return elapsed;
+}
+
+
+int main(int argc, char **argv) {
+  const char *exe = argc > 1 ? argv[1] : "bin/exe";
+  long messages = argc > 2 ? atol(argv[2]) : 1000000;
+  uint32_t size = argc > 3 ? (uint32_t) atol(argv[3]) : 64;
+  char *message = calloc(1, sizeof(size) + size);
+  if (message == NULL) fail("calloc");
+
+  double channel = run_channel(exe, messages, size, message);
+  double pipe = run_pipe(exe, messages, size, message);
+  printf("%ld messages of %u bytes\n", messages, size);
+  printf("channel: %8.3f s  %10.0f messages/s\n", channel, messages / channel);
+  printf("pipe:    %8.3f s  %10.0f messages/s\n", pipe, messages / pipe);
+  return 0;
+}
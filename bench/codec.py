@@ -0,0 +1,220 @@
+#!/usr/bin/env python3
+"""Compare codec.pack() and codec.unpack() with a MessagePack codec written in plain Lua."""
+
+import argparse
+import os
+import statistics
+import subprocess
+import tempfile
+import time
+
+# A straightforward pure-Lua MessagePack codec for the same types, as a script would write it.
+PURE_LUA = r'''
+local byte, char, floor, frexp = string.byte, string.char, math.floor, math.frexp
+local concat, sub = table.concat, string.sub
+
+local function be(n, width)
+  local bytes = {}
+  for i = width, 1, -1 do
+    bytes[i] = n % 256
+    n = floor(n / 256)
+  end
+  return char(unpack(bytes))
+end
+
+local function pack_value(v, out)
+  local t = type(v)
+  if t == "nil" then
+    out[#out + 1] = "\192"
+  elseif t == "boolean" then
+    out[#out + 1] = v and "\195" or "\194"
+  elseif t == "number" then
+    if v == floor(v) and v >= 0 and v < 2^32 then
+      if v < 128 then out[#out + 1] = char(v)
+      elseif v < 256 then out[#out + 1] = "\204" .. char(v)
+      elseif v < 65536 then out[#out + 1] = "\205" .. be(v, 2)
+      else out[#out + 1] = "\206" .. be(v, 4) end
+    elseif v == floor(v) and v < 0 and v >= -2^31 then
+      if v >= -32 then out[#out + 1] = char(v + 256)
+      elseif v >= -128 then out[#out + 1] = "\208" .. char(v + 256)
+      elseif v >= -32768 then out[#out + 1] = "\209" .. be(v + 65536, 2)
+      else out[#out + 1] = "\210" .. be(v + 2^32, 4) end
+    else
+      local sign = 0
+      if v < 0 then sign, v = 128, -v end
+      local m, e = frexp(v)
+      m, e = (m * 2 - 1) * 2^52, e + 1022
+      local bytes = {}
+      for i = 8, 3, -1 do
+        bytes[i] = m % 256
+        m = floor(m / 256)
+      end
+      bytes[2] = (e % 16) * 16 + m
+      bytes[1] = sign + floor(e / 16)
+      out[#out + 1] = "\203" .. char(unpack(bytes))
+    end
+  elseif t == "string" then
+    local n = #v
+    if n < 32 then out[#out + 1] = char(160 + n)
+    elseif n < 256 then out[#out + 1] = "\217" .. char(n)
+    elseif n < 65536 then out[#out + 1] = "\218" .. be(n, 2)
+    else out[#out + 1] = "\219" .. be(n, 4) end
+    out[#out + 1] = v
+  else
+    local count, array = 0, true
+    for k in pairs(v) do
+      count = count + 1
+      if type(k) ~= "number" or k < 1 or k ~= floor(k) then array = false end
+    end
+    array = array and #v == count
+    if array then
+      if count < 16 then out[#out + 1] = char(144 + count)
+      else out[#out + 1] = "\220" .. be(count, 2) end
+      for i = 1, count do pack_value(v[i], out) end
+    else
+      if count < 16 then out[#out + 1] = char(128 + count)
+      else out[#out + 1] = "\222" .. be(count, 2) end
+      for k, x in pairs(v) do
+        pack_value(k, out)
+        pack_value(x, out)
+      end
+    end
+  end
+end
+
+function lua_pack(v)
+  local out = {}
+  pack_value(v, out)
+  return concat(out)
+end
+
+local unpack_value
+
+local function get(s, pos, width)
+  local n = 0
+  for i = pos, pos + width - 1 do n = n * 256 + byte(s, i) end
+  return n
+end
+
+local function unpack_table(s, pos, count, map)
+  local t = {}
+  for i = 1, count do
+    if map then
+      local k
+      k, pos = unpack_value(s, pos)
+      t[k], pos = unpack_value(s, pos)
+    else
+      t[i], pos = unpack_value(s, pos)
+    end
+  end
+  return t, pos
+end
+
+function unpack_value(s, pos)
+  local tag = byte(s, pos)
+  pos = pos + 1
+  if tag < 128 then return tag, pos
+  elseif tag < 144 then return unpack_table(s, pos, tag - 128, true)
+  elseif tag < 160 then return unpack_table(s, pos, tag - 144, false)
+  elseif tag < 192 then return sub(s, pos, pos + tag - 161), pos + tag - 160
+  elseif tag >= 224 then return tag - 256, pos
+  elseif tag == 192 then return nil, pos
+  elseif tag == 194 then return false, pos
+  elseif tag == 195 then return true, pos
+  elseif tag == 203 then
+    local b1, b2, b3, b4, b5, b6, b7, b8 = byte(s, pos, pos + 7)
+    local sign = b1 >= 128 and -1 or 1
+    local e = (b1 % 128) * 16 + floor(b2 / 16)
+    local m = ((((((b2 % 16) * 256 + b3) * 256 + b4) * 256 + b5) * 256 + b6) * 256 + b7) * 256 + b8
+    if e == 0 then return sign * m * 2^-1074, pos + 8 end
+    return sign * (1 + m / 2^52) * 2^(e - 1023), pos + 8
+  elseif tag == 204 then return byte(s, pos), pos + 1
+  elseif tag == 205 then return get(s, pos, 2), pos + 2
+  elseif tag == 206 then return get(s, pos, 4), pos + 4
+  elseif tag == 208 then
+    local n = byte(s, pos)
+    return n >= 128 and n - 256 or n, pos + 1
+  elseif tag == 209 then
+    local n = get(s, pos, 2)
+    return n >= 32768 and n - 65536 or n, pos + 2
+  elseif tag == 210 then
+    local n = get(s, pos, 4)
+    return n >= 2^31 and n - 2^32 or n, pos + 4
+  elseif tag == 217 then
+    local n = byte(s, pos)
+    return sub(s, pos + 1, pos + n), pos + 1 + n
+  elseif tag == 218 then
+    local n = get(s, pos, 2)
+    return sub(s, pos + 2, pos + 1 + n), pos + 2 + n
+  elseif tag == 219 then
+    local n = get(s, pos, 4)
+    return sub(s, pos + 4, pos + 3 + n), pos + 4 + n
+  elseif tag == 220 then return unpack_table(s, pos + 2, get(s, pos, 2), false)
+  elseif tag == 222 then return unpack_table(s, pos + 2, get(s, pos, 2), true)
+  end
+  error("unsupported type " .. tag)
+end
+
+function lua_unpack(s)
+  return (unpack_value(s, 1))
+end
+'''
+
+# Records like the structured payloads scripts exchange.
+PAYLOAD = '''
+local payload = {{}}
+for i = 1, {records} do
+  payload[i] = {{
+    id = i, name = "record-" .. i, score = i / 7, offset = -i,
+    active = i % 2 == 0, tags = {{"alpha", "beta", i % 10}},
+  }}
+end
+local encoded = codec.pack(payload)
+assert(lua_pack(payload) == encoded)
+'''
+
+OPERATIONS = {
+    'pack': ('codec.pack(payload)', 'lua_pack(payload)'),
+    'unpack': ('codec.unpack(encoded)', 'lua_unpack(encoded)'),
+}
+
+
+def time_script(exe, source, iterations):
+    with tempfile.NamedTemporaryFile('w', suffix='.lua') as f:
+        f.write(source)
+        f.flush()
+        samples = []
+        for _ in range(iterations):
+            start = time.perf_counter()
+            subprocess.run([exe, '-t', '0', '-m', '0', f.name], check=True)
+            samples.append(time.perf_counter() - start)
+    return statistics.median(samples)
+
+
+def per_operation(exe, statement, records, count, iterations):
+    # Subtract startup and building the payload by also timing a run without the statement.
+    setup = PURE_LUA + PAYLOAD.format(records=records)
+    loop = 'for _ = 1, {} do local _ = {} end\n'
+    base = time_script(exe, setup + loop.format(0, statement), iterations)
+    total = time_script(exe, setup + loop.format(count, statement), iterations)
+    return (total - base) / count
+
+
+def main():
+    this_dir = os.path.dirname(os.path.abspath(__file__))
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--exe', default=os.path.join(this_dir, '..', 'bin', 'exe'))
+    parser.add_argument('--iterations', '-n', type=int, default=5)
+    parser.add_argument('--records', type=int, default=10000)
+    parser.add_argument('--count', type=int, default=20)
+    args = parser.parse_args()
+
+    for name, (native, pure) in sorted(OPERATIONS.items()):
+        native_cost = per_operation(args.exe, native, args.records, args.count, args.iterations)
+        pure_cost = per_operation(args.exe, pure, args.records, args.count, args.iterations)
+        print('{:<7} codec {:8.2f} ms   pure Lua {:8.2f} ms   {:5.1f}x'.format(
+            name, native_cost * 1e3, pure_cost * 1e3, pure_cost / native_cost))
+
+
+if __name__ == '__main__':
+    main()
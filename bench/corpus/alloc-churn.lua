@@ -0,0 +1,25 @@
+--! luajit-sandbox -m 100 -t 0
+-- Allocation-heavy workload for the Lua heap allocator: small tables, strings of all sizes
+-- and a growing array like SLOW-memory.lua. To count the memory system calls, run it under
+-- `strace -c -e trace=memory`.
+local iterations = 100
+
+local live = {}
+for i = 1, iterations do
+  -- Lots of short-lived small objects.
+  for j = 1, 20000 do
+    local t = {j, j + 1, name = "item"}
+    live[j % 512 + 1] = t
+  end
+  -- Strings of all sizes, some of them big enough to be mapped individually.
+  local parts = {}
+  for j = 1, 64 do
+    parts[j] = string.rep("x", j * 97 + i)
+  end
+  live.big = table.concat(parts) .. string.rep("y", 256 * 1024 + i)
+  -- A table that keeps growing and is then dropped.
+  local grow = {}
+  for j = 1, 50000 do grow[j] = j end
+end
+
+print("iterations " .. iterations)
@@ -0,0 +1,2 @@
+--! luajit-sandbox
+-- Intentionally empty: measures starting bin/exe, setting up the sandbox and the VM.
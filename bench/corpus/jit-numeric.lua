@@ -0,0 +1,35 @@
+--! luajit-sandbox -t 0
+-- Numeric loops the JIT compiler should turn into tight machine code: a sieve and a
+-- Mandelbrot set. Each iteration is one inner loop step.
+local iterations = 0
+
+local size = 2000000
+local sieve = {}
+for i = 2, size do sieve[i] = true end
+for i = 2, size do
+  if sieve[i] then
+    for j = i * i, size, i do
+      sieve[j] = false
+      iterations = iterations + 1
+    end
+  end
+end
+
+local width, height, limit = 800, 800, 50
+local inside = 0
+for y = 0, height - 1 do
+  local ci = 2 * y / height - 1
+  for x = 0, width - 1 do
+    local cr = 2.5 * x / width - 2
+    local zr, zi, n = 0, 0, 0
+    while n < limit and zr * zr + zi * zi < 4 do
+      zr, zi = zr * zr - zi * zi + cr, 2 * zr * zi + ci
+      n = n + 1
+    end
+    iterations = iterations + n
+    if n == limit then inside = inside + 1 end
+  end
+end
+assert(inside > 0)
+
+print("iterations " .. iterations)
@@ -0,0 +1,27 @@
+--! luajit-sandbox -t 0
+-- One task spawns many short-lived tasks that each yield a few times, then joins them all.
+-- Each iteration is one task.
+local tasks = 20000
+local rounds = 10
+
+local scheduler = resumer.Scheduler()
+
+local function worker(n)
+  for i = 1, rounds do scheduler:yield() end
+  return n
+end
+
+scheduler:spawn(function ()
+  local children = {}
+  for i = 1, tasks do
+    children[i] = scheduler:spawn(worker, i)
+  end
+  local sum = 0
+  for i = 1, tasks do
+    sum = sum + scheduler:join(children[i])
+  end
+  assert(sum == tasks * (tasks + 1) / 2)
+end)
+scheduler:run()
+
+print("iterations " .. tasks)
@@ -0,0 +1,11 @@
+--! luajit-sandbox -t 0
+-- Switches between the main thread and one Resumer. Each iteration is a round trip.
+local iterations = 2000000
+
+local pong
+pong = resumer.Resumer(function (value)
+  while true do value = pong(value) end
+end)
+for i = 1, iterations do pong(i) end
+
+print("iterations " .. iterations)
@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+"""Compare per-slice latency of Resumer threads with and without resumer.gc_budget()."""
+
+import argparse
+import json
+import os
+import statistics
+import subprocess
+import tempfile
+
+# Each Resumer handles a request per slice: it builds some garbage and keeps a little of it,
+# so the heap grows and the collector has real work. A slice's latency is the time charged to
+# its thread, which includes any collector steps its allocations set off.
+SCRIPT = '''
+resumer.gc_budget({budget})
+local kept, workers = {{}}, {{}}
+for w = 1, {workers} do
+  local self
+  self = resumer.Resumer(function ()
+    local n = 0
+    while true do
+      n = n + 1
+      local rows = {{}}
+      for i = 1, {rows} do rows[i] = {{id = i, name = "row" .. i, tags = {{w, n}}}} end
+      kept[#kept + 1] = rows[n % #rows + 1]
+      if #kept > {retained} then kept[#kept - {retained}] = false end
+      self()
+    end
+  end)
+  workers[w] = self
+end
+local samples, usage = {{}}, resumer.usage
+for round = 1, {rounds} do
+  for w = 1, #workers do
+    local r = workers[w]
+    local before = usage(r)
+    r()
+    -- Leave out the first rounds, where the JIT compiler is still at work.
+    if round > {warmup} then samples[#samples + 1] = usage(r) - before end
+  end
+end
+table.sort(samples)
+local function at(p) return samples[math.max(1, math.ceil(#samples * p))] end
+print(at(0.5), at(0.99), samples[#samples])
+'''
+
+
+def run(exe, budget, args, script_path):
+    with open(script_path, 'w') as f:
+        f.write(SCRIPT.format(budget=budget, workers=args.workers, rows=args.rows,
+                              retained=args.retained, rounds=args.rounds,
+                              warmup=args.rounds // 10))
+    results = []
+    for _ in range(args.iterations):
+        read_end, write_end = os.pipe()
+        proc = subprocess.Popen([exe, '-t', '0', '-m', '0', '--stats-fd', str(write_end),
+                                 script_path], stdout=subprocess.PIPE, pass_fds=(write_end,))
+        os.close(write_end)
+        output = proc.stdout.read()
+        with os.fdopen(read_end) as f:
+            stats = json.loads(f.read())
+        if proc.wait() != 0:
+            raise RuntimeError('failed with gc_budget {}'.format(budget))
+        p50, p99, worst = (float(x) * 1000 for x in output.split())
+        # Collecting between slices isn't free either, so the whole run and the heap show what
+        # it costs.
+        results.append((p50, p99, worst, stats['run_us'] / 1000,
+                        stats['heap_peak_bytes'] / (1 << 20)))
+    # Each one's median over the runs, since the worst slice is at the mercy of the machine.
+    return [statistics.median(r[i] for r in results) for i in range(5)]
+
+
+def main():
+    this_dir = os.path.dirname(os.path.abspath(__file__))
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--exe', default=os.path.join(this_dir, '..', 'bin', 'exe'))
+    parser.add_argument('--iterations', '-n', type=int, default=5)
+    parser.add_argument('--workers', type=int, default=8)
+    parser.add_argument('--rows', type=int, default=200)
+    parser.add_argument('--retained', type=int, default=20000)
+    parser.add_argument('--rounds', type=int, default=2000)
+    parser.add_argument('--budgets', default='0 50 200 1000',
+                        help='Values of resumer.gc_budget() to compare, in microseconds, '
+                             'separated by spaces. 0 leaves collection to the collector.')
+    args = parser.parse_args()
+
+    with tempfile.TemporaryDirectory() as tmp:
+        script_path = os.path.join(tmp, 'slices.lua')
+        for budget in args.budgets.split():
+            p50, p99, worst, run_ms, peak_mib = run(args.exe, budget, args, script_path)
+            print('gc_budget {:>6} us  p50 {:8.1f} us  p99 {:8.1f} us  max {:8.1f} us  '
+                  'run {:8.1f} ms  heap peak {:6.1f} MiB'.format(
+                      budget, p50, p99, worst, run_ms, peak_mib))
+
+
+if __name__ == '__main__':
+    main()
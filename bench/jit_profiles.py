@@ -0,0 +1,132 @@
+#!/usr/bin/env python3
+"""Compare --jit profiles on a short-lived script and a long-running numeric one."""
+
+import argparse
+import json
+import os
+import statistics
+import subprocess
+import tempfile
+
+# Two kinds of typical request handling, about a millisecond each. Validating, sorting and
+# summarizing a small batch of records compiles well. Parsing text with string patterns mostly
+# aborts, since the recorder doesn't handle those library functions.
+RECORDS = '''
+local records = {}
+for i = 1, 300 do
+  records[i] = {id = i, price = (i * 7919) % 1000 / 10, qty = i % 7, tag = i % 3 == 0 and "a" or "b"}
+end
+local function valid(r)
+  return r.qty > 0 and r.price >= 1 and (r.tag == "a" or r.tag == "b")
+end
+local function insertion_sort(list, key)
+  for i = 2, #list do
+    local v, j = list[i], i - 1
+    while j >= 1 and list[j][key] > v[key] do list[j + 1] = list[j]; j = j - 1 end
+    list[j + 1] = v
+  end
+end
+local kept = {}
+for _, r in ipairs(records) do if valid(r) then kept[#kept + 1] = r end end
+insertion_sort(kept, "price")
+local totals = {a = 0, b = 0}
+for _, r in ipairs(kept) do
+  local amount = r.price * r.qty
+  if amount > 200 then amount = amount * 0.9 end
+  totals[r.tag] = totals[r.tag] + amount
+end
+print(#kept, math.floor(totals.a), math.floor(totals.b))
+'''
+
+PARSING = '''
+local rows = {}
+for i = 1, 40 do rows[i] = i .. "," .. (i * 7 % 13) .. "," .. (i * 0.25) end
+local text = table.concat(rows, "\\n")
+local function checksum(s)
+  local h = 0
+  for i = 1, #s do h = (h * 31 + s:byte(i)) % 4294967296 end
+  return h
+end
+local total = 0
+for round = 1, 10 do
+  for line in text:gmatch("[^\\n]+") do
+    local a, b, c = line:match("(%d+),(%d+),([%d.]+)")
+    total = total + a * b + c + checksum(line)
+  end
+end
+print(total)
+'''
+
+
+def long_script(kernels):
+    # Many distinct numeric kernels, each with a loop and a branch that gets a side trace,
+    # called from an outer loop, so the whole program keeps more traces than the default
+    # maxtrace=1000 and more machine code than maxmcode=512 KiB allows.
+    lines = ['local kernels = {}\n']
+    for i in range(kernels):
+        lines.append(
+            'kernels[{0}] = function(n)\n'
+            '  local s = {0}\n'
+            '  for j = 1, n do\n'
+            '    if j % {1} == 0 then s = s - j * {2} else s = s + j / {3} end\n'
+            '  end\n'
+            '  return s\n'
+            'end\n'.format(i + 1, i % 5 + 2, i % 3 + 1, i % 7 + 1))
+    lines.append('local total = 0\n'
+                 'for round = 1, {rounds} do\n'
+                 '  for i = 1, #kernels do total = total + kernels[i](1000) end\n'
+                 'end\n'
+                 'print(total)\n')
+    return ''.join(lines)
+
+
+def run(exe, profile, script_path, iterations):
+    command = [exe, '-t', '0', '-m', '0']
+    if profile != 'default':
+        command += ['--jit', profile]
+    run_ms = []
+    stats = None
+    for _ in range(iterations):
+        read_end, write_end = os.pipe()
+        proc = subprocess.Popen(command + ['--stats-fd', str(write_end), script_path],
+                                stdout=subprocess.DEVNULL, pass_fds=(write_end,))
+        os.close(write_end)
+        with os.fdopen(read_end) as f:
+            stats = json.loads(f.read())
+        if proc.wait() != 0:
+            raise RuntimeError('{} failed with --jit {}'.format(script_path, profile))
+        # Only the time running the script, which starting the process would drown out.
+        run_ms.append(stats['run_us'] / 1000)
+    return statistics.median(run_ms), stats
+
+
+def main():
+    this_dir = os.path.dirname(os.path.abspath(__file__))
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--exe', default=os.path.join(this_dir, '..', 'bin', 'exe'))
+    parser.add_argument('--iterations', '-n', type=int, default=20)
+    parser.add_argument('--kernels', type=int, default=400)
+    parser.add_argument('--rounds', type=int, default=100)
+    parser.add_argument('--profiles', default='default off short-lived throughput',
+                        help='Values of --jit to compare, separated by spaces.')
+    args = parser.parse_args()
+
+    scripts = [('records', RECORDS, args.iterations),
+               ('parsing', PARSING, args.iterations),
+               ('long', long_script(args.kernels).replace('{rounds}', str(args.rounds)),
+                max(1, args.iterations // 10))]
+    with tempfile.TemporaryDirectory() as tmp:
+        for name, source, iterations in scripts:
+            script_path = os.path.join(tmp, name + '.lua')
+            with open(script_path, 'w') as f:
+                f.write(source)
+            for profile in args.profiles.split():
+                run_ms, stats = run(args.exe, profile, script_path, iterations)
+                print('{:<8} {:<12} {:9.2f} ms  {:5d} traces  {:5d} aborts  {:3d} flushes  '
+                      '{:8d} mcode bytes'.format(
+                          name, profile, run_ms, stats['jit_traces'], stats['jit_aborts'],
+                          stats['jit_flushes'], stats['jit_mcode_bytes']))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+"""Measure how bin/exe --batch --jobs N scales across cores, and its tail latency.
+
+Throughput runs every bench/corpus script a number of times for each worker count. The
+latency run mixes many copies of the empty cold-start script with a few long ones, and
+reports when each short script's results arrive, with --completion-order.
+"""
+
+import argparse
+import glob
+import os
+import statistics
+import struct
+import subprocess
+import tempfile
+import time
+
+FRAME = struct.Struct('=IIII')  # struct server_frame
+FRAME_EXIT = 3
+
+
+def run_batch(exe, manifest, jobs, extra=()):
+    """Run a batch and return {script id: seconds from start until its exit frame}."""
+    command = [exe, '-t', '0', '-m', '0', '--batch', manifest, '--jobs', str(jobs)]
+    start = time.perf_counter()
+    proc = subprocess.Popen(command + list(extra), stdout=subprocess.PIPE)
+    finished = {}
+    while True:
+        header = proc.stdout.read(FRAME.size)
+        if not header:
+            break
+        frame_id, frame_type, length, _ = FRAME.unpack(header)
+        payload = proc.stdout.read(length)
+        if frame_type == FRAME_EXIT:
+            assert struct.unpack('=i', payload)[0] == 0, 'script {} failed'.format(frame_id)
+            finished[frame_id] = time.perf_counter() - start
+    if proc.wait() != 0:
+        raise RuntimeError('bin/exe --batch failed')
+    return finished
+
+
+def write_manifest(path, scripts):
+    with open(path, 'w') as f:
+        f.write(''.join(script + '\n' for script in scripts))
+
+
+def percentile(samples, fraction):
+    samples = sorted(samples)
+    return samples[min(len(samples) - 1, int(len(samples) * fraction))]
+
+
+def main():
+    this_dir = os.path.dirname(os.path.abspath(__file__))
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--exe', default=os.path.join(this_dir, '..', 'bin', 'exe'))
+    parser.add_argument('--repeat', '-n', type=int, default=8,
+                        help='Copies of each corpus script in the throughput batch.')
+    parser.add_argument('--max-jobs', type=int, default=os.cpu_count())
+    args = parser.parse_args()
+
+    corpus = sorted(glob.glob(os.path.join(this_dir, 'corpus', '*.lua')))
+    short = os.path.join(this_dir, 'corpus', 'cold-start.lua')
+    long = os.path.join(this_dir, 'corpus', 'alloc-churn.lua')
+    jobs = [1]
+    while jobs[-1] * 2 <= args.max_jobs:
+        jobs.append(jobs[-1] * 2)
+    if jobs[-1] != args.max_jobs:
+        jobs.append(args.max_jobs)
+
+    with tempfile.TemporaryDirectory() as tmp:
+        manifest = os.path.join(tmp, 'throughput')
+        write_manifest(manifest, corpus * args.repeat)
+        base = None
+        for n in jobs:
+            elapsed = max(run_batch(args.exe, manifest, n, ['--pin-cpus']).values())
+            base = base or elapsed
+            print('jobs {:3}: {:8.1f} scripts/s   speedup {:5.2f}'.format(
+                n, len(corpus) * args.repeat / elapsed, base / elapsed))
+
+        # One long script for every 20 short ones.
+        mixed = ([long] + [short] * 20) * max(1, args.repeat)
+        manifest = os.path.join(tmp, 'mixed')
+        write_manifest(manifest, mixed)
+        for n in jobs:
+            finished = run_batch(args.exe, manifest, n, ['--completion-order'])
+            samples = [finished[i + 1] for i, script in enumerate(mixed) if script == short]
+            print('jobs {:3}: short scripts done after p50 {:8.1f} ms  p99 {:8.1f} ms'.format(
+                n, statistics.median(samples) * 1e3, percentile(samples, 0.99) * 1e3))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,60 @@
+#!/usr/bin/env python3
+"""Count the write system calls a script makes per KiB of output it prints."""
+
+import argparse
+import os
+import subprocess
+import tempfile
+import time
+
+# The script flushes and waits on stdin at the end, so its counters can be read before it exits.
+SCRIPT = '''
+{setup}
+for i = 1, {lines} do print("line", i, "of some output") end
+print("END")
+io.stdout:flush()
+io.read()
+'''
+
+MODES = {
+    'default': '',
+    'setvbuf "no"': 'io.stdout:setvbuf "no"',
+}
+
+
+def measure(exe, setup, lines):
+    with tempfile.NamedTemporaryFile('w', suffix='.lua') as f:
+        f.write(SCRIPT.format(setup=setup, lines=lines))
+        f.flush()
+        start = time.perf_counter()
+        proc = subprocess.Popen([exe, '-t', '0', '-m', '0', f.name],
+                                stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+        size = 0
+        for line in proc.stdout:
+            size += len(line)
+            if line == b'END\n':
+                break
+        elapsed = time.perf_counter() - start
+        with open('/proc/{}/io'.format(proc.pid)) as io:
+            counters = dict(line.split(': ') for line in io.read().splitlines())
+        proc.stdin.close()
+        proc.stdout.read()
+        proc.wait()
+    return int(counters['syscw']), size, elapsed
+
+
+def main():
+    this_dir = os.path.dirname(os.path.abspath(__file__))
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--exe', default=os.path.join(this_dir, '..', 'bin', 'exe'))
+    parser.add_argument('--lines', type=int, default=100000)
+    args = parser.parse_args()
+
+    for name, setup in sorted(MODES.items()):
+        writes, size, elapsed = measure(args.exe, setup, args.lines)
+        print('{:<13} {:8d} writes  {:8.1f} KiB  {:7.3f} writes/KiB  {:6.3f} s'.format(
+            name, writes, size / 1024, writes / (size / 1024), elapsed))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,67 @@
+#!/usr/bin/env python3
+"""Compare a script that inlines a utility library with one that requires it from the prelude."""
+
+import argparse
+import json
+import os
+import statistics
+import subprocess
+import tempfile
+
+USE = '''
+local doc = json.decode('{"id": 7, "tags": ["a", "b"], "price": 12.5, "ok": true}')
+doc.tags[#doc.tags + 1] = "c"
+print(json.encode(doc.tags), doc.price)
+'''
+
+
+def scripts(library):
+    inlined = 'local json = (function (...)\n' + library + '\nend)("json")\n' + USE
+    required = 'local json = require "json"\n' + USE
+    return [('inlined', inlined), ('required', required)]
+
+
+def run(exe, options, script_path, iterations):
+    load_us, total_us = [], []
+    for _ in range(iterations):
+        read_end, write_end = os.pipe()
+        proc = subprocess.Popen([exe, '-t', '0', '-m', '0'] + options +
+                                ['--stats-fd', str(write_end), script_path],
+                                stdout=subprocess.DEVNULL, pass_fds=(write_end,))
+        os.close(write_end)
+        with os.fdopen(read_end) as f:
+            stats = json.loads(f.read())
+        if proc.wait() != 0:
+            raise RuntimeError('{} failed'.format(script_path))
+        load_us.append(stats['load_us'])
+        # Requiring the module happens while running, so the two only compare fairly together.
+        total_us.append(stats['load_us'] + stats['run_us'])
+    return statistics.median(load_us), statistics.median(total_us)
+
+
+def main():
+    this_dir = os.path.dirname(os.path.abspath(__file__))
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--exe', default=os.path.join(this_dir, '..', 'bin', 'exe'))
+    parser.add_argument('--iterations', '-n', type=int, default=200)
+    parser.add_argument('--library', default=os.path.join(this_dir, '..', 'prelude', 'json.lua'),
+                        help='The prelude module to inline. The script uses it as json.')
+    args = parser.parse_args()
+
+    with open(args.library) as f:
+        library = f.read()
+    with tempfile.TemporaryDirectory() as tmp:
+        cache_dir = os.path.join(tmp, 'cache')
+        os.mkdir(cache_dir)
+        for name, source in scripts(library):
+            script_path = os.path.join(tmp, name + '.lua')
+            with open(script_path, 'w') as f:
+                f.write(source)
+            for mode, options in [('', []), (' (cache)', ['--cache-dir', cache_dir])]:
+                load_us, total_us = run(args.exe, options, script_path, args.iterations)
+                print('{:<18} {:6d} bytes  load {:7.1f} us  load+run {:7.1f} us'.format(
+                    name + mode, len(source.encode('utf-8')), load_us, total_us))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+"""Measure Resumer ping-pong switch latency and create/destroy throughput."""
+
+import argparse
+import os
+import statistics
+import subprocess
+import tempfile
+import time
+
+# Each round trip is two switches: main thread -> Resumer thread -> main thread.
+PING_PONG = '''
+resumer.pool_size({pool_size})
+local pong
+pong = resumer.Resumer(function (value)
+  while true do value = pong(value) end
+end)
+{setup}
+for i = 1, {count} do pong(i) end
+'''
+
+CREATE = '''
+resumer.pool_size({pool_size})
+local function body(value) return value end
+for i = 1, {count} do resumer.Resumer(body)(i) end
+'''
+
+
+def time_script(exe, source, iterations):
+    with tempfile.NamedTemporaryFile('w', suffix='.lua') as f:
+        f.write(source)
+        f.flush()
+        samples = []
+        for _ in range(iterations):
+            start = time.perf_counter()
+            subprocess.run([exe, '-t', '0', '-m', '0', f.name], check=True)
+            samples.append(time.perf_counter() - start)
+    return statistics.median(samples)
+
+
+def per_operation(exe, template, count, pool_size, iterations, setup=''):
+    # Subtract startup by also timing an empty run.
+    base = time_script(exe, template.format(count=0, pool_size=pool_size, setup=setup),
+                       iterations)
+    total = time_script(exe, template.format(count=count, pool_size=pool_size, setup=setup),
+                        iterations)
+    return (total - base) / count
+
+
+def main():
+    this_dir = os.path.dirname(os.path.abspath(__file__))
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--exe', default=os.path.join(this_dir, '..', 'bin', 'exe'))
+    parser.add_argument('--iterations', '-n', type=int, default=5)
+    parser.add_argument('--count', type=int, default=1000000)
+    args = parser.parse_args()
+
+    for pool_size in (0, 64):
+        latency = per_operation(args.exe, PING_PONG, args.count, pool_size, args.iterations)
+        print('pool_size={:<3} ping-pong      {:8.1f} ns per switch'.format(
+            pool_size, latency / 2 * 1e9))
+        cost = per_operation(args.exe, CREATE, args.count, pool_size, args.iterations)
+        print('pool_size={:<3} create+finish  {:8.0f} Resumers/s'.format(pool_size, 1 / cost))
+
+    # Every switch charges the Resumer's account; quotas add a check on top.
+    latency = per_operation(args.exe, PING_PONG, args.count, 64, args.iterations,
+                            'resumer.set_quota(pong, 1e9, 1e15)')
+    print('with quotas    ping-pong      {:8.1f} ns per switch'.format(latency / 2 * 1e9))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,84 @@
+#!/usr/bin/env python3
+"""Compare task switches per second of resumer.Scheduler against a scheduler written in Lua."""
+
+import argparse
+import os
+import statistics
+import subprocess
+import tempfile
+import time
+
+# The same round-robin workload: `tasks` green threads that each yield `rounds` times.
+
+NATIVE = '''
+local scheduler = resumer.Scheduler()
+local function worker(rounds)
+  for i = 1, rounds do scheduler:yield() end
+end
+for i = 1, {tasks} do scheduler:spawn(worker, {rounds}) end
+scheduler:run()
+'''
+
+# Modelled on the hand-rolled schedulers in tests/resumer/, with a FIFO ready queue.
+LUA = '''
+local queue, head, tail = {{}}, 1, 0
+local current
+local function yield()
+  tail = tail + 1
+  queue[tail] = current
+  current.resumer()
+end
+local function spawn(f, ...)
+  local args = {{...}}
+  local thread = {{}}
+  thread.resumer = resumer.Resumer(function ()
+    f(unpack(args))
+  end)
+  tail = tail + 1
+  queue[tail] = thread
+end
+local function worker(rounds)
+  for i = 1, rounds do yield() end
+end
+for i = 1, {tasks} do spawn(worker, {rounds}) end
+while head <= tail do
+  current = queue[head]
+  queue[head] = nil
+  head = head + 1
+  current.resumer()
+end
+'''
+
+
+def time_script(exe, source, iterations):
+    with tempfile.NamedTemporaryFile('w', suffix='.lua') as f:
+        f.write(source)
+        f.flush()
+        samples = []
+        for _ in range(iterations):
+            start = time.perf_counter()
+            subprocess.run([exe, '-t', '0', '-m', '0', f.name], check=True)
+            samples.append(time.perf_counter() - start)
+    return statistics.median(samples)
+
+
+def main():
+    this_dir = os.path.dirname(os.path.abspath(__file__))
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--exe', default=os.path.join(this_dir, '..', 'bin', 'exe'))
+    parser.add_argument('--iterations', '-n', type=int, default=5)
+    parser.add_argument('--tasks', type=int, default=1000)
+    parser.add_argument('--rounds', type=int, default=1000)
+    args = parser.parse_args()
+
+    switches = args.tasks * args.rounds
+    for name, template in (('lua', LUA), ('native', NATIVE)):
+        # Subtract the cost of starting up and spawning, measured with no rounds.
+        base = time_script(args.exe, template.format(tasks=args.tasks, rounds=0), args.iterations)
+        total = time_script(args.exe, template.format(tasks=args.tasks, rounds=args.rounds),
+                            args.iterations)
+        print('{:8} {:12.0f} switches/s'.format(name, switches / max(total - base, 1e-9)))
+
+
+if __name__ == '__main__':
+    main()
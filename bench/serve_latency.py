@@ -0,0 +1,80 @@
+#!/usr/bin/env python3
+"""Compare per-script latency of one-shot bin/exe against bin/exe --serve."""
+
+import argparse
+import os
+import statistics
+import struct
+import subprocess
+import time
+
+REQUEST = struct.Struct('=IIQII')  # struct server_request
+FRAME = struct.Struct('=IIII')     # struct server_frame
+FRAME_STDOUT, FRAME_STDERR, FRAME_EXIT = 1, 2, 3
+
+
+def read_exactly(f, size):
+    data = f.read(size)
+    if len(data) != size:
+        raise EOFError('server closed its output')
+    return data
+
+
+def serve_request(proc, request_id, script, max_memory=50 << 20, max_cpu_time=1, max_cpu_ms=0):
+    """Send one request and collect (exit code, stdout, stderr)."""
+    proc.stdin.write(REQUEST.pack(request_id, len(script), max_memory, max_cpu_time,
+                                   max_cpu_ms) + script)
+    proc.stdin.flush()
+    output = {FRAME_STDOUT: b'', FRAME_STDERR: b''}
+    while True:
+        frame_id, frame_type, length, _ = FRAME.unpack(read_exactly(proc.stdout, FRAME.size))
+        assert frame_id == request_id
+        payload = read_exactly(proc.stdout, length)
+        if frame_type == FRAME_EXIT:
+            return struct.unpack('=i', payload)[0], output[FRAME_STDOUT], output[FRAME_STDERR]
+        output[frame_type] += payload
+
+
+def one_shot(exe, script):
+    proc = subprocess.run([exe], input=script, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    return proc.returncode, proc.stdout, proc.stderr
+
+
+def summarize(name, samples):
+    samples = sorted(samples)
+    p99 = samples[min(len(samples) - 1, int(len(samples) * 0.99))]
+    print('{:10} mean {:8.3f} ms   p50 {:8.3f} ms   p99 {:8.3f} ms'.format(
+        name, statistics.mean(samples) * 1e3, statistics.median(samples) * 1e3, p99 * 1e3))
+
+
+def main():
+    this_dir = os.path.dirname(os.path.abspath(__file__))
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--exe', default=os.path.join(this_dir, '..', 'bin', 'exe'))
+    parser.add_argument('--iterations', '-n', type=int, default=200)
+    parser.add_argument('--script', default='print "hello"\n')
+    args = parser.parse_args()
+    script = args.script.encode('utf-8')
+
+    samples = []
+    for _ in range(args.iterations):
+        start = time.perf_counter()
+        one_shot(args.exe, script)
+        samples.append(time.perf_counter() - start)
+    summarize('one-shot', samples)
+
+    proc = subprocess.Popen([args.exe, '--serve'], stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+    samples = []
+    try:
+        for i in range(args.iterations):
+            start = time.perf_counter()
+            serve_request(proc, i, script)
+            samples.append(time.perf_counter() - start)
+    finally:
+        proc.stdin.close()
+        proc.wait()
+    summarize('serve', samples)
+
+
+if __name__ == '__main__':
+    main()
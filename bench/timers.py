@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+"""Measure Scheduler timers: the cost of arming and expiring many, and CPU use while asleep."""
+
+import argparse
+import os
+import subprocess
+import tempfile
+import time
+
+# Every task sleeps until about the same time, spread over 10 ms so no two deadlines are equal.
+# The last task spawned runs after all the others have armed their timers.
+SCRIPT = '''
+local scheduler = resumer.Scheduler()
+local left = {timers}
+for i = 1, {timers} do
+  scheduler:spawn(function ()
+    scheduler:sleep({delay_ms} + (i * 7919 % {timers}) * 10 / {timers})
+    left = left - 1
+    if left == 0 then
+      print "expired"
+      io.stdout:flush()
+    end
+  end)
+end
+scheduler:spawn(function ()
+  print "armed"
+  io.stdout:flush()
+end)
+print "start"
+io.stdout:flush()
+scheduler:run()
+io.read()
+'''
+
+
+def cpu_ns(pid):
+    # The first field is the time the (single) thread has spent on a CPU, in nanoseconds.
+    with open('/proc/{}/schedstat'.format(pid)) as f:
+        return int(f.read().split()[0])
+
+
+def main():
+    this_dir = os.path.dirname(os.path.abspath(__file__))
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--exe', default=os.path.join(this_dir, '..', 'bin', 'exe'))
+    parser.add_argument('--timers', type=int, default=100000)
+    parser.add_argument('--delay-ms', type=int, default=2000)
+    args = parser.parse_args()
+
+    with tempfile.NamedTemporaryFile('w', suffix='.lua') as f:
+        f.write(SCRIPT.format(timers=args.timers, delay_ms=args.delay_ms))
+        f.flush()
+        proc = subprocess.Popen([args.exe, '-t', '0', '-m', '0', f.name],
+                                stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+        assert proc.stdout.readline() == b'start\n'
+        start = cpu_ns(proc.pid)
+        assert proc.stdout.readline() == b'armed\n'
+        armed = cpu_ns(proc.pid)
+        # Sample the idle period well before the first deadline.
+        idle_seconds = args.delay_ms / 2000
+        time.sleep(idle_seconds)
+        idle = cpu_ns(proc.pid)
+        assert proc.stdout.readline() == b'expired\n'
+        expired = cpu_ns(proc.pid)
+        proc.stdin.close()
+        proc.wait()
+
+    print('{} timers'.format(args.timers))
+    print('arm:    {:8.1f} ms CPU  {:6.0f} ns/timer (with the first resume of its task)'.format(
+        (armed - start) / 1e6, (armed - start) / args.timers))
+    print('idle:   {:8.3f} ms CPU over {:.1f} s asleep'.format((idle - armed) / 1e6, idle_seconds))
+    print('expire: {:8.1f} ms CPU  {:6.0f} ns/timer (with resuming the task)'.format(
+        (expired - idle) / 1e6, (expired - idle) / args.timers))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,166 @@
+#!/usr/bin/env python3
+
+import argparse
+import json
+import os
+import shlex
+import statistics
+import subprocess
+import sys
+import time
+
+
+def percentile(samples, fraction):
+    samples = sorted(samples)
+    return samples[min(len(samples) - 1, int(len(samples) * fraction))]
+
+
+def summarize(samples):
+    return {
+        'min': min(samples),
+        'p50': statistics.median(samples),
+        'p90': percentile(samples, 0.9),
+        'max': max(samples),
+        'mean': statistics.mean(samples),
+    }
+
+
+class BenchmarkError(Exception):
+    pass
+
+
+class MeasuredPopen(subprocess.Popen):
+    """A Popen that reaps its child with wait4(), to keep the child's resource usage."""
+
+    rusage = None
+
+    def _try_wait(self, wait_flags):
+        pid, status, rusage = os.wait4(self.pid, wait_flags)
+        if pid == self.pid:
+            self.rusage = rusage
+        return pid, status
+
+
+class BenchmarkRunner(object):
+    """Runs each Lua script of a corpus repeatedly and collects resource usage.
+
+    Like the tests, a script may give its command line in a first line starting with `--!`.
+    A script reports how much work it did by printing a line `iterations N`; otherwise it
+    counts as one iteration.
+    """
+
+    def __init__(self, exe, runs):
+        self.exe = exe
+        self.runs = runs
+
+    def command(self, path):
+        with open(path) as f:
+            first_line = f.readline()
+        options = [self.exe]
+        if '!' in first_line[:3]:
+            options = shlex.split(first_line.split('!', 1)[1])
+        return options + [path]
+
+    def run_once(self, command):
+        start = time.perf_counter()
+        proc = MeasuredPopen(command, executable=self.exe, stdin=subprocess.DEVNULL,
+                             stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+        # Reads both pipes at once, so a script that fills one can't block on it.
+        stdout, stderr = proc.communicate()
+        wall = time.perf_counter() - start
+        rusage = proc.rusage
+        if proc.returncode != 0:
+            raise BenchmarkError('exited with status {}:\n{}'.format(
+                proc.returncode, stderr.decode('utf-8', 'replace')))
+        iterations = 1
+        for line in stdout.decode('utf-8', 'replace').splitlines():
+            if line.startswith('iterations '):
+                iterations = int(line.split()[1])
+        return {
+            'wall_s': wall,
+            'cpu_s': rusage.ru_utime + rusage.ru_stime,
+            'max_rss_kb': rusage.ru_maxrss,
+            'iterations': iterations,
+        }
+
+    def run(self, path):
+        command = self.command(path)
+        samples = [self.run_once(command) for _ in range(self.runs)]
+        result = {'runs': self.runs, 'iterations': samples[0]['iterations']}
+        for key in ('wall_s', 'cpu_s', 'max_rss_kb'):
+            result[key] = summarize([sample[key] for sample in samples])
+        result['iterations_per_s'] = summarize(
+            [sample['iterations'] / sample['wall_s'] for sample in samples])
+        return result
+
+
+def find_benchmarks(path):
+    if os.path.isfile(path):
+        return [path]
+    return sorted(
+        os.path.join(path, filename) for filename in os.listdir(path) if filename.endswith('.lua')
+    )
+
+
+def compare(results, baseline, threshold):
+    """Print median wall times next to the baseline's. Returns the names that got slower."""
+    regressions = []
+    for name, result in sorted(results.items()):
+        if name not in baseline:
+            print('{:24} {:10.4f} s   (no baseline)'.format(name, result['wall_s']['p50']),
+                  file=sys.stderr)
+            continue
+        before = baseline[name]['wall_s']['p50']
+        after = result['wall_s']['p50']
+        change = after / before - 1
+        flag = ''
+        if change > threshold:
+            flag = '  REGRESSION'
+            regressions.append(name)
+        print('{:24} {:10.4f} s   baseline {:10.4f} s   {:+7.1%}{}'.format(
+            name, after, before, change, flag), file=sys.stderr)
+    return regressions
+
+
+def main():
+    this_dir = os.path.dirname(__file__)
+
+    parser = argparse.ArgumentParser(description='Run the benchmark corpus and report JSON.')
+    parser.add_argument(
+        'path', nargs='?', default=os.path.join(this_dir, 'bench', 'corpus'),
+        help='Path to a benchmark or a directory with benchmarks in it.'
+    )
+    parser.add_argument('--exe', default=os.path.join(this_dir, 'bin', 'exe'))
+    parser.add_argument('--runs', '-n', type=int, default=10, help='Runs of each benchmark.')
+    parser.add_argument('--output', '-o', help='Write the JSON report here instead of stdout.')
+    parser.add_argument('--baseline', help='Compare median wall times against this report.')
+    parser.add_argument('--threshold', type=float, default=0.25,
+                        help='Fail if a median wall time exceeds the baseline by this fraction.')
+    args = parser.parse_args()
+
+    results = {}
+    for path in find_benchmarks(args.path):
+        name = os.path.splitext(os.path.basename(path))[0]
+        try:
+            results[name] = BenchmarkRunner(args.exe, args.runs).run(path)
+        except BenchmarkError as e:
+            print('{}: {}'.format(name, e), file=sys.stderr)
+            return 1
+
+    report = json.dumps(results, indent=2, sort_keys=True)
+    if args.output:
+        with open(args.output, 'w') as f:
+            f.write(report + '\n')
+    else:
+        print(report)
+
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+        if compare(results, baseline, args.threshold):
+            return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,214 @@
+-- JSON encoding and decoding.
+--
+-- json.encode(value) turns nil/json.null, booleans, finite numbers, strings and tables into
+-- JSON text. A table is an array if its keys are exactly 1..n, or if it was marked with
+-- json.array(t), which is how an empty table becomes [] rather than {}. Any other table is an
+-- object, whose keys must be strings. json.decode(text) does the reverse, with json.null
+-- standing in for null, and marks the arrays it returns.
+
+local byte, char, concat, find, format, sub = string.byte, string.char, table.concat, string.find,
+  string.format, string.sub
+local floor, huge = math.floor, math.huge
+local getmetatable, pairs, setmetatable, tonumber, tostring, type = getmetatable, pairs,
+  setmetatable, tonumber, tostring, type
+
+local json = {}
+
+json.null = setmetatable({}, {__tostring = function () return "null" end})
+
+local array_mt = {}
+
+function json.array(t)
+  return setmetatable(t or {}, array_mt)
+end
+
+local escapes = {
+  ['"'] = '\\"', ["\\"] = "\\\\", ["\b"] = "\\b", ["\f"] = "\\f", ["\n"] = "\\n", ["\r"] = "\\r",
+  ["\t"] = "\\t",
+}
+
+local function escape(c)
+  return escapes[c] or format("\\u%04x", byte(c))
+end
+
+local encode_value
+
+local function encode_table(value, parts, depth)
+  if depth > 128 then error("json.encode: nested too deeply, or a table contains itself", 0) end
+  local n = #value
+  local count = 0
+  for _ in pairs(value) do count = count + 1 end
+  if count == n and (n > 0 or getmetatable(value) == array_mt) then
+    parts[#parts + 1] = "["
+    for i = 1, n do
+      if i > 1 then parts[#parts + 1] = "," end
+      encode_value(value[i], parts, depth + 1)
+    end
+    parts[#parts + 1] = "]"
+    return
+  end
+  parts[#parts + 1] = "{"
+  local first = true
+  for k, v in pairs(value) do
+    if type(k) ~= "string" then
+      error("json.encode: object keys must be strings, not " .. type(k), 0)
+    end
+    if not first then parts[#parts + 1] = "," end
+    first = false
+    parts[#parts + 1] = '"' .. k:gsub('[%c"\\]', escape) .. '":'
+    encode_value(v, parts, depth + 1)
+  end
+  parts[#parts + 1] = "}"
+end
+
+function encode_value(value, parts, depth)
+  local t = type(value)
+  if value == nil or value == json.null then
+    parts[#parts + 1] = "null"
+  elseif t == "boolean" then
+    parts[#parts + 1] = value and "true" or "false"
+  elseif t == "number" then
+    if value ~= value or value == huge or value == -huge then
+      error("json.encode: " .. tostring(value) .. " is not a JSON number", 0)
+    end
+    if value == floor(value) and value >= -2^53 and value <= 2^53 then
+      parts[#parts + 1] = format("%d", value)
+    else
+      -- The shortest of these that reads back as the same number.
+      local text = format("%.14g", value)
+      if tonumber(text) ~= value then text = format("%.17g", value) end
+      parts[#parts + 1] = text
+    end
+  elseif t == "string" then
+    parts[#parts + 1] = '"' .. value:gsub('[%c"\\]', escape) .. '"'
+  elseif t == "table" then
+    encode_table(value, parts, depth)
+  else
+    error("json.encode: can't encode a " .. t, 0)
+  end
+end
+
+function json.encode(value)
+  local parts = {}
+  encode_value(value, parts, 0)
+  return concat(parts)
+end
+
+local decode_value
+
+local function decode_error(text, i, message)
+  error(format("json.decode: %s at position %d", message, i), 0)
+end
+
+local function skip_space(text, i)
+  return find(text, "[^ \t\r\n]", i) or #text + 1
+end
+
+local function utf8(code)
+  if code < 0x80 then return char(code) end
+  if code < 0x800 then return char(0xc0 + floor(code / 0x40), 0x80 + code % 0x40) end
+  if code < 0x10000 then
+    return char(0xe0 + floor(code / 0x1000), 0x80 + floor(code / 0x40) % 0x40, 0x80 + code % 0x40)
+  end
+  return char(0xf0 + floor(code / 0x40000), 0x80 + floor(code / 0x1000) % 0x40,
+              0x80 + floor(code / 0x40) % 0x40, 0x80 + code % 0x40)
+end
+
+local unescapes = {
+  ['"'] = '"', ["\\"] = "\\", ["/"] = "/", b = "\b", f = "\f", n = "\n", r = "\r", t = "\t",
+}
+
+local function decode_string(text, i)
+  -- `i` is just past the opening quote.
+  local parts = {}
+  while true do
+    local j = find(text, '["\\%c]', i)
+    if j == nil then decode_error(text, i, "unterminated string") end
+    parts[#parts + 1] = sub(text, i, j - 1)
+    local c = sub(text, j, j)
+    if c == '"' then return concat(parts), j + 1 end
+    if c ~= "\\" then decode_error(text, j, "control character in string") end
+    local e = sub(text, j + 1, j + 1)
+    if e == "u" then
+      local code = tonumber(sub(text, j + 2, j + 5), 16)
+      if code == nil or not find(sub(text, j + 2, j + 5), "^%x%x%x%x$") then
+        decode_error(text, j, "bad unicode escape")
+      end
+      i = j + 6
+      if code >= 0xd800 and code < 0xdc00 and sub(text, i, i + 1) == "\\u" then
+        local low = tonumber(sub(text, i + 2, i + 5), 16)
+        if low and low >= 0xdc00 and low < 0xe000 then
+          code = 0x10000 + (code - 0xd800) * 0x400 + (low - 0xdc00)
+          i = i + 6
+        end
+      end
+      parts[#parts + 1] = utf8(code)
+    else
+      local unescaped = unescapes[e]
+      if unescaped == nil then decode_error(text, j, "bad escape") end
+      parts[#parts + 1] = unescaped
+      i = j + 2
+    end
+  end
+end
+
+local literals = {["true"] = true, ["false"] = false, null = json.null}
+
+function decode_value(text, i, depth)
+  if depth > 128 then decode_error(text, i, "nested too deeply") end
+  i = skip_space(text, i)
+  local c = sub(text, i, i)
+  if c == "{" then
+    local object = {}
+    i = skip_space(text, i + 1)
+    if sub(text, i, i) == "}" then return object, i + 1 end
+    while true do
+      if sub(text, i, i) ~= '"' then decode_error(text, i, "expected a string key") end
+      local key
+      key, i = decode_string(text, i + 1)
+      i = skip_space(text, i)
+      if sub(text, i, i) ~= ":" then decode_error(text, i, "expected ':'") end
+      object[key], i = decode_value(text, i + 1, depth + 1)
+      i = skip_space(text, i)
+      c = sub(text, i, i)
+      if c == "}" then return object, i + 1 end
+      if c ~= "," then decode_error(text, i, "expected ',' or '}'") end
+      i = skip_space(text, i + 1)
+    end
+  elseif c == "[" then
+    local array = json.array()
+    i = skip_space(text, i + 1)
+    if sub(text, i, i) == "]" then return array, i + 1 end
+    local n = 0
+    while true do
+      n = n + 1
+      array[n], i = decode_value(text, i, depth + 1)
+      i = skip_space(text, i)
+      c = sub(text, i, i)
+      if c == "]" then return array, i + 1 end
+      if c ~= "," then decode_error(text, i, "expected ',' or ']'") end
+      i = i + 1
+    end
+  elseif c == '"' then
+    return decode_string(text, i + 1)
+  end
+  local number = text:match("^-?%d+%.?%d*[eE]?[-+]?%d*", i)
+  if number and number ~= "" and number ~= "-" then
+    local value = tonumber(number)
+    if value == nil then decode_error(text, i, "bad number") end
+    return value, i + #number
+  end
+  local word = text:match("^%a+", i)
+  if word and literals[word] ~= nil then return literals[word], i + #word end
+  decode_error(text, i, i > #text and "unexpected end of text" or "unexpected character")
+end
+
+function json.decode(text)
+  if type(text) ~= "string" then error("json.decode: expected a string", 0) end
+  local value, i = decode_value(text, 1, 0)
+  i = skip_space(text, i)
+  if i <= #text then decode_error(text, i, "trailing characters") end
+  return value
+end
+
+return json
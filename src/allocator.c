@@ -0,0 +1,186 @@
+/*
+  Accounting allocator for the Lua heap.
+  Copyright (C) 2017 Collin RM Stocks. All rights reserved.
+*/
+
+#include "allocator.h"
+#include "interrupt.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/*
+  Blocks at least this big are mmap()ed and munmap()ed individually by LuaJIT's allocator,
+  so a loop that keeps building and dropping big strings or tables costs two system calls
+  (through the seccomp filter) per iteration. A few of them are kept around for reuse. They
+  aren't part of the Lua heap, but still count against the limit, and are let go as soon as
+  they stand in the way of an allocation or a collection is due.
+*/
+#define LARGE_BLOCK_SIZE (128 * 1024)
+#define LARGE_BLOCK_CACHE_SIZE 4
+
+
+struct allocator_stats allocator_stats;
+
+static lua_Alloc base_alloc = NULL;
+static void *base_ud = NULL;
+
+static size_t limit = 0;
+static size_t collect_threshold = SIZE_MAX;
+static bool overdrawn = false;
+static size_t watermark = SIZE_MAX;
+static size_t cached = 0; // Bytes in large_blocks.
+
+static struct {
+  void *block;
+  size_t size;
+} large_blocks[LARGE_BLOCK_CACHE_SIZE];
+
+
+static void *take_large_block(size_t size) {
+  // Only hand out a cached block if it wastes at most a quarter of itself.
+  for (int i = 0; i < LARGE_BLOCK_CACHE_SIZE; ++i) {
+    if (large_blocks[i].block != NULL && size <= large_blocks[i].size &&
+        size >= large_blocks[i].size - large_blocks[i].size / 4) {
+      void *block = large_blocks[i].block;
+      large_blocks[i].block = NULL;
+      cached -= large_blocks[i].size;
+      return block;
+    }
+  }
+  return NULL;
+}
+
+
+static int keep_large_block(void *block, size_t size) {
+  if (limit != 0 && allocator_stats.live + cached + size > limit) return 0;
+  for (int i = 0; i < LARGE_BLOCK_CACHE_SIZE; ++i) {
+    if (large_blocks[i].block == NULL) {
+      large_blocks[i].block = block;
+      large_blocks[i].size = size;
+      cached += size;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+
+static void drop_large_blocks(void) {
+  for (int i = 0; i < LARGE_BLOCK_CACHE_SIZE; ++i) {
+    if (large_blocks[i].block != NULL) {
+      base_alloc(base_ud, large_blocks[i].block, large_blocks[i].size, 0);
+      large_blocks[i].block = NULL;
+    }
+  }
+  cached = 0;
+}
+
+
+static void request_collection(void) {
+  // The GC can't run from inside an allocation, so ask for it at the next safe point. Only
+  // once until it has happened: allocator_collected() re-arms the threshold.
+  collect_threshold = SIZE_MAX;
+  drop_large_blocks();
+  interrupt_request(INTERRUPT_COLLECT);
+}
+
+
+static void *allocate(void *ud, void *ptr, size_t osize, size_t nsize) {
+  (void) ud;
+  if (ptr == NULL) osize = 0;
+
+  if (nsize == 0) {
+    allocator_stats.live -= osize;
+    if (osize < LARGE_BLOCK_SIZE || !keep_large_block(ptr, osize)) {
+      base_alloc(base_ud, ptr, osize, 0);
+    }
+    return NULL;
+  }
+
+  if (nsize > osize) {
+    size_t growth = nsize - osize;
+    if (limit != 0 && allocator_stats.live + cached + growth > limit) drop_large_blocks();
+    if (limit != 0 && growth > limit - allocator_stats.live) {
+      // The garbage may be what is in the way, but LuaJIT can't collect from inside an
+      // allocation: the collector runs finalizers and shrinks buffers the caller may be
+      // copying from. So one allocation at a time may overdraw the limit by an eighth, and
+      // the collection that follows decides whether the script is really out of memory.
+      if (overdrawn || growth > limit + limit / 8 - allocator_stats.live) {
+        ++allocator_stats.failures;
+        request_collection(); // so a script that catches the error gets its memory back
+        return NULL;
+      }
+      overdrawn = true;
+      request_collection();
+    }
+    if (allocator_stats.live + cached + growth >= collect_threshold) request_collection();
+  }
+
+  void *block = NULL;
+  if (ptr == NULL && nsize >= LARGE_BLOCK_SIZE) block = take_large_block(nsize);
+  if (block == NULL) block = base_alloc(base_ud, ptr, osize, nsize);
+  if (block == NULL) {
+    ++allocator_stats.failures;
+    return NULL;
+  }
+
+  allocator_stats.live = allocator_stats.live - osize + nsize;
+  if (nsize > osize) {
+    allocator_stats.total += nsize - osize;
+    if (allocator_stats.total >= watermark) {
+      watermark = SIZE_MAX;
+      interrupt_request(INTERRUPT_QUOTA);
+    }
+  }
+  if (allocator_stats.live > allocator_stats.peak) allocator_stats.peak = allocator_stats.live;
+  return block;
+}
+
+
+void allocator_install(lua_State *L) {
+  base_alloc = lua_getallocf(L, &base_ud);
+  // Everything the state allocated so far still counts.
+  allocator_stats.live = (size_t) lua_gc(L, LUA_GCCOUNT, 0) * 1024 + lua_gc(L, LUA_GCCOUNTB, 0);
+  allocator_stats.peak = allocator_stats.live;
+  allocator_stats.total = allocator_stats.live;
+  allocator_stats.failures = 0;
+  lua_setallocf(L, allocate, NULL);
+}
+
+
+void allocator_set_limit(size_t bytes) {
+  limit = bytes;
+  collect_threshold = limit ? limit - limit / 8 : SIZE_MAX;
+}
+
+
+int allocator_collected(void) {
+  // Collect again once half the remaining headroom is used up, but not so soon that a heap
+  // sitting right at the limit collects on every other allocation.
+  if (limit == 0) return 0;
+  size_t live = allocator_stats.live;
+  size_t headroom = live < limit ? limit - live : 0;
+  collect_threshold = live + (headroom / 2 > limit / 16 ? headroom / 2 : limit / 16);
+  bool was_overdrawn = overdrawn;
+  overdrawn = false;
+  if (was_overdrawn && live > limit) {
+    ++allocator_stats.failures;
+    return 1;
+  }
+  return 0;
+}
+
+
+void allocator_set_watermark(size_t total) {
+  watermark = total;
+}
+
+
+void allocator_close(lua_State *L) {
+  // LuaJIT only tears down its arena if it still sees its own allocator.
+  drop_large_blocks();
+  lua_setallocf(L, base_alloc, base_ud);
+  lua_close(L);
+}
@@ -0,0 +1,58 @@
+/*
+  Accounting allocator for the Lua heap.
+  Copyright (C) 2017 Collin RM Stocks. All rights reserved.
+*/
+
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+
+#include <luajit-2.0/lua.h>
+
+#include <stddef.h>
+
+
+struct allocator_stats {
+  size_t live;            // Bytes currently held by the Lua heap.
+  size_t peak;            // Highest value `live` has reached.
+  size_t total;           // Bytes handed out over the life of the state, including reallocs.
+  unsigned long failures; // Allocations refused because of the limit.
+};
+
+extern struct allocator_stats allocator_stats;
+
+
+/*
+  Route all further allocations of a state made by luaL_newstate() through the accounting
+  allocator. LuaJIT needs its own allocator underneath on x86-64 (objects must live in the
+  low 2 GiB), so this wraps it rather than replacing it.
+*/
+void allocator_install(lua_State *);
+
+/*
+  Limit the Lua heap to this many bytes. Zero means unlimited. Past 7/8 of the limit, a full
+  collection is requested at the next safe point. Allocations that would exceed the limit fail,
+  which raises a "not enough memory" error in the script, except that one at a time may go up
+  to an eighth over it, until the collection it requests shows whether the limit still holds.
+*/
+void allocator_set_limit(size_t);
+
+/*
+  Called after a requested collection has run, to re-arm the collection threshold. Returns
+  nonzero if an allocation overdrew the limit and the collection didn't bring the heap back
+  under it, in which case the caller raises "not enough memory".
+*/
+int allocator_collected(void);
+
+/*
+  Request INTERRUPT_QUOTA once `allocator_stats.total` reaches `total`, for Resumer allocation
+  quotas. SIZE_MAX disarms it, as does the request itself.
+*/
+void allocator_set_watermark(size_t total);
+
+/*
+  Close a state set up with allocator_install(). Use this instead of lua_close(), so that
+  LuaJIT can release its own arena too.
+*/
+void allocator_close(lua_State *);
+
+#endif
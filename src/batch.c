@@ -0,0 +1,418 @@
+/*
+  Batch mode.
+  Copyright (C) 2017 Collin RM Stocks. All rights reserved.
+*/
+
+#define _GNU_SOURCE
+
+#include "batch.h"
+#include "allocator.h"
+#include "luajit_wrapper.h"
+#include "output.h"
+#include "server.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+
+#define err(v, msg) do { if (v) { perror(msg); return 1; } } while (0)
+
+
+/*
+  All the scripts are copied into one anonymous file, each starting on a page boundary, so a
+  child can map its own script without the parent holding any of them in its address space,
+  which every child would inherit.
+*/
+struct batch_script {
+  uint32_t id;       // Line number in the manifest.
+  int error;         // errno from opening or reading the script, or 0.
+  off_t offset;
+  size_t size;
+};
+
+struct batch {
+  struct batch_script *scripts;
+  size_t count;
+  size_t capacity;
+  size_t dispatched; // Scripts handed out so far.
+  size_t written;    // With --jobs, how many results have been written in manifest order.
+  int spool;
+  off_t spool_size;
+  int devnull;
+};
+
+
+struct batch_output {
+  char *data;
+  size_t size;
+  size_t capacity;
+};
+
+
+static int spool_file(struct batch *batch, struct batch_script *script, const char *path) {
+  // Returns nonzero only if the spool itself fails. A script that can't be read is reported
+  // when its turn comes, like a separate run would report it.
+  long page_size = sysconf(_SC_PAGESIZE);
+  script->offset = (batch->spool_size + page_size - 1) / page_size * page_size;
+  script->size = 0;
+  script->error = 0;
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    script->error = errno;
+    return 0;
+  }
+  char chunk[65536];
+  while (1) {
+    ssize_t n = read(fd, chunk, sizeof(chunk));
+    if (n == -1 && errno == EINTR) continue;
+    if (n == -1) script->error = errno;
+    if (n <= 0) break;
+    for (ssize_t done = 0; done < n;) {
+      ssize_t written = pwrite(batch->spool, chunk + done, n - done,
+                               script->offset + script->size + done);
+      if (written == -1 && errno == EINTR) continue;
+      if (written == -1) {
+        perror("failed to copy script");
+        close(fd);
+        return 1;
+      }
+      done += written;
+    }
+    script->size += n;
+  }
+  close(fd);
+  if (script->size != 0) batch->spool_size = script->offset + script->size;
+  return 0;
+}
+
+
+static int read_manifest(struct batch *batch, const char *manifest) {
+  FILE *file = fopen(manifest, "re");
+  err(file == NULL, "failed to open manifest");
+  char *line = NULL;
+  size_t line_capacity = 0;
+  uint32_t line_number = 0;
+  ssize_t length;
+  int error = 0;
+  while (!error && (length = getline(&line, &line_capacity, file)) != -1) {
+    ++line_number;
+    if (length > 0 && line[length - 1] == '\n') line[--length] = '\0';
+    if (length == 0) continue;
+    if (batch->count == batch->capacity) {
+      size_t capacity = batch->capacity ? 2 * batch->capacity : 64;
+      struct batch_script *grown = realloc(batch->scripts, capacity * sizeof(*grown));
+      if (grown == NULL) {
+        perror("failed to read manifest");
+        error = 1;
+        break;
+      }
+      batch->scripts = grown;
+      batch->capacity = capacity;
+    }
+    struct batch_script *script = &batch->scripts[batch->count++];
+    script->id = line_number;
+    error = spool_file(batch, script, line);
+  }
+  if (!error && ferror(file)) {
+    perror("failed to read manifest");
+    error = 1;
+  }
+  free(line);
+  fclose(file);
+  return error;
+}
+
+
+static void run_child(lua_State *L, const struct batch *batch, const struct batch_script *script,
+                      size_t max_memory, size_t output_limit) {
+  // Runs in the forked child and never returns.
+  if (sandbox_enter_child()) exit(1);
+  if (output_open(output_limit)) exit(1);
+  if (script->error != 0) {
+    errno = script->error;
+    perror("failed to open file");
+    exit(1);
+  }
+
+  struct luajit_wrapper_script wrapper_script;
+  wrapper_script.fd = -1;
+  wrapper_script.buffer = "";
+  wrapper_script.size = script->size;
+  if (script->size != 0) {
+    void *image = mmap(NULL, script->size, PROT_READ, MAP_PRIVATE, batch->spool, script->offset);
+    if (image == MAP_FAILED) {
+      perror("failed to map script");
+      exit(1);
+    }
+    wrapper_script.buffer = image;
+  }
+  close(batch->spool); // The other scripts in the batch are none of this one's business.
+  allocator_set_limit(max_memory);
+
+  exit(luajit_wrapper_run(L, &wrapper_script) ? 1 : 0);
+}
+
+
+static int run_scripts(struct batch *batch, const struct batch_settings *settings,
+                       int (*next)(struct batch *, size_t *)) {
+  // Set up this process's sandbox and run scripts in forked children until `next` runs out.
+  // Everything up to here is paid once; every script starts from a copy of this state.
+  lua_State *L = luajit_wrapper_new_state();
+  if (L == NULL) return 1;
+
+  struct sandbox_settings sandbox_settings = settings->sandbox_settings;
+  sandbox_settings.fork_scripts = true;
+  if (sandbox_init(&sandbox_settings)) return 1;
+
+  size_t index;
+  int more;
+  while ((more = next(batch, &index)) > 0) {
+    struct server_job job;
+    pid_t pid = server_fork_job(&job, batch->scripts[index].id, batch->devnull,
+                                settings->err_to_stdout);
+    if (pid == 0) run_child(L, batch, &batch->scripts[index], sandbox_settings.max_memory,
+                            settings->output_limit);
+    if (pid == -1 || server_finish_job(&job)) return 1;
+  }
+  return more;
+}
+
+
+static int next_in_order(struct batch *batch, size_t *index) {
+  if (batch->dispatched == batch->count) return 0;
+  *index = batch->dispatched++;
+  return 1;
+}
+
+
+static int next_from_supervisor(struct batch *batch, size_t *index) {
+  // Workers read the index of their next script from stdin.
+  uint32_t next;
+  ssize_t n = server_read_full(0, &next, sizeof(next));
+  if (n == 0) return 0;
+  if (n != sizeof(next) || next >= batch->count) {
+    fputs("worker lost its supervisor\n", stderr);
+    return -1;
+  }
+  *index = next;
+  return 1;
+}
+
+
+/*
+  With --jobs, an unsandboxed supervisor that never creates a Lua state keeps a number of
+  workers busy. Each worker is a sandboxed batch process of its own, reading script indices
+  from a pipe on its stdin and writing frames to a pipe on its stdout. The supervisor
+  collects each script's frames and writes them out together once its exit frame arrives.
+*/
+struct batch_worker {
+  pid_t pid;
+  int input;                  // Where the supervisor writes script indices, or -1 once done.
+  int output;                 // Where the worker writes frames, or -1 at end of file.
+  size_t script;              // Index of the script it is running, or SIZE_MAX if idle.
+  struct batch_output frames; // Frames of that script so far.
+};
+
+
+static bool output_append(struct batch_output *output, const void *data, size_t size) {
+  if (output->capacity - output->size < size) {
+    size_t capacity = output->capacity ? output->capacity : 4096;
+    while (capacity - output->size < size) capacity *= 2;
+    char *grown = realloc(output->data, capacity);
+    if (grown == NULL) return false;
+    output->data = grown;
+    output->capacity = capacity;
+  }
+  memcpy(output->data + output->size, data, size);
+  output->size += size;
+  return true;
+}
+
+
+static int start_worker(struct batch *batch, struct batch_worker *workers, unsigned int n,
+                        const struct batch_settings *settings, const cpu_set_t *cpus) {
+  int input[2], output[2];
+  err(pipe2(input, O_CLOEXEC) == -1, "failed to create worker pipe");
+  if (pipe2(output, O_CLOEXEC) == -1) {
+    perror("failed to create worker pipe");
+    close(input[0]);
+    close(input[1]);
+    return 1;
+  }
+
+  struct batch_worker *worker = &workers[n];
+  worker->pid = fork();
+  if (worker->pid == 0) {
+    // The worker only keeps its own pipes, as stdin and stdout.
+    if (dup2(input[0], 0) == -1 || dup2(output[1], 1) == -1) _exit(1);
+    close(input[0]);
+    close(input[1]);
+    close(output[0]);
+    close(output[1]);
+    for (unsigned int i = 0; i < n; ++i) {
+      close(workers[i].input);
+      close(workers[i].output);
+    }
+    if (settings->pin_workers) {
+      // Pin each worker to the next CPU this process may run on.
+      unsigned int skip = n % CPU_COUNT(cpus);
+      for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (!CPU_ISSET(cpu, cpus) || skip-- != 0) continue;
+        cpu_set_t pinned;
+        CPU_ZERO(&pinned);
+        CPU_SET(cpu, &pinned);
+        if (sched_setaffinity(0, sizeof(pinned), &pinned)) perror("failed to pin worker");
+        break;
+      }
+    }
+    exit(run_scripts(batch, settings, next_from_supervisor) ? 1 : 0);
+  }
+
+  close(input[0]);
+  close(output[1]);
+  worker->input = input[1];
+  worker->output = output[0];
+  worker->script = SIZE_MAX;
+  memset(&worker->frames, '\0', sizeof(worker->frames));
+  if (worker->pid == -1) {
+    perror("failed to start worker");
+    close(worker->input);
+    close(worker->output);
+    return 1;
+  }
+  return 0;
+}
+
+
+static int dispatch(struct batch *batch, struct batch_worker *worker) {
+  // Give the worker the next script, or let it finish if there are none left.
+  if (batch->dispatched == batch->count) {
+    if (worker->input != -1) close(worker->input);
+    worker->input = -1;
+    return 0;
+  }
+  uint32_t index = batch->dispatched++;
+  worker->script = index;
+  err(server_write_full(worker->input, &index, sizeof(index)), "failed to dispatch script");
+  return 0;
+}
+
+
+static int collect(struct batch *batch, struct batch_worker *worker, struct batch_output *results,
+                   const struct batch_settings *settings) {
+  // Read one frame from a worker. When it completes a script, write out what can be written.
+  struct server_frame frame;
+  ssize_t n = server_read_full(worker->output, &frame, sizeof(frame));
+  if (n == 0 && worker->script == SIZE_MAX) {
+    close(worker->output);
+    worker->output = -1;
+    return 0;
+  }
+  if (n != sizeof(frame) || !output_append(&worker->frames, &frame, sizeof(frame))) {
+    fputs("worker stopped unexpectedly\n", stderr);
+    return 1;
+  }
+  char payload[4096];
+  for (uint32_t left = frame.length; left > 0;) {
+    size_t chunk = left < sizeof(payload) ? left : sizeof(payload);
+    if (server_read_full(worker->output, payload, chunk) != (ssize_t) chunk ||
+        !output_append(&worker->frames, payload, chunk)) {
+      fputs("worker stopped unexpectedly\n", stderr);
+      return 1;
+    }
+    left -= chunk;
+  }
+  if (frame.type != SERVER_FRAME_EXIT) return 0;
+
+  results[worker->script] = worker->frames;
+  memset(&worker->frames, '\0', sizeof(worker->frames));
+  size_t first = settings->completion_order ? worker->script : batch->written;
+  worker->script = SIZE_MAX;
+  // In manifest order, a finished script may also release the ones that finished before it.
+  for (size_t i = first; i < batch->count && results[i].data != NULL; ++i) {
+    err(server_write_full(1, results[i].data, results[i].size), "failed to write results");
+    free(results[i].data);
+    results[i].data = NULL;
+    if (settings->completion_order) break;
+    batch->written = i + 1;
+  }
+  return dispatch(batch, worker);
+}
+
+
+static int supervise(struct batch *batch, const struct batch_settings *settings) {
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  if (settings->pin_workers) {
+    err(sched_getaffinity(0, sizeof(cpus), &cpus), "failed to get CPU affinity");
+  }
+  struct batch_worker *workers = calloc(settings->jobs, sizeof(*workers));
+  struct batch_output *results = calloc(batch->count ? batch->count : 1, sizeof(*results));
+  struct pollfd *fds = calloc(settings->jobs, sizeof(*fds));
+  err(workers == NULL || results == NULL || fds == NULL, "failed to start workers");
+  for (unsigned int i = 0; i < settings->jobs; ++i) {
+    if (start_worker(batch, workers, i, settings, &cpus)) return 1;
+  }
+  for (unsigned int i = 0; i < settings->jobs; ++i) {
+    if (dispatch(batch, &workers[i])) return 1;
+  }
+
+  int error = 0;
+  while (!error) {
+    nfds_t count = 0;
+    for (unsigned int i = 0; i < settings->jobs; ++i) {
+      fds[i].fd = workers[i].output; // ppoll() ignores negative descriptors.
+      fds[i].events = POLLIN;
+      fds[i].revents = 0;
+      if (workers[i].output != -1) ++count;
+    }
+    if (count == 0) break;
+    if (ppoll(fds, settings->jobs, NULL, NULL) == -1) {
+      if (errno == EINTR) continue;
+      perror("failed to wait for workers");
+      error = 1;
+      break;
+    }
+    for (unsigned int i = 0; i < settings->jobs && !error; ++i) {
+      if (fds[i].revents != 0) error = collect(batch, &workers[i], results, settings);
+    }
+  }
+
+  for (unsigned int i = 0; i < settings->jobs; ++i) {
+    if (workers[i].input != -1) close(workers[i].input);
+    int status;
+    while (waitpid(workers[i].pid, &status, 0) == -1) {
+      if (errno != EINTR) {
+        perror("failed to wait for worker");
+        return 1;
+      }
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) error = 1;
+  }
+  return error;
+}
+
+
+int batch_run(const char *manifest, const struct batch_settings *settings) {
+  struct batch batch;
+  memset(&batch, '\0', sizeof(batch));
+  batch.spool = memfd_create("batch", MFD_CLOEXEC);
+  err(batch.spool == -1, "failed to create script spool");
+  if (read_manifest(&batch, manifest)) return 1;
+
+  batch.devnull = open("/dev/null", O_RDONLY | O_CLOEXEC);
+  err(batch.devnull == -1, "failed to open /dev/null");
+
+  if (settings->jobs == 0) return run_scripts(&batch, settings, next_in_order);
+  return supervise(&batch, settings);
+}
@@ -0,0 +1,39 @@
+/*
+  Batch mode.
+  Copyright (C) 2017 Collin RM Stocks. All rights reserved.
+*/
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "sandbox.h"
+
+#include <stdbool.h>
+
+
+struct batch_settings {
+  struct sandbox_settings sandbox_settings; // Limits for each script.
+  bool err_to_stdout;
+  size_t output_limit;   // Bytes of output per script, zero for no limit (see output.h).
+  unsigned int jobs;     // Number of workers, or zero to run the scripts from this process.
+  bool pin_workers;      // Pin each worker to a CPU of its own.
+  bool completion_order; // With workers, write results as scripts finish, not in manifest order.
+};
+
+
+/*
+  Run every script listed in `manifest`, one path per line, and write their results to stdout
+  as the same frames --serve uses (see server.h), tagged with the script's line number.
+
+  The manifest and all the scripts are read, and a Lua state initialized, before the sandbox
+  is set up once for the whole batch. Each script then runs in its own forked child of the
+  sandboxed process, starting from an untouched copy of that state, with the CPU and memory
+  limits in `sandbox_settings` applying to each script separately.
+
+  With `jobs`, this process only supervises: it never creates a Lua state itself, and hands
+  the scripts out to that many workers, each of which does the above in its own sandbox.
+  Each script's frames are written out together.
+*/
+int batch_run(const char *manifest, const struct batch_settings *);
+
+#endif
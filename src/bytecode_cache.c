@@ -0,0 +1,178 @@
+/*
+  Content-addressed cache of compiled scripts.
+  Copyright (C) 2017 Collin RM Stocks. All rights reserved.
+*/
+
+#define _GNU_SOURCE
+
+#include "bytecode_cache.h"
+#include "sha256.h"
+
+#include <luajit-2.0/lua.h>
+#include <luajit-2.0/lauxlib.h>
+#include <luajit-2.0/luajit.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+// Every LuaJIT bytecode image starts with these bytes.
+#define BYTECODE_MAGIC "\033LJ"
+
+
+struct growable_buffer {
+  char *data;
+  size_t size;
+  size_t capacity;
+};
+
+
+static bool buffer_append(struct growable_buffer *buffer, const void *data, size_t size) {
+  if (buffer->capacity - buffer->size < size) {
+    size_t capacity = buffer->capacity ? buffer->capacity : 65536;
+    while (capacity - buffer->size < size) capacity *= 2;
+    char *grown = realloc(buffer->data, capacity);
+    if (grown == NULL) return false;
+    buffer->data = grown;
+    buffer->capacity = capacity;
+  }
+  memcpy(buffer->data + buffer->size, data, size);
+  buffer->size += size;
+  return true;
+}
+
+
+static bool read_all(int fd, struct growable_buffer *buffer) {
+  char chunk[4096];
+  while (1) {
+    ssize_t n = read(fd, chunk, sizeof(chunk));
+    if (n == -1 && errno == EINTR) continue;
+    if (n == -1) return false;
+    if (n == 0) return true;
+    if (!buffer_append(buffer, chunk, n)) return false;
+  }
+}
+
+
+static void cache_key(const struct growable_buffer *source, char name[2 * SHA256_DIGEST_SIZE + 1]) {
+  // Bytecode is only valid for the LuaJIT version that produced it, so that is part of the key.
+  static const char hex[] = "0123456789abcdef";
+  struct sha256 ctx;
+  unsigned char digest[SHA256_DIGEST_SIZE];
+  sha256_init(&ctx);
+  sha256_update(&ctx, LUAJIT_VERSION, sizeof(LUAJIT_VERSION)); // includes the terminating NUL
+  sha256_update(&ctx, source->data, source->size);
+  sha256_final(&ctx, digest);
+  for (int i = 0; i < SHA256_DIGEST_SIZE; ++i) {
+    name[2 * i] = hex[digest[i] >> 4];
+    name[2 * i + 1] = hex[digest[i] & 0xf];
+  }
+  name[2 * SHA256_DIGEST_SIZE] = '\0';
+}
+
+
+static bool map_image(int dirfd, const char *name, struct luajit_wrapper_script *script) {
+  int fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) return false;
+  struct stat info;
+  void *image = MAP_FAILED;
+  if (!fstat(fd, &info) && info.st_size >= (off_t) (sizeof(BYTECODE_MAGIC) - 1)) {
+    image = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd); // The mapping stays valid, and the sandbox never sees a descriptor into the cache.
+  if (image == MAP_FAILED) return false;
+  if (memcmp(image, BYTECODE_MAGIC, sizeof(BYTECODE_MAGIC) - 1)) {
+    munmap(image, info.st_size);
+    return false;
+  }
+  script->buffer = image;
+  script->size = info.st_size;
+  return true;
+}
+
+
+static int dump_writer(lua_State *L, const void *data, size_t size, void *ud) {
+  (void) L;
+  return buffer_append((struct growable_buffer *) ud, data, size) ? 0 : 1;
+}
+
+
+static bool compile(const struct growable_buffer *source, struct growable_buffer *image) {
+  // Parse only. Nothing from the script runs outside the sandbox.
+  lua_State *L = luaL_newstate();
+  if (L == NULL) return false;
+  bool compiled = !luaL_loadbuffer(L, source->data, source->size, "script") &&
+                  !lua_dump(L, dump_writer, image);
+  lua_close(L);
+  return compiled;
+}
+
+
+static void publish(int dirfd, const char *name, const struct growable_buffer *image) {
+  // Write to a private temporary name and rename it into place, so readers never see a
+  // partial image. Failures just mean the next run compiles again.
+  char temporary[2 * SHA256_DIGEST_SIZE + 32];
+  snprintf(temporary, sizeof(temporary), ".%s.%ld", name, (long) getpid());
+  int fd = openat(dirfd, temporary, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if (fd == -1) return;
+  size_t done = 0;
+  while (done < image->size) {
+    ssize_t n = write(fd, image->data + done, image->size - done);
+    if (n == -1 && errno == EINTR) continue;
+    if (n == -1) break;
+    done += n;
+  }
+  // Make sure a crash can't leave a renamed but empty image behind.
+  bool written = done == image->size && !fdatasync(fd);
+  close(fd);
+  if (!written || renameat(dirfd, temporary, dirfd, name)) {
+    unlinkat(dirfd, temporary, 0);
+  }
+}
+
+
+int bytecode_cache_load(const char *directory, struct luajit_wrapper_script *script) {
+  int dirfd = open(directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dirfd == -1) {
+    perror("failed to open bytecode cache directory");
+    return 1;
+  }
+
+  struct growable_buffer source;
+  memset(&source, '\0', sizeof(source));
+  if (!read_all(script->fd, &source)) {
+    perror("failed to read script");
+    close(dirfd);
+    return 1;
+  }
+
+  char name[2 * SHA256_DIGEST_SIZE + 1];
+  cache_key(&source, name);
+
+  if (map_image(dirfd, name, script)) {
+    free(source.data);
+  } else {
+    struct growable_buffer image;
+    memset(&image, '\0', sizeof(image));
+    if (compile(&source, &image)) {
+      publish(dirfd, name, &image);
+      free(source.data);
+      script->buffer = image.data;
+      script->size = image.size;
+    } else {
+      free(image.data);
+      script->buffer = source.data;
+      script->size = source.size;
+    }
+  }
+
+  close(dirfd);
+  return 0;
+}
@@ -0,0 +1,26 @@
+/*
+  Content-addressed cache of compiled scripts.
+  Copyright (C) 2017 Collin RM Stocks. All rights reserved.
+*/
+
+#ifndef BYTECODE_CACHE_H
+#define BYTECODE_CACHE_H
+
+#include "luajit_wrapper.h"
+
+
+/*
+  Read the whole script from `script->fd` and point `script->buffer` at its compiled
+  bytecode, keyed by a SHA-256 hash of the source in `directory`. On a hit, the cached
+  image is mapped read-only and used in place. On a miss, the source is compiled (but not
+  run) and the image is published atomically for later runs. If the script does not
+  compile, or the cache cannot be written, the buffer holds the source instead and errors
+  are reported when it is loaded for real.
+
+  Must be called before sandbox_init(), since it opens and creates files. The buffer stays
+  valid until the process exits. Returns nonzero only if the script or the cache directory
+  could not be read at all.
+*/
+int bytecode_cache_load(const char *directory, struct luajit_wrapper_script *script);
+
+#endif
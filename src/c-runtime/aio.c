@@ -0,0 +1,162 @@
+#define _GNU_SOURCE
+#include "aio.h"
+#include "resumer.h"
+#include "../output.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+
+
+// The most aio.read() returns at once.
+#define AIO_READ_SIZE 65536
+
+static char read_buffer[AIO_READ_SIZE];
+
+
+struct aio_request {
+  struct cr_io_wait wait;      // Must come first.
+  const char *data;            // Only for writes.
+  size_t size;
+  size_t done;
+};
+
+
+static int aio_push_error(lua_State *L, int error) {
+  lua_pushnil(L);
+  lua_pushstring(L, strerror(error));
+  lua_pushinteger(L, error);
+  return 3;
+}
+
+
+/*
+  O_NONBLOCK belongs to the open file description, which is shared with every descriptor
+  duplicated from it, such as stdout, and with other processes, all of which expect it to
+  block. So it is only set for each attempt, and put back right after. Returns the flags to
+  put back, or -1.
+*/
+static int aio_begin_nonblocking(int fd) {
+  int flags = fcntl(fd, F_GETFL);
+  if (flags == -1 || (flags & O_NONBLOCK)) return flags;
+  return fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1 ? -1 : flags;
+}
+
+
+static void aio_end_nonblocking(int fd, int flags) {
+  if (flags & O_NONBLOCK) return;
+  int error = errno;
+  fcntl(fd, F_SETFL, flags);
+  errno = error;
+}
+
+
+/*
+  Try to carry out a request, and push the results onto L's stack. Returns the number of
+  results, or -1 if it would block.
+*/
+static int aio_try_read(lua_State *L, struct cr_io_wait *wait) {
+  struct aio_request *request = (struct aio_request *) wait;
+  size_t size = request->size < AIO_READ_SIZE ? request->size : AIO_READ_SIZE;
+  int flags = aio_begin_nonblocking(wait->fd);
+  if (flags == -1) return aio_push_error(L, errno);
+  ssize_t n = read(wait->fd, read_buffer, size);
+  aio_end_nonblocking(wait->fd, flags);
+  if (n == -1) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return -1;
+    return aio_push_error(L, errno);
+  }
+  if (n == 0 && size > 0) {
+    lua_pushnil(L);
+    return 1;
+  }
+  lua_pushlstring(L, read_buffer, n);
+  return 1;
+}
+
+
+static int aio_try_write(lua_State *L, struct cr_io_wait *wait) {
+  struct aio_request *request = (struct aio_request *) wait;
+  int flags = aio_begin_nonblocking(wait->fd);
+  if (flags == -1) return aio_push_error(L, errno);
+  while (request->done < request->size) {
+    ssize_t n = write(wait->fd, request->data + request->done, request->size - request->done);
+    if (n == -1) {
+      if (errno == EINTR) continue;
+      aio_end_nonblocking(wait->fd, flags);
+      if (errno == EAGAIN || errno == EWOULDBLOCK) return -1;
+      return aio_push_error(L, errno);
+    }
+    request->done += n;
+  }
+  aio_end_nonblocking(wait->fd, flags);
+  lua_pushnumber(L, (lua_Number) request->done);
+  return 1;
+}
+
+
+static int aio_perform(lua_State *L, struct aio_request *request) {
+  // stack: [fd, argument]
+  int nresults = request->wait.ready(L, &request->wait);
+  if (nresults >= 0) return nresults;
+
+  struct cr_scheduler *scheduler = cr_Scheduler_running(L);
+  if (scheduler != NULL) {
+    // The request has to outlive this call, so move it into a userdata on the stack, along
+    // with the string being written.
+    struct aio_request *waiting = lua_newuserdata(L, sizeof(*waiting));
+    memcpy(waiting, request, sizeof(*waiting));
+    return cr_Scheduler_wait_io(L, scheduler, &waiting->wait);
+  }
+
+  // Nothing else could run meanwhile, so just block.
+  while (1) {
+    struct pollfd pollfd;
+    pollfd.fd = request->wait.fd;
+    pollfd.events = request->wait.events;
+    if (ppoll(&pollfd, 1, NULL, NULL) == -1 && errno != EINTR) return aio_push_error(L, errno);
+    nresults = request->wait.ready(L, &request->wait);
+    if (nresults >= 0) return nresults;
+  }
+}
+
+
+static int cr_aio_read(lua_State *L) {
+  struct aio_request request;
+  memset(&request, '\0', sizeof(request));
+  request.wait.fd = luaL_checkint(L, 1);
+  request.wait.events = POLLIN;
+  request.wait.ready = &aio_try_read;
+  lua_Integer size = luaL_checkinteger(L, 2);
+  luaL_argcheck(L, size >= 0, 2, "size must not be negative");
+  request.size = size;
+  lua_settop(L, 2);
+  output_flush(); // the other end may be waiting for it before it replies
+  return aio_perform(L, &request);
+}
+
+
+static int cr_aio_write(lua_State *L) {
+  struct aio_request request;
+  memset(&request, '\0', sizeof(request));
+  request.wait.fd = luaL_checkint(L, 1);
+  request.wait.events = POLLOUT;
+  request.wait.ready = &aio_try_write;
+  request.data = luaL_checklstring(L, 2, &request.size);
+  lua_settop(L, 2);
+  output_flush(); // so it comes after what the script printed before
+  return aio_perform(L, &request);
+}
+
+
+void cropen_aio(lua_State *L) {
+  luaL_Reg library[3];
+  memset(&library, '\0', sizeof(library));
+  library[0].name = "read";
+  library[0].func = &cr_aio_read;
+  library[1].name = "write";
+  library[1].func = &cr_aio_write;
+  luaL_register(L, "aio", library);
+}
@@ -0,0 +1,24 @@
+#ifndef CR_AIO_H
+#define CR_AIO_H
+
+#include "lj_headers.h"
+
+
+/*
+  aio.read(fd, n)
+    Read up to `n` bytes from `fd`. Returns a string, nil at end of file, or nil, an error
+    message and errno on failure.
+
+  aio.write(fd, s)
+    Write all of `s` to `fd`. Returns the number of bytes written, or nil, an error message
+    and errno on failure.
+
+    Both leave `fd` in whichever mode they found it: each attempt only makes it non-blocking
+    for as long as the system call takes. Called from a resumer.Scheduler task, they suspend
+    only that task until `fd` is ready, and other tasks keep running. Anywhere else, they
+    block.
+*/
+void cropen_aio(lua_State *);
+
+
+#endif
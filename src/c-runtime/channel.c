@@ -0,0 +1,224 @@
+#define _GNU_SOURCE
+#include "channel.h"
+#include "resumer.h"
+#include "../channel_ring.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+#define CHANNEL_METATABLE "channel.Channel"
+
+
+struct cr_channel {
+  const char *name;
+  struct channel channel;
+  bool hung_up; // The host has closed its end of the doorbell.
+};
+
+static struct cr_channel channels[CR_CHANNEL_MAX];
+static int channel_count = 0;
+
+
+struct channel_request {
+  struct cr_io_wait wait;      // Must come first.
+  struct cr_channel *channel;
+  int (*attempt)(lua_State *, struct channel_request *);
+  const char *data;            // Only for sends.
+  size_t size;
+};
+
+
+int cr_channel_attach(const char *name, int memfd, int doorbell) {
+  if (channel_count == CR_CHANNEL_MAX) {
+    fprintf(stderr, "too many channels (at most %d)\n", CR_CHANNEL_MAX);
+    return 1;
+  }
+  struct stat info;
+  if (fstat(memfd, &info)) {
+    perror("failed to get channel size");
+    return 1;
+  }
+  void *mapping = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+  if (mapping == MAP_FAILED) {
+    perror("failed to map channel");
+    return 1;
+  }
+  close(memfd); // the mapping keeps it
+  struct cr_channel *channel = &channels[channel_count];
+  if (!channel_attach(&channel->channel, mapping, info.st_size, doorbell)) {
+    fprintf(stderr, "channel %s was not initialized with channel_region_init()\n", name);
+    return 1;
+  }
+  int flags = fcntl(doorbell, F_GETFL);
+  if (flags == -1 || fcntl(doorbell, F_SETFL, flags | O_NONBLOCK)) {
+    perror("failed to set up channel doorbell");
+    return 1;
+  }
+  channel->name = name;
+  channel->hung_up = false;
+  ++channel_count;
+  return 0;
+}
+
+
+/*
+  Try to carry out a request, and push the results onto L's stack. Returns the number of
+  results, or -1 if it has to wait for the doorbell. Makes no system calls unless the host
+  has to be woken up.
+*/
+static int channel_attempt_recv(lua_State *L, struct channel_request *request) {
+  struct cr_channel *channel = request->channel;
+  const unsigned char *first, *second;
+  uint32_t first_length, second_length;
+  bool closed;
+  if (!channel_peek(&channel->channel, CHANNEL_TO_SANDBOX, &first, &first_length,
+                    &second, &second_length, &closed)) {
+    if (!closed && !channel->hung_up) return -1;
+    lua_pushnil(L);
+    return 1;
+  }
+  if (second_length == 0) {
+    lua_pushlstring(L, (const char *) first, first_length);
+  } else {
+    luaL_Buffer buffer;
+    luaL_buffinit(L, &buffer);
+    luaL_addlstring(&buffer, (const char *) first, first_length);
+    luaL_addlstring(&buffer, (const char *) second, second_length);
+    luaL_pushresult(&buffer);
+  }
+  if (channel_consume(&channel->channel, CHANNEL_TO_SANDBOX, first_length + second_length)) {
+    channel_ring_doorbell(&channel->channel);
+  }
+  return 1;
+}
+
+
+static int channel_attempt_send(lua_State *L, struct channel_request *request) {
+  struct cr_channel *channel = request->channel;
+  bool wake;
+  if (!channel_try_send(&channel->channel, CHANNEL_FROM_SANDBOX, request->data, request->size,
+                        &wake)) {
+    if (!channel->hung_up) return -1;
+    lua_pushnil(L);
+    lua_pushliteral(L, "channel closed by the host");
+    return 2;
+  }
+  if (wake) channel_ring_doorbell(&channel->channel);
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+
+static int channel_ready(lua_State *L, struct cr_io_wait *wait) {
+  // Called once the doorbell has rung.
+  struct channel_request *request = (struct channel_request *) wait;
+  if (channel_drain_doorbell(&request->channel->channel)) request->channel->hung_up = true;
+  return request->attempt(L, request);
+}
+
+
+static int channel_perform(lua_State *L, struct channel_request *request) {
+  int nresults = request->attempt(L, request);
+  if (nresults >= 0) return nresults;
+
+  request->wait.fd = request->channel->channel.doorbell;
+  request->wait.events = POLLIN;
+  request->wait.ready = &channel_ready;
+  struct cr_scheduler *scheduler = cr_Scheduler_running(L);
+  if (scheduler != NULL) {
+    // The request has to outlive this call, so move it into a userdata on the stack, along
+    // with the string being sent.
+    struct channel_request *waiting = lua_newuserdata(L, sizeof(*waiting));
+    memcpy(waiting, request, sizeof(*waiting));
+    return cr_Scheduler_wait_io(L, scheduler, &waiting->wait);
+  }
+
+  // Nothing else could run meanwhile, so just block.
+  while (1) {
+    struct pollfd pollfd;
+    pollfd.fd = request->wait.fd;
+    pollfd.events = request->wait.events;
+    if (ppoll(&pollfd, 1, NULL, NULL) == -1 && errno != EINTR) {
+      return luaL_error(L, "failed to wait for channel: %s", strerror(errno));
+    }
+    nresults = channel_ready(L, &request->wait);
+    if (nresults >= 0) return nresults;
+  }
+}
+
+
+static int cr_channel_open(lua_State *L) {
+  const char *name = luaL_checkstring(L, 1);
+  for (int i = 0; i < channel_count; ++i) {
+    if (strcmp(channels[i].name, name) == 0) {
+      struct cr_channel **channel = lua_newuserdata(L, sizeof(*channel));
+      *channel = &channels[i];
+      luaL_getmetatable(L, CHANNEL_METATABLE);
+      lua_setmetatable(L, -2);
+      return 1;
+    }
+  }
+  return luaL_error(L, "channel.open() got unknown channel %s", name);
+}
+
+
+static int cr_Channel_send(lua_State *L) {
+  struct channel_request request;
+  memset(&request, '\0', sizeof(request));
+  request.channel = *(struct cr_channel **) luaL_checkudata(L, 1, CHANNEL_METATABLE);
+  request.attempt = &channel_attempt_send;
+  request.data = luaL_checklstring(L, 2, &request.size);
+  if (request.size > channel_max_message(&request.channel->channel)) {
+    return luaL_error(L, "Channel:send() got a message longer than %d bytes",
+                      (int) channel_max_message(&request.channel->channel));
+  }
+  lua_settop(L, 2);
+  return channel_perform(L, &request);
+}
+
+
+static int cr_Channel_recv(lua_State *L) {
+  struct channel_request request;
+  memset(&request, '\0', sizeof(request));
+  request.channel = *(struct cr_channel **) luaL_checkudata(L, 1, CHANNEL_METATABLE);
+  request.attempt = &channel_attempt_recv;
+  lua_settop(L, 1);
+  return channel_perform(L, &request);
+}
+
+
+static int cr_Channel_close(lua_State *L) {
+  struct cr_channel *channel = *(struct cr_channel **) luaL_checkudata(L, 1, CHANNEL_METATABLE);
+  channel_close(&channel->channel, CHANNEL_FROM_SANDBOX);
+  return 0;
+}
+
+
+void cropen_channel(lua_State *L) {
+  luaL_Reg methods[4];
+  memset(&methods, '\0', sizeof(methods));
+  methods[0].name = "send";
+  methods[0].func = &cr_Channel_send;
+  methods[1].name = "recv";
+  methods[1].func = &cr_Channel_recv;
+  methods[2].name = "close";
+  methods[2].func = &cr_Channel_close;
+  luaL_newmetatable(L, CHANNEL_METATABLE);
+  lua_newtable(L);
+  luaL_register(L, NULL, methods);
+  lua_setfield(L, -2, "__index");
+  lua_pop(L, 1);
+
+  luaL_Reg library[2];
+  memset(&library, '\0', sizeof(library));
+  library[0].name = "open";
+  library[0].func = &cr_channel_open;
+  luaL_register(L, "channel", library);
+}
@@ -0,0 +1,39 @@
+#ifndef CR_CHANNEL_H
+#define CR_CHANNEL_H
+
+#include "lj_headers.h"
+
+
+/*
+  channel.open(name) -> Channel
+    Open the shared-memory channel passed to the sandbox with --channel NAME=MEMFD:DOORBELL
+    (see src/channel_ring.h for the host's side). Raises an error if there is none by that
+    name.
+
+  Channel:send(s)
+    Send the string `s` to the host. Returns true, or nil and an error message if the host
+    has gone away.
+
+  Channel:recv() -> string or nil
+    Receive the next message from the host. Returns nil once the host has closed the channel
+    and every message it sent has been received.
+
+  Channel:close()
+    Tell the host that no more messages will be sent.
+
+    send() waits while the ring to the host is full, and recv() while the ring from it is
+    empty. Called from a resumer.Scheduler task, they suspend only that task, and other tasks
+    keep running. Anywhere else, they block.
+*/
+void cropen_channel(lua_State *);
+
+/*
+  Map the channel in `memfd` under `name`, for channel.open(). Call before the sandbox is set
+  up, at most CR_CHANNEL_MAX times. Returns 0, or 1 after printing an error.
+*/
+#define CR_CHANNEL_MAX 16
+
+int cr_channel_attach(const char *name, int memfd, int doorbell);
+
+
+#endif
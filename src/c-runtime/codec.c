@@ -0,0 +1,377 @@
+#include "codec.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+
+#define BUFFER_METATABLE "codec.buffer"
+
+// Output buffers bigger than this are released after each codec.pack() instead of kept.
+#define BUFFER_KEEP_SIZE 65536
+
+
+/*
+  The output buffer of codec.pack(). It is allocated with the state's allocator, so it counts
+  against the memory limit, and lives in a userdata, so that a pack that raises an error
+  leaves it to be reused or collected instead of leaking it.
+*/
+struct codec_buffer {
+  unsigned char *data;
+  size_t size;
+  size_t capacity;
+};
+
+
+struct codec_reader {
+  const unsigned char *data;
+  size_t size;
+  size_t position;
+};
+
+
+static void codec_buffer_release(lua_State *L, struct codec_buffer *buffer) {
+  void *ud;
+  lua_Alloc alloc = lua_getallocf(L, &ud);
+  if (buffer->data != NULL) alloc(ud, buffer->data, buffer->capacity, 0);
+  buffer->data = NULL;
+  buffer->size = 0;
+  buffer->capacity = 0;
+}
+
+
+static unsigned char *codec_reserve(lua_State *L, struct codec_buffer *buffer, size_t n) {
+  if (n > buffer->capacity - buffer->size) {
+    if (n > SIZE_MAX / 2 - buffer->size) luaL_error(L, "codec.pack() result too large");
+    size_t capacity = buffer->capacity ? buffer->capacity * 2 : 256;
+    while (capacity < buffer->size + n) capacity *= 2;
+    void *ud;
+    lua_Alloc alloc = lua_getallocf(L, &ud);
+    void *data = alloc(ud, buffer->data, buffer->capacity, capacity);
+    if (data == NULL) luaL_error(L, "not enough memory");
+    buffer->data = data;
+    buffer->capacity = capacity;
+  }
+  unsigned char *out = buffer->data + buffer->size;
+  buffer->size += n;
+  return out;
+}
+
+
+static void codec_put(lua_State *L, struct codec_buffer *buffer, int tag, uint64_t value, int width) {
+  // Write a type byte followed by `value` as a big-endian integer `width` bytes wide.
+  unsigned char *out = codec_reserve(L, buffer, 1 + width);
+  out[0] = tag;
+  for (int i = width; i > 0; --i) {
+    out[i] = value & 0xff;
+    value >>= 8;
+  }
+}
+
+
+static void codec_put_length(lua_State *L, struct codec_buffer *buffer, size_t length,
+                             int fix_tag, size_t fix_limit, int tag8, int tag16, int tag32) {
+  // The header of a string, array or map. tag8 is -1 for arrays and maps, which have none.
+  if (length < fix_limit) {
+    codec_put(L, buffer, fix_tag | length, 0, 0);
+  } else if (tag8 != -1 && length <= UINT8_MAX) {
+    codec_put(L, buffer, tag8, length, 1);
+  } else if (length <= UINT16_MAX) {
+    codec_put(L, buffer, tag16, length, 2);
+  } else if (length <= UINT32_MAX) {
+    codec_put(L, buffer, tag32, length, 4);
+  } else {
+    luaL_error(L, "codec.pack() got a string or table too large for MessagePack");
+  }
+}
+
+
+static void codec_pack_number(lua_State *L, struct codec_buffer *buffer, lua_Number n) {
+  if (n == floor(n) && n >= 0 && n < 18446744073709551616.0 && !(n == 0 && signbit(n))) {
+    uint64_t value = (uint64_t) n;
+    if (value <= 0x7f) codec_put(L, buffer, value, 0, 0);
+    else if (value <= UINT8_MAX) codec_put(L, buffer, 0xcc, value, 1);
+    else if (value <= UINT16_MAX) codec_put(L, buffer, 0xcd, value, 2);
+    else if (value <= UINT32_MAX) codec_put(L, buffer, 0xce, value, 4);
+    else codec_put(L, buffer, 0xcf, value, 8);
+  } else if (n == floor(n) && n < 0 && n >= -9223372036854775808.0) {
+    int64_t value = (int64_t) n;
+    if (value >= -32) codec_put(L, buffer, (uint8_t) value, 0, 0);
+    else if (value >= INT8_MIN) codec_put(L, buffer, 0xd0, (uint8_t) value, 1);
+    else if (value >= INT16_MIN) codec_put(L, buffer, 0xd1, (uint16_t) value, 2);
+    else if (value >= INT32_MIN) codec_put(L, buffer, 0xd2, (uint32_t) value, 4);
+    else codec_put(L, buffer, 0xd3, (uint64_t) value, 8);
+  } else {
+    uint64_t bits;
+    double d = n;
+    memcpy(&bits, &d, sizeof(bits));
+    codec_put(L, buffer, 0xcb, bits, 8);
+  }
+}
+
+
+static void codec_pack_value(lua_State *L, struct codec_buffer *buffer, int index, int depth);
+
+
+static void codec_pack_table(lua_State *L, struct codec_buffer *buffer, int index, int depth) {
+  if (depth >= CODEC_MAX_DEPTH) {
+    luaL_error(L, "codec.pack() got tables nested more than %d deep (or a cycle)", CODEC_MAX_DEPTH);
+  }
+  luaL_checkstack(L, 3, "codec.pack() could not extend stack");
+
+  // It's an array if its keys are exactly 1..n.
+  size_t count = 0;
+  lua_Number max_key = 0;
+  bool array = true;
+  lua_pushnil(L);
+  while (lua_next(L, index)) {
+    lua_pop(L, 1);
+    ++count;
+    if (array) {
+      lua_Number key = lua_type(L, -1) == LUA_TNUMBER ? lua_tonumber(L, -1) : 0;
+      if (key >= 1 && key == floor(key)) {
+        if (key > max_key) max_key = key;
+      } else {
+        array = false;
+      }
+    }
+  }
+  array = array && max_key == count;
+
+  if (array) {
+    codec_put_length(L, buffer, count, 0x90, 16, -1, 0xdc, 0xdd);
+    for (size_t i = 1; i <= count; ++i) {
+      lua_rawgeti(L, index, i);
+      codec_pack_value(L, buffer, lua_gettop(L), depth + 1);
+      lua_pop(L, 1);
+    }
+  } else {
+    codec_put_length(L, buffer, count, 0x80, 16, -1, 0xde, 0xdf);
+    lua_pushnil(L);
+    while (lua_next(L, index)) {
+      int top = lua_gettop(L);
+      codec_pack_value(L, buffer, top - 1, depth + 1);
+      codec_pack_value(L, buffer, top, depth + 1);
+      lua_pop(L, 1);
+    }
+  }
+}
+
+
+static void codec_pack_value(lua_State *L, struct codec_buffer *buffer, int index, int depth) {
+  switch (lua_type(L, index)) {
+    case LUA_TNIL:
+      codec_put(L, buffer, 0xc0, 0, 0);
+      break;
+    case LUA_TBOOLEAN:
+      codec_put(L, buffer, lua_toboolean(L, index) ? 0xc3 : 0xc2, 0, 0);
+      break;
+    case LUA_TNUMBER:
+      codec_pack_number(L, buffer, lua_tonumber(L, index));
+      break;
+    case LUA_TSTRING: {
+      size_t length;
+      const char *s = lua_tolstring(L, index, &length);
+      codec_put_length(L, buffer, length, 0xa0, 32, 0xd9, 0xda, 0xdb);
+      memcpy(codec_reserve(L, buffer, length), s, length);
+      break;
+    }
+    case LUA_TTABLE:
+      codec_pack_table(L, buffer, index, depth);
+      break;
+    default:
+      luaL_error(L, "codec.pack() can't pack a %s", luaL_typename(L, index));
+  }
+}
+
+
+static struct codec_buffer *codec_buffer_new(lua_State *L) {
+  struct codec_buffer *buffer = lua_newuserdata(L, sizeof(*buffer));
+  memset(buffer, '\0', sizeof(*buffer));
+  luaL_getmetatable(L, BUFFER_METATABLE);
+  lua_setmetatable(L, -2);
+  return buffer;
+}
+
+
+/*
+  The shared buffer is taken out of the upvalue while in use, since any allocation can run a
+  finalizer that calls codec.pack() again. Such a call, like the one after a pack that raised
+  an error, gets a buffer of its own, which is kept for next time.
+*/
+static int cr_codec_pack(lua_State *L) {
+  luaL_checkany(L, 1);
+  lua_settop(L, 1);
+  lua_pushvalue(L, lua_upvalueindex(1));    // stack: [value, buffer]
+  struct codec_buffer *buffer = lua_touserdata(L, 2);
+  if (buffer == NULL) {
+    lua_pop(L, 1);
+    buffer = codec_buffer_new(L);
+  } else {
+    lua_pushnil(L);
+    lua_replace(L, lua_upvalueindex(1));
+  }
+  buffer->size = 0;
+  codec_pack_value(L, buffer, 1, 0);
+  lua_pushlstring(L, (const char *) buffer->data, buffer->size);
+  if (buffer->capacity > BUFFER_KEEP_SIZE) codec_buffer_release(L, buffer);
+  lua_pushvalue(L, 2);
+  lua_replace(L, lua_upvalueindex(1));
+  return 1;
+}
+
+
+static int cr_codec_buffer_gc(lua_State *L) {
+  codec_buffer_release(L, luaL_checkudata(L, 1, BUFFER_METATABLE));
+  return 0;
+}
+
+
+static const unsigned char *codec_take(lua_State *L, struct codec_reader *reader, size_t n) {
+  if (n > reader->size - reader->position) {
+    luaL_error(L, "codec.unpack() got truncated input at byte %d", (int) reader->position + 1);
+  }
+  const unsigned char *in = reader->data + reader->position;
+  reader->position += n;
+  return in;
+}
+
+
+static uint64_t codec_get(lua_State *L, struct codec_reader *reader, int width) {
+  // Read a big-endian integer `width` bytes wide.
+  const unsigned char *in = codec_take(L, reader, width);
+  uint64_t value = 0;
+  for (int i = 0; i < width; ++i) value = (value << 8) | in[i];
+  return value;
+}
+
+
+static void codec_unpack_value(lua_State *L, struct codec_reader *reader, int depth);
+
+
+static void codec_unpack_table(lua_State *L, struct codec_reader *reader, int depth,
+                               uint64_t count, bool map) {
+  // Every element takes at least a byte, so a bad count can't make this allocate much.
+  if (count > (reader->size - reader->position) / (map ? 2 : 1)) {
+    luaL_error(L, "codec.unpack() got truncated input at byte %d", (int) reader->position + 1);
+  }
+  if (depth >= CODEC_MAX_DEPTH) {
+    luaL_error(L, "codec.unpack() got tables nested more than %d deep", CODEC_MAX_DEPTH);
+  }
+  luaL_checkstack(L, 3, "codec.unpack() could not extend stack");
+  if (map) {
+    lua_createtable(L, 0, count);
+    for (uint64_t i = 0; i < count; ++i) {
+      size_t position = reader->position;
+      codec_unpack_value(L, reader, depth + 1);
+      if (lua_isnil(L, -1) || (lua_type(L, -1) == LUA_TNUMBER && isnan(lua_tonumber(L, -1)))) {
+        luaL_error(L, "codec.unpack() got an invalid map key at byte %d", (int) position + 1);
+      }
+      codec_unpack_value(L, reader, depth + 1);
+      lua_rawset(L, -3);
+    }
+  } else {
+    lua_createtable(L, count, 0);
+    for (uint64_t i = 0; i < count; ++i) {
+      codec_unpack_value(L, reader, depth + 1);
+      lua_rawseti(L, -2, i + 1);
+    }
+  }
+}
+
+
+static void codec_unpack_string(lua_State *L, struct codec_reader *reader, uint64_t length) {
+  if (length > reader->size - reader->position) {
+    luaL_error(L, "codec.unpack() got truncated input at byte %d", (int) reader->position + 1);
+  }
+  lua_pushlstring(L, (const char *) codec_take(L, reader, length), length);
+}
+
+
+static void codec_unpack_value(lua_State *L, struct codec_reader *reader, int depth) {
+  size_t position = reader->position;
+  int tag = *codec_take(L, reader, 1);
+  if (tag <= 0x7f) {
+    lua_pushnumber(L, tag);
+  } else if (tag <= 0x8f) {
+    codec_unpack_table(L, reader, depth, tag & 0x0f, true);
+  } else if (tag <= 0x9f) {
+    codec_unpack_table(L, reader, depth, tag & 0x0f, false);
+  } else if (tag <= 0xbf) {
+    codec_unpack_string(L, reader, tag & 0x1f);
+  } else if (tag >= 0xe0) {
+    lua_pushnumber(L, (int8_t) tag);
+  } else {
+    switch (tag) {
+      case 0xc0: lua_pushnil(L); break;
+      case 0xc2: lua_pushboolean(L, 0); break;
+      case 0xc3: lua_pushboolean(L, 1); break;
+      case 0xc4: case 0xd9: codec_unpack_string(L, reader, codec_get(L, reader, 1)); break;
+      case 0xc5: case 0xda: codec_unpack_string(L, reader, codec_get(L, reader, 2)); break;
+      case 0xc6: case 0xdb: codec_unpack_string(L, reader, codec_get(L, reader, 4)); break;
+      case 0xca: {
+        uint32_t bits = codec_get(L, reader, 4);
+        float f;
+        memcpy(&f, &bits, sizeof(f));
+        lua_pushnumber(L, f);
+        break;
+      }
+      case 0xcb: {
+        uint64_t bits = codec_get(L, reader, 8);
+        double d;
+        memcpy(&d, &bits, sizeof(d));
+        lua_pushnumber(L, d);
+        break;
+      }
+      case 0xcc: lua_pushnumber(L, (lua_Number) codec_get(L, reader, 1)); break;
+      case 0xcd: lua_pushnumber(L, (lua_Number) codec_get(L, reader, 2)); break;
+      case 0xce: lua_pushnumber(L, (lua_Number) codec_get(L, reader, 4)); break;
+      case 0xcf: lua_pushnumber(L, (lua_Number) codec_get(L, reader, 8)); break;
+      case 0xd0: lua_pushnumber(L, (int8_t) codec_get(L, reader, 1)); break;
+      case 0xd1: lua_pushnumber(L, (int16_t) codec_get(L, reader, 2)); break;
+      case 0xd2: lua_pushnumber(L, (int32_t) codec_get(L, reader, 4)); break;
+      case 0xd3: lua_pushnumber(L, (lua_Number) (int64_t) codec_get(L, reader, 8)); break;
+      case 0xdc: codec_unpack_table(L, reader, depth, codec_get(L, reader, 2), false); break;
+      case 0xdd: codec_unpack_table(L, reader, depth, codec_get(L, reader, 4), false); break;
+      case 0xde: codec_unpack_table(L, reader, depth, codec_get(L, reader, 2), true); break;
+      case 0xdf: codec_unpack_table(L, reader, depth, codec_get(L, reader, 4), true); break;
+      default: {
+        char name[8];
+        snprintf(name, sizeof(name), "0x%02x", tag);
+        luaL_error(L, "codec.unpack() got unsupported type %s at byte %d", name, (int) position + 1);
+      }
+    }
+  }
+}
+
+
+static int cr_codec_unpack(lua_State *L) {
+  struct codec_reader reader;
+  reader.data = (const unsigned char *) luaL_checklstring(L, 1, &reader.size);
+  lua_Integer position = luaL_optinteger(L, 2, 1);
+  luaL_argcheck(L, position >= 1 && (size_t) position <= reader.size + 1, 2, "position out of range");
+  reader.position = position - 1;
+  lua_settop(L, 1); // keeps the string, which is read in place, alive
+  codec_unpack_value(L, &reader, 0);
+  lua_pushnumber(L, (lua_Number) reader.position + 1);
+  return 2;
+}
+
+
+void cropen_codec(lua_State *L) {
+  luaL_Reg library[2];
+  memset(&library, '\0', sizeof(library));
+  library[0].name = "unpack";
+  library[0].func = &cr_codec_unpack;
+  luaL_register(L, "codec", library);       // stack: [codec]
+
+  luaL_newmetatable(L, BUFFER_METATABLE);
+  lua_pushcfunction(L, &cr_codec_buffer_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_pop(L, 1);
+  codec_buffer_new(L);                      // stack: [codec, buffer]
+  lua_pushcclosure(L, &cr_codec_pack, 1);
+  lua_setfield(L, -2, "pack");
+}
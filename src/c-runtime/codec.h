@@ -0,0 +1,30 @@
+#ifndef CR_CODEC_H
+#define CR_CODEC_H
+
+#include "lj_headers.h"
+
+
+/*
+  codec.pack(value) -> string
+    Serialize `value` as MessagePack. Supports nil, booleans, numbers, strings and tables of
+    those. A table whose keys are exactly 1..n becomes an array (so does an empty table), and
+    any other table a map. Numbers with an integral value are packed as the smallest integer
+    that holds them, and any others as 64-bit floats. Metatables are ignored. Tables nested
+    deeper than CODEC_MAX_DEPTH, which is also how reference cycles end, are an error.
+
+  codec.unpack(s [, position]) -> value, next position
+    Deserialize one MessagePack value from `s`, starting at byte `position` (default 1).
+    Also returns the position just after it, to read the next value of a stream. Strings and
+    binary data both become strings, and integers beyond 2^53 lose precision. Extension types,
+    nil map keys and truncated input are errors.
+
+  unpack reads the string in place, pack builds its result in a reusable buffer, and both
+  count every allocation against the script's memory limit. Either may be called again from
+  a finalizer that runs while it allocates.
+*/
+#define CODEC_MAX_DEPTH 128
+
+void cropen_codec(lua_State *);
+
+
+#endif
@@ -0,0 +1,225 @@
+#define _GNU_SOURCE
+#include "data.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+#define DATA_METATABLE "data.Data"
+
+
+struct cr_data {
+  const char *name;
+  const unsigned char *bytes;
+  size_t size;
+};
+
+static struct cr_data mounts[CR_DATA_MAX];
+static int mount_count = 0;
+
+
+int cr_data_mount(const char *name, const char *path) {
+  if (mount_count == CR_DATA_MAX) {
+    fprintf(stderr, "too many data mounts (at most %d)\n", CR_DATA_MAX);
+    return 1;
+  }
+  for (int i = 0; i < mount_count; ++i) {
+    if (strcmp(mounts[i].name, name) == 0) {
+      fprintf(stderr, "data mount %s given more than once\n", name);
+      return 1;
+    }
+  }
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    perror("failed to open data file");
+    return 1;
+  }
+  struct stat info;
+  if (fstat(fd, &info)) {
+    perror("failed to get data file size");
+    close(fd);
+    return 1;
+  }
+  struct cr_data *data = &mounts[mount_count];
+  data->bytes = (const unsigned char *) "";
+  data->size = info.st_size;
+  if (data->size != 0) { // mmap() refuses empty mappings
+    // MAP_PRIVATE would not help: pages never written come from the file either way, so the
+    // file has to stay as it is (see data.h).
+    void *mapping = mmap(NULL, data->size, PROT_READ, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+      perror("failed to map data file");
+      close(fd);
+      return 1;
+    }
+    data->bytes = mapping;
+  }
+  close(fd); // the mapping keeps it
+  data->name = name;
+  ++mount_count;
+  return 0;
+}
+
+
+size_t cr_data_mapped_size(void) {
+  size_t total = 0;
+  for (int i = 0; i < mount_count; ++i) total += mounts[i].size;
+  return total;
+}
+
+
+static struct cr_data *check_data(lua_State *L) {
+  return *(struct cr_data **) luaL_checkudata(L, 1, DATA_METATABLE);
+}
+
+
+// Convert a position counting back from the end, like the string functions do.
+static ptrdiff_t relative_position(ptrdiff_t position, size_t size) {
+  return position >= 0 ? position : (ptrdiff_t) size + position + 1;
+}
+
+
+static int cr_Data_len(lua_State *L) {
+  lua_pushnumber(L, check_data(L)->size);
+  return 1;
+}
+
+
+static int cr_Data_byte(lua_State *L) {
+  struct cr_data *data = check_data(L);
+  ptrdiff_t first = relative_position(luaL_optinteger(L, 2, 1), data->size);
+  ptrdiff_t last = relative_position(luaL_optinteger(L, 3, first), data->size);
+  if (first < 1) first = 1;
+  if (last > (ptrdiff_t) data->size) last = data->size;
+  if (first > last) return 0;
+  if (last - first >= INT_MAX) return luaL_error(L, "Data:byte() got too many bytes");
+  int count = last - first + 1;
+  luaL_checkstack(L, count, "Data:byte() got too many bytes");
+  for (int i = 0; i < count; ++i) lua_pushinteger(L, data->bytes[first - 1 + i]);
+  return count;
+}
+
+
+static int cr_Data_sub(lua_State *L) {
+  struct cr_data *data = check_data(L);
+  ptrdiff_t first = relative_position(luaL_checkinteger(L, 2), data->size);
+  ptrdiff_t last = relative_position(luaL_optinteger(L, 3, -1), data->size);
+  if (first < 1) first = 1;
+  if (last > (ptrdiff_t) data->size) last = data->size;
+  if (first > last) {
+    lua_pushliteral(L, "");
+  } else {
+    lua_pushlstring(L, (const char *) data->bytes + first - 1, last - first + 1);
+  }
+  return 1;
+}
+
+
+// The `width` bytes at the position in argument 2, which must all be within the file.
+static const unsigned char *check_range(lua_State *L, struct cr_data *data, size_t width) {
+  ptrdiff_t position = luaL_checkinteger(L, 2);
+  if (position < 1 || (size_t) position > data->size || data->size - (position - 1) < width) {
+    luaL_argerror(L, 2, "position out of range");
+  }
+  return data->bytes + position - 1;
+}
+
+
+static uint64_t read_le(const unsigned char *bytes, size_t width) {
+  uint64_t value = 0;
+  for (size_t i = width; i-- > 0;) value = (value << 8) | bytes[i];
+  return value;
+}
+
+
+static int cr_Data_u16le(lua_State *L) {
+  struct cr_data *data = check_data(L);
+  lua_pushnumber(L, (uint16_t) read_le(check_range(L, data, 2), 2));
+  return 1;
+}
+
+
+static int cr_Data_u32le(lua_State *L) {
+  struct cr_data *data = check_data(L);
+  lua_pushnumber(L, (uint32_t) read_le(check_range(L, data, 4), 4));
+  return 1;
+}
+
+
+static int cr_Data_i32le(lua_State *L) {
+  struct cr_data *data = check_data(L);
+  lua_pushnumber(L, (int32_t) read_le(check_range(L, data, 4), 4));
+  return 1;
+}
+
+
+static int cr_Data_f64le(lua_State *L) {
+  struct cr_data *data = check_data(L);
+  uint64_t bits = read_le(check_range(L, data, 8), 8);
+  double value;
+  memcpy(&value, &bits, sizeof(value));
+  lua_pushnumber(L, value);
+  return 1;
+}
+
+
+static int cr_Data_pointer(lua_State *L) {
+  // ffi.cast() turns a light userdata into a pointer. The script's own require() might have
+  // been replaced, so the original one is kept as an upvalue.
+  struct cr_data *data = check_data(L);
+  lua_pushvalue(L, lua_upvalueindex(1));
+  lua_pushliteral(L, "ffi");
+  lua_call(L, 1, 1);
+  lua_getfield(L, -1, "cast");
+  lua_pushliteral(L, "const uint8_t *");
+  lua_pushlightuserdata(L, (void *) data->bytes);
+  lua_call(L, 2, 1);
+  return 1;
+}
+
+
+void cropen_data(lua_State *L) {
+  luaL_Reg methods[7];
+  memset(&methods, '\0', sizeof(methods));
+  methods[0].name = "byte";
+  methods[0].func = &cr_Data_byte;
+  methods[1].name = "sub";
+  methods[1].func = &cr_Data_sub;
+  methods[2].name = "u16le";
+  methods[2].func = &cr_Data_u16le;
+  methods[3].name = "u32le";
+  methods[3].func = &cr_Data_u32le;
+  methods[4].name = "i32le";
+  methods[4].func = &cr_Data_i32le;
+  methods[5].name = "f64le";
+  methods[5].func = &cr_Data_f64le;
+  luaL_newmetatable(L, DATA_METATABLE);
+  lua_pushcfunction(L, &cr_Data_len);
+  lua_setfield(L, -2, "__len");
+  lua_newtable(L);
+  luaL_register(L, NULL, methods);
+  lua_getglobal(L, "require");
+  lua_pushcclosure(L, &cr_Data_pointer, 1);
+  lua_setfield(L, -2, "pointer");
+  lua_setfield(L, -2, "__index");
+  lua_pop(L, 1);
+
+  // stack: sandbox, data
+  lua_getglobal(L, "sandbox");
+  lua_newtable(L);
+  for (int i = 0; i < mount_count; ++i) {
+    struct cr_data **data = lua_newuserdata(L, sizeof(*data));
+    *data = &mounts[i];
+    luaL_getmetatable(L, DATA_METATABLE);
+    lua_setmetatable(L, -2);
+    lua_setfield(L, -2, mounts[i].name);
+  }
+  lua_setfield(L, -2, "data");
+  lua_pop(L, 1);
+}
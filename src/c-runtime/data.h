@@ -0,0 +1,45 @@
+#ifndef CR_DATA_H
+#define CR_DATA_H
+
+#include "lj_headers.h"
+
+#include <stddef.h>
+
+
+#define CR_DATA_MAX 16
+
+
+/*
+  sandbox.data.NAME -> Data
+    The file mounted with --data NAME=PATH, mapped read-only. It is not copied, and does not
+    count towards the script's memory limit. The file must not change while scripts run:
+    writes show through, and reading past its end after it was truncated kills the script
+    with SIGBUS, whichever way it is mapped.
+
+  #data
+    The size of the file in bytes.
+
+  Data:byte([i [, j]]) and Data:sub(i [, j])
+    Like string.byte() and string.sub() on the file's contents.
+
+  Data:u16le(pos), Data:u32le(pos), Data:i32le(pos), Data:f64le(pos)
+    Read a little-endian number starting at byte `pos`, counting from 1 like the string
+    functions. Raises an error unless the whole number is within the file.
+
+  Data:pointer() -> cdata
+    A `const uint8_t *` to the first byte, for loops the JIT compiler should see through.
+    It counts from 0 and is not bounds-checked. Writing through it crashes the script.
+*/
+void cropen_data(lua_State *);
+
+/*
+  Map the file at `path` under `name`, for sandbox.data. Call before the sandbox is set up,
+  at most CR_DATA_MAX times. Returns 0, or 1 after printing an error.
+*/
+int cr_data_mount(const char *name, const char *path);
+
+// Total size of the mounted files, which the sandbox's address space limit has to allow for.
+size_t cr_data_mapped_size(void);
+
+
+#endif
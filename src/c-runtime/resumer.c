@@ -1,8 +1,431 @@
+#define _GNU_SOURCE
 #include "resumer.h"
+#include "timer.h"
+#include "../allocator.h"
+#include "../interrupt.h"
 
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
 
+/*
+  Threads whose Resumer function has returned are kept in a pool and handed to new Resumers,
+  so that short-lived Resumers don't leave a thread behind for the GC every time. Reusing them
+  is safe because of how Resumers pass control around: a suspended thread can only be resumed
+  through the one Resumer that last recorded it as `resume_next`, and resuming it replaces that
+  record. By the time a thread has returned, no Resumer refers to it any more. Its Resumer's
+  account, if it has one, still holds it, but only to keep its address from being taken by
+  another thread while it is the account's key, and that entry is removed when it returns.
+
+  The idle threads are kept on the stack of another thread, which is much cheaper than a table.
+*/
+#define RESUME_NEXT lua_upvalueindex(1)
+#define POOL lua_upvalueindex(2)
+
+#define DEFAULT_POOL_SIZE 64
+
+struct cr_thread_pool {
+  lua_State *threads; // Idle threads, on its stack. Referenced by the userdata's environment.
+  int size;           // Maximum number of idle threads to keep.
+};
+
+struct cr_resumer_stats cr_resumer_stats;
+
+
+/*
+  Move `n` values from the top of one stack to another. Most hops carry no values at all, and
+  those skip the stack check.
+*/
+static inline void cr_transfer(lua_State *from, lua_State *to, int n, const char *message) {
+  if (n == 0) return;
+  luaL_checkstack(to, n, message);
+  lua_xmove(from, to, n);
+}
+
+
+/*
+  Offer the finished thread at `index` of L's stack to the pool.
+*/
+static void cr_Resumer_recycle(lua_State *L, int index) {
+  struct cr_thread_pool *pool = (struct cr_thread_pool *) lua_touserdata(L, POOL);
+  if (lua_gettop(pool->threads) >= pool->size || !lua_checkstack(pool->threads, 1)) return;
+  lua_settop(lua_tothread(L, index), 0);
+  lua_pushvalue(L, index);
+  lua_xmove(L, pool->threads, 1);
+}
+
+
+/*
+  Accounting
+
+  A Resumer can have an account of the time its thread has spent running and the bytes the
+  Lua heap handed out meanwhile. It is created by the first resumer.usage() or set_quota() for
+  the Resumer, kept in a userdata in its upvalues, and found by thread in a hash table. The
+  loops that resume threads (Resumer:outer_loop() and Scheduler:run()) call
+  cr_account_switch_to() with each thread before resuming it, and with their own when they
+  return, so every interval is charged to exactly one account, or none. While no account
+  exists, that is all a switch costs.
+
+  Time is wall-clock time from the monotonic clock, read once per switch through the vDSO, so
+  a thread that blocks in a system call is charged for the wait. (The sandbox only lets the
+  monotonic clock be read, not a thread's CPU clock.) Bytes are the growth of the allocator's
+  running total.
+
+  An account over one of its quotas gets an error raised in its thread the next time that
+  thread runs. The allocator also interrupts a thread as soon as it passes its allocation
+  quota; the time quota is only checked at switches, and a thread that never yields is stopped
+  by the sandbox's CPU budget instead.
+*/
+#define ACCOUNT 3                    // The upvalue that holds a Resumer's account, or nil.
+
+#define ACCOUNT_METATABLE "resumer.Account"
+
+struct cr_account {
+  lua_State *thread;
+  uint64_t time_ns;
+  size_t allocated;
+  uint64_t time_quota_ns;               // Zero for none.
+  size_t allocation_quota;             // Zero for none.
+};
+
+struct cr_account_slot {
+  lua_State *thread;                   // NULL for an empty slot.
+  struct cr_account *account;
+};
+
+static struct cr_account_slot *account_slots = NULL;
+static size_t account_slots_size = 0;  // A power of two, kept at least twice `account_count`.
+static size_t account_count = 0;
+
+static struct cr_account *running_account = NULL;
+static uint64_t running_since;
+static size_t running_allocated_since;
+
+
+static inline size_t cr_account_home(lua_State *thread) {
+  return (size_t) (((uint64_t) (uintptr_t) thread * 0x9e3779b97f4a7c15u) >> 32) &
+         (account_slots_size - 1);
+}
+
+
+static inline struct cr_account *cr_account_find(lua_State *thread) {
+  if (account_count == 0) return NULL;
+  size_t mask = account_slots_size - 1;
+  for (size_t i = cr_account_home(thread); account_slots[i].thread != NULL; i = (i + 1) & mask) {
+    if (account_slots[i].thread == thread) return account_slots[i].account;
+  }
+  return NULL;
+}
+
+
+// Returns 0, or -1 if there was no memory to grow the table.
+static int cr_account_insert(lua_State *thread, struct cr_account *account) {
+  if ((account_count + 1) * 2 > account_slots_size) {
+    size_t size = account_slots_size != 0 ? account_slots_size * 2 : 64;
+    struct cr_account_slot *slots = calloc(size, sizeof(*slots));
+    if (slots == NULL) return -1;
+    struct cr_account_slot *old_slots = account_slots;
+    size_t old_size = account_slots_size;
+    account_slots = slots;
+    account_slots_size = size;
+    for (size_t i = 0; i < old_size; ++i) {
+      if (old_slots[i].thread == NULL) continue;
+      size_t j = cr_account_home(old_slots[i].thread);
+      while (slots[j].thread != NULL) j = (j + 1) & (size - 1);
+      slots[j] = old_slots[i];
+    }
+    free(old_slots);
+  }
+  size_t mask = account_slots_size - 1;
+  size_t i = cr_account_home(thread);
+  while (account_slots[i].thread != NULL && account_slots[i].thread != thread) i = (i + 1) & mask;
+  if (account_slots[i].thread == NULL) ++account_count;
+  account_slots[i].thread = thread;
+  account_slots[i].account = account;
+  return 0;
+}
+
+
+// Stop charging `thread` to `account`, or to whatever account it has if `account` is NULL.
+static void cr_account_remove(lua_State *thread, struct cr_account *account) {
+  if (account_count == 0) return;
+  size_t mask = account_slots_size - 1;
+  size_t i = cr_account_home(thread);
+  while (account_slots[i].thread != thread) {
+    if (account_slots[i].thread == NULL) return;
+    i = (i + 1) & mask;
+  }
+  if (account != NULL && account_slots[i].account != account) return;
+  if (running_account == account_slots[i].account) running_account = NULL;
+  // Shift later entries of the same run back into the hole, so lookups never stop early.
+  for (size_t j = (i + 1) & mask; account_slots[j].thread != NULL; j = (j + 1) & mask) {
+    size_t home = cr_account_home(account_slots[j].thread);
+    bool stays = i < j ? (home > i && home <= j) : (home > i || home <= j);
+    if (!stays) {
+      account_slots[i] = account_slots[j];
+      i = j;
+    }
+  }
+  account_slots[i].thread = NULL;
+  --account_count;
+}
+
+
+static inline bool cr_account_over_quota(const struct cr_account *account) {
+  return (account->time_quota_ns != 0 && account->time_ns >= account->time_quota_ns) ||
+         (account->allocation_quota != 0 && account->allocated >= account->allocation_quota);
+}
+
+
+// Charge what happened since the last switch to the running account, and start on `next`.
+static void cr_account_switch(struct cr_account *next) {
+  if (running_account == NULL && next == NULL) return;
+  uint64_t now = cr_timer_now();
+  size_t total = allocator_stats.total;
+  if (running_account != NULL) {
+    running_account->time_ns += now - running_since;
+    running_account->allocated += total - running_allocated_since;
+  }
+  running_since = now;
+  running_allocated_since = total;
+  running_account = next;
+
+  size_t watermark = SIZE_MAX;
+  if (next != NULL) {
+    if (cr_account_over_quota(next)) {
+      interrupt_request(INTERRUPT_QUOTA);
+    } else if (next->allocation_quota != 0) {
+      watermark = total + (next->allocation_quota - next->allocated);
+    }
+  }
+  allocator_set_watermark(watermark);
+}
+
+
+void cr_Resumer_enforce_quota(lua_State *L) {
+  struct cr_account *account = running_account;
+  if (account == NULL) return;
+  cr_account_switch(account);
+  if (account->time_quota_ns != 0 && account->time_ns >= account->time_quota_ns) {
+    luaL_error(L, "Resumer time quota exceeded");
+  }
+  if (account->allocation_quota != 0 && account->allocated >= account->allocation_quota) {
+    luaL_error(L, "Resumer allocation quota exceeded");
+  }
+}
+
+
+// Switch to the account of `thread`, if any. Cheap while no Resumer has an account.
+static inline void cr_account_switch_to(lua_State *thread) {
+  if (account_count == 0 && running_account == NULL) return;
+  cr_account_switch(cr_account_find(thread));
+}
+
+
+static int cr_account_gc(lua_State *L) {
+  struct cr_account *account = lua_touserdata(L, 1);
+  cr_account_remove(account->thread, account);
+  return 0;
+}
+
+
+/*
+  GC pacing
+
+  With resumer.gc_budget(us) set, the loops that resume threads collect garbage between slices
+  instead of letting the collector step inside them. Before each switch, once the live heap has
+  grown by `pause` percent since the last cycle, they do incremental steps for up to the budget,
+  and Scheduler:run() keeps going while it has nothing to do but wait. The collector's own
+  threshold is kept further out, so that it only steps inside slices when they allocate faster
+  than the budget lets it keep up with.
+
+  After each cycle, `pause` adapts to how much was allocated while it ran, so that the next one
+  starts early enough for the heap to peak where collectgarbage("setpause") said it should,
+  rather than that much above it when a cycle takes many switches to finish. `stepmul` sets
+  how much work a step does, and adapts so that steps stay well inside the budget, which
+  bounds how far a switch can run over it. The atomic step, which marks whatever changed during
+  the cycle all at once, is left out of that, since no setting makes it smaller.
+*/
+#define GC_PAUSE_MIN 110
+#define GC_STEPMUL_MIN 50
+#define GC_STEPMUL_MAX 1600
+
+static struct {
+  uint64_t budget_ns;     // Zero while the policy is off.
+  bool collecting;        // A cycle is in progress, stepped only by this policy.
+  int target_pause;       // The pause that was set for the collector.
+  int pause;
+  int stepmul;
+  size_t base;            // The live heap when the last cycle finished.
+  size_t trigger;         // Start a cycle once the live heap reaches this.
+  size_t cycle_total;     // allocator_stats.total when the cycle started.
+  uint64_t longest_step;  // Of the cycle's steps, in nanoseconds.
+  unsigned int overruns;  // Steps of the cycle that took more than half the budget.
+  int saved_pause;        // The collector's settings from before the policy was turned on.
+  int saved_stepmul;
+} gc_pacing;
+
+
+/*
+  Set the collector's threshold for while the slices run. It would otherwise go by its estimate
+  of the heap from the cycle's atomic step, which leaves out everything allocated in the slices
+  since, and start the next cycle inside one of them.
+
+  Between cycles, the threshold is twice the trigger. During one, it is what the cycle may
+  still allocate: whatever is allocated during a cycle survives it and counts towards the next
+  base, so a cycle that allocated more than half of the last one could set off a runaway. Once
+  past that, the pacing isn't keeping up, and the collector steps as the slices allocate again,
+  as it would without it.
+*/
+static void cr_gc_set_backstop(lua_State *L) {
+  size_t live = allocator_stats.live;
+  size_t limit = gc_pacing.trigger * 2;
+  if (gc_pacing.collecting) {
+    size_t allocated = allocator_stats.total - gc_pacing.cycle_total;
+    limit = allocated < gc_pacing.base / 2 ? live + (gc_pacing.base / 2 - allocated) : 0;
+  }
+  if (limit / (live / 100 + 1) > 100) {
+    // LUA_GCRESTART with -1 sets the threshold to `pause` percent of the heap as it is now.
+    size_t pause = limit / (live / 100 + 1);
+    lua_gc(L, LUA_GCSETPAUSE, pause < INT_MAX ? (int) pause : INT_MAX);
+    lua_gc(L, LUA_GCSETSTEPMUL, gc_pacing.stepmul);
+    lua_gc(L, LUA_GCRESTART, -1);
+  } else {
+    // Our stepmul only sizes the steps between slices, and can be too low to keep up with.
+    lua_gc(L, LUA_GCSETPAUSE, gc_pacing.target_pause);
+    lua_gc(L, LUA_GCSETSTEPMUL, gc_pacing.saved_stepmul);
+    lua_gc(L, LUA_GCRESTART, 0);
+  }
+}
+
+
+static void cr_gc_set_trigger(void) {
+  gc_pacing.base = allocator_stats.live;
+  gc_pacing.trigger = gc_pacing.base / 100 * gc_pacing.pause;
+}
+
+
+static void cr_gc_cycle_done(void) {
+  // The growth during the cycle, as a percentage of the heap it started from, comes off the
+  // target. Halfway there at a time, so that one odd cycle doesn't throw it off.
+  size_t allocated = allocator_stats.total - gc_pacing.cycle_total;
+  size_t growth = allocated / (gc_pacing.base / 100 + 1);
+  int pause = GC_PAUSE_MIN;
+  if (growth < (size_t) (gc_pacing.target_pause - GC_PAUSE_MIN)) {
+    pause = gc_pacing.target_pause - (int) growth;
+  }
+  gc_pacing.pause = (gc_pacing.pause + pause) / 2;
+
+  // One overrun is expected: the atomic step.
+  if (gc_pacing.overruns > 1) {
+    gc_pacing.stepmul /= 2;
+  } else if (gc_pacing.overruns == 0 && gc_pacing.longest_step < gc_pacing.budget_ns / 8) {
+    gc_pacing.stepmul *= 2;
+  }
+  if (gc_pacing.stepmul < GC_STEPMUL_MIN) gc_pacing.stepmul = GC_STEPMUL_MIN;
+  if (gc_pacing.stepmul > GC_STEPMUL_MAX) gc_pacing.stepmul = GC_STEPMUL_MAX;
+
+  gc_pacing.collecting = false;
+  cr_gc_set_trigger();
+}
+
+
+// Step the collector until the cycle finishes or `deadline` passes.
+static void cr_gc_work(lua_State *L, uint64_t deadline) {
+  cr_account_switch(NULL); // Collecting is charged to no thread.
+  if (!gc_pacing.collecting) {
+    gc_pacing.collecting = true;
+    gc_pacing.cycle_total = allocator_stats.total;
+    gc_pacing.longest_step = 0;
+    gc_pacing.overruns = 0;
+  }
+  uint64_t now = cr_timer_now();
+  int finished;
+  do {
+    uint64_t start = now;
+    finished = lua_gc(L, LUA_GCSTEP, 0);
+    now = cr_timer_now();
+    if (now - start > gc_pacing.budget_ns / 2) {
+      ++gc_pacing.overruns;
+    } else if (now - start > gc_pacing.longest_step) {
+      gc_pacing.longest_step = now - start;
+    }
+    ++cr_resumer_stats.gc_steps;
+  } while (!finished && now < deadline);
+  if (finished) cr_gc_cycle_done();
+  cr_gc_set_backstop(L);
+}
+
+
+// At a switch: collect for up to the budget, if it's time to.
+static inline void cr_gc_boundary(lua_State *L) {
+  if (gc_pacing.budget_ns == 0) return;
+  if (!gc_pacing.collecting && allocator_stats.live < gc_pacing.trigger) return;
+  cr_gc_work(L, cr_timer_now() + gc_pacing.budget_ns);
+}
+
+
+/*
+  While waiting for I/O or a timer: collect for up to the budget, but no later than
+  `deadline`, if there is a cycle to finish or at least half the headroom has been used.
+  Returns whether there was anything to do.
+*/
+static bool cr_gc_idle(lua_State *L, uint64_t deadline) {
+  if (gc_pacing.budget_ns == 0) return false;
+  if (!gc_pacing.collecting &&
+      allocator_stats.live < gc_pacing.base + (gc_pacing.trigger - gc_pacing.base) / 2) {
+    return false;
+  }
+  uint64_t now = cr_timer_now();
+  if (now >= deadline) return false;
+  if (deadline - now > gc_pacing.budget_ns) deadline = now + gc_pacing.budget_ns;
+  cr_gc_work(L, deadline);
+  return true;
+}
+
+
+/*
+  resumer.gc_budget([us])
+    Return the time in microseconds that may be spent collecting garbage at each switch, and
+    set it if `us` is given. Zero, the default, leaves collection to the collector, where it
+    happens inside slices as they allocate. Anything else turns on the pacing above, which aims
+    for the pause that collectgarbage("setpause") last set, and takes over from ("stop"),
+    ("setpause") and ("setstepmul") until it is turned off again.
+*/
+static int cr_gc_budget(lua_State *L) {
+  lua_pushnumber(L, gc_pacing.budget_ns / 1e3);
+  if (lua_isnoneornil(L, 1)) return 1;
+  lua_Number us = luaL_checknumber(L, 1);
+  luaL_argcheck(L, us >= 0 && us < 1e12, 1, "budget must be between 0 and 1e12");
+  uint64_t budget_ns = (uint64_t) (us * 1e3);
+  if (us > 0 && budget_ns == 0) budget_ns = 1;
+  if (budget_ns != 0 && gc_pacing.budget_ns == 0) {
+    gc_pacing.saved_pause = lua_gc(L, LUA_GCSETPAUSE, 200);
+    gc_pacing.saved_stepmul = lua_gc(L, LUA_GCSETSTEPMUL, 200);
+    gc_pacing.target_pause =
+        gc_pacing.saved_pause < GC_PAUSE_MIN ? GC_PAUSE_MIN : gc_pacing.saved_pause;
+    gc_pacing.pause = gc_pacing.target_pause;
+    gc_pacing.stepmul = 200;
+    gc_pacing.collecting = false;
+    cr_gc_set_trigger();
+    cr_gc_set_backstop(L);
+  } else if (budget_ns == 0 && gc_pacing.budget_ns != 0) {
+    lua_gc(L, LUA_GCSETPAUSE, gc_pacing.saved_pause);
+    lua_gc(L, LUA_GCSETSTEPMUL, gc_pacing.saved_stepmul);
+    lua_gc(L, LUA_GCRESTART, -1);
+    gc_pacing.collecting = false;
+  }
+  gc_pacing.budget_ns = budget_ns;
+  return 1;
+}
+
+
 /*
   Resumer:outer_loop(partial(thread, args...))
     Resume `thread` with arguments `args` until it yields to the main
@@ -18,6 +441,9 @@ static int cr_Resumer_outer_loop(lua_State *L, lua_State *thread, int nargs) {
   int status;
 
   while (1) {
+    cr_gc_boundary(L);
+    ++cr_resumer_stats.switches;
+    cr_account_switch_to(thread);
     status = lua_resume(thread, nargs);
     nargs = lua_gettop(thread); // this is the number of returned values
 
@@ -25,13 +451,16 @@ static int cr_Resumer_outer_loop(lua_State *L, lua_State *thread, int nargs) {
       // Thread exited without errors. Return whatever it returned.
       // stack: [thread]
       // thread stack: [args...]
-      luaL_checkstack(L, nargs, "Resumer:outer_loop() could not extend stack");
-      lua_xmove(thread, L, nargs);
+      cr_account_switch_to(L);
+      cr_account_remove(thread, NULL);
+      cr_transfer(thread, L, nargs, "Resumer:outer_loop() could not extend stack");
       // stack: [thread, args...]
+      cr_Resumer_recycle(L, 1);
       return nargs; // return args...
 
     } else if (status == LUA_YIELD) {
       if (nargs == 0) {
+        cr_account_switch_to(L);
         return luaL_error(L, "Resumer:outer_loop() got an unexpected yield without a thread to resume");
       }
       // Thread yielded, but may wish us to resume a different thread, passed as the last yielded value.
@@ -60,8 +489,8 @@ static int cr_Resumer_outer_loop(lua_State *L, lua_State *thread, int nargs) {
         // the one that just yielded. This silly case is supported, and just causes
         // Resumer:resume() to return its arguments.
         if (thread != next_thread) {
-          luaL_checkstack(next_thread, nargs, "Resumer:outer_loop() could not extend next thread stack");
-          lua_xmove(thread, next_thread, nargs); // Use return values as arguments to `next_thread`.
+          // Use return values as arguments to `next_thread`.
+          cr_transfer(thread, next_thread, nargs, "Resumer:outer_loop() could not extend next thread stack");
           // stack: [thread, next_thread]
           // thread stack: []
           // next_thread stack: [args...]
@@ -77,14 +506,16 @@ static int cr_Resumer_outer_loop(lua_State *L, lua_State *thread, int nargs) {
 
       } else {
         // We don't need to resume another thread. Return all the yielded values, except the last nil.
+        cr_account_switch_to(L);
         lua_pop(thread, 1); // Remove the nil.
-        luaL_checkstack(L, nargs, "Resumer:outer_loop() could not extend stack");
-        lua_xmove(thread, L, nargs);
+        cr_transfer(thread, L, nargs, "Resumer:outer_loop() could not extend stack");
         return nargs;
       }
 
     } else {
       // Error in thread. Re-raise in the main thread.
+      cr_account_switch_to(L);
+      cr_account_remove(thread, NULL);
       return luaL_error(L, "error in thread: %s", lua_tostring(thread, -1));
     }
   }
@@ -95,6 +526,7 @@ static int cr_Resumer_outer_loop(lua_State *L, lua_State *thread, int nargs) {
   function Resumer:resume(...)
     Upvalues:
       - Thread resume_next
+      - Thread pool
     local resume_to = resume_next
     if current thread is main thread
       resume_next = nil
@@ -104,7 +536,7 @@ static int cr_Resumer_outer_loop(lua_State *L, lua_State *thread, int nargs) {
 */
 static int cr_Resumer_resume(lua_State *L) {
   int nargs = lua_gettop(L);                // stack: [args...]
-  lua_pushvalue(L, lua_upvalueindex(1));    // stack: [args..., resume_to]
+  lua_pushvalue(L, RESUME_NEXT);            // stack: [args..., resume_to]
 
   if (lua_pushthread(L)) {                  // stack: [args..., resume_to, current coroutine]
 
@@ -112,7 +544,7 @@ static int cr_Resumer_resume(lua_State *L) {
     // mainloop with the args and `resume_to` (like we would do if we were in any other
     // thread), become the mainloop and resume `resume_to` directly.
     lua_pop(L, 2);                          // stack: [args...]
-    lua_State *resume_to = lua_tothread(L, lua_upvalueindex(1));
+    lua_State *resume_to = lua_tothread(L, RESUME_NEXT);
     if (resume_to == NULL) {
       // The value `resume_to` wasn't a thread, which means it must have been nil. That
       // means the caller asked to resume itself, which although silly, is supported.
@@ -122,24 +554,23 @@ static int cr_Resumer_resume(lua_State *L) {
     }
 
     // stack: [args...]
-    luaL_checkstack(resume_to, nargs, "Resumer:resume() could not extend target thread's stack");
-    lua_xmove(L, resume_to, nargs);
+    cr_transfer(L, resume_to, nargs, "Resumer:resume() could not extend target thread's stack");
     // stack: []
     // resume_to stack: [args...]
 
     // Notice that we maintain a reference to `resume_to` in the upvalues until we're
     // ready to put it back in the stack, and only then do we replace the upvalue.
     // This prevents `resume_to` from becoming unreachable.
-    lua_pushvalue(L, lua_upvalueindex(1));  // stack: [resume_to(args...)]
+    lua_pushvalue(L, RESUME_NEXT);          // stack: [resume_to(args...)]
     lua_pushnil(L);                         // stack: [resume_to(args...), nil]
-    lua_replace(L, lua_upvalueindex(1));    // stack: [resume_to(args...)]  ;   resume_next = nil
+    lua_replace(L, RESUME_NEXT);            // stack: [resume_to(args...)]  ;   resume_next = nil
 
     // return resume(resume_to, args...)
     return cr_Resumer_outer_loop(L, resume_to, nargs);
   }
 
   // stack: [args..., resume_to, current coroutine]
-  lua_replace(L, lua_upvalueindex(1));      // stack: [args..., resume_to]  ;   resume_next = L
+  lua_replace(L, RESUME_NEXT);              // stack: [args..., resume_to]  ;   resume_next = L
   return lua_yield(L, nargs + 1);           // return: args..., resume_to
 }
 
@@ -151,19 +582,1192 @@ int cr_new_Resumer(lua_State *L) {
   } else if (lua_iscfunction(L, 1) || !lua_isfunction(L, 1)) {
     return luaL_error(L, "new Resumer() expected lua function");
   }
-  lua_State *thread = lua_newthread(L);     // stack: [function, thread]
+  struct cr_thread_pool *pool = (struct cr_thread_pool *) lua_touserdata(L, lua_upvalueindex(1));
+  lua_State *thread;
+  if (lua_gettop(pool->threads) > 0) {
+    thread = lua_tothread(pool->threads, -1);
+    lua_xmove(pool->threads, L, 1);         // stack: [function, thread]
+    // Undo any setfenv(0, ...) by its last function, as lua_newthread() would start it.
+    lua_pushvalue(L, LUA_GLOBALSINDEX);     // stack: [function, thread, globals]
+    lua_setfenv(L, -2);                     // stack: [function, thread]
+  } else {
+    thread = lua_newthread(L);              // stack: [function, thread]
+    ++cr_resumer_stats.threads_created;
+  }
   lua_insert(L, -2);                        // stack: [thread, function]
   lua_xmove(L, thread, 1);                  // stack: [thread]
   // thread stack: [function]
-  lua_pushcclosure(L, &cr_Resumer_resume, 1);     // stack: [resumer(thread[function])]
+  lua_pushvalue(L, lua_upvalueindex(1));    // stack: [thread, pool]
+  lua_pushnil(L);                           // stack: [thread, pool, account]
+  lua_pushcclosure(L, &cr_Resumer_resume, 3);     // stack: [resumer(thread[function])]
+  return 1;
+}
+
+
+/*
+  The account of the Resumer at `index`, created if it has none yet. That is only possible
+  before its thread first runs, when the Resumer still records it as `resume_next` and it is
+  the only thread that can be recorded there without having yielded.
+*/
+static struct cr_account *cr_Resumer_account(lua_State *L, int index) {
+  luaL_argcheck(L, lua_tocfunction(L, index) == &cr_Resumer_resume, index, "Resumer expected");
+  lua_getupvalue(L, index, ACCOUNT);
+  struct cr_account *account = lua_touserdata(L, -1);
+  lua_pop(L, 1);                            // The Resumer still refers to it.
+  if (account != NULL) return account;
+
+  lua_getupvalue(L, index, 1);              // stack: [..., thread]
+  lua_State *thread = lua_tothread(L, -1);
+  if (thread == NULL || lua_status(thread) != 0) {
+    luaL_error(L, "Resumer accounting must start before the Resumer first runs");
+  }
+  account = lua_newuserdata(L, sizeof(*account));
+  memset(account, '\0', sizeof(*account));
+  account->thread = thread;
+  luaL_getmetatable(L, ACCOUNT_METATABLE);
+  lua_setmetatable(L, -2);
+  lua_createtable(L, 1, 0);
+  lua_pushvalue(L, -3);
+  lua_rawseti(L, -2, 1);
+  lua_setfenv(L, -2);                       // stack: [..., thread, account]
+  if (cr_account_insert(thread, account)) {
+    luaL_error(L, "Resumer accounting could not allocate memory");
+  }
+  lua_setupvalue(L, index, ACCOUNT);
+  lua_pop(L, 1);
+  return account;
+}
+
+
+/*
+  resumer.usage(r) -> ms, bytes
+    Return the wall-clock time the thread of Resumer `r` has spent running, in milliseconds,
+    and the bytes allocated while it ran, since accounting for it started.
+*/
+static int cr_Resumer_usage(lua_State *L) {
+  struct cr_account *account = cr_Resumer_account(L, 1);
+  if (account == running_account) cr_account_switch(account); // Bring it up to date.
+  lua_pushnumber(L, account->time_ns / 1e6);
+  lua_pushnumber(L, (lua_Number) account->allocated);
+  return 2;
+}
+
+
+/*
+  resumer.set_quota(r, [ms], [bytes])
+    Limit the thread of Resumer `r` to `ms` milliseconds of running and `bytes` bytes of
+    allocation in all, where nil or zero means no limit. A thread over its quota gets an error
+    every time it is resumed.
+*/
+static int cr_Resumer_set_quota(lua_State *L) {
+  struct cr_account *account = cr_Resumer_account(L, 1);
+  lua_Number ms = luaL_optnumber(L, 2, 0);
+  lua_Number bytes = luaL_optnumber(L, 3, 0);
+  luaL_argcheck(L, ms >= 0, 2, "quota must not be negative");
+  luaL_argcheck(L, bytes >= 0, 3, "quota must not be negative");
+  account->time_quota_ns = ms >= 1.8e13 ? UINT64_MAX : (uint64_t) (ms * 1e6);
+  account->allocation_quota = bytes >= (lua_Number) SIZE_MAX ? SIZE_MAX : (size_t) bytes;
+  // A quota too small to count is still a quota.
+  if (ms > 0 && account->time_quota_ns == 0) account->time_quota_ns = 1;
+  if (bytes > 0 && account->allocation_quota == 0) account->allocation_quota = 1;
+  if (account == running_account) cr_account_switch(account); // Re-arm the allocator for it.
+  return 0;
+}
+
+
+/*
+  resumer.pool_size([size])
+    Return the maximum number of finished Resumer threads kept for reuse, and set it if
+    `size` is given. Zero disables reuse.
+*/
+static int cr_pool_size(lua_State *L) {
+  struct cr_thread_pool *pool = (struct cr_thread_pool *) lua_touserdata(L, lua_upvalueindex(1));
+  int size = pool->size;
+  if (!lua_isnoneornil(L, 1)) {
+    int new_size = luaL_checkint(L, 1);
+    luaL_argcheck(L, new_size >= 0, 1, "pool size must not be negative");
+    pool->size = new_size;
+    if (lua_gettop(pool->threads) > new_size) lua_settop(pool->threads, new_size);
+  }
+  lua_pushinteger(L, size);
+  return 1;
+}
+
+
+/*
+  Scheduler
+
+  A task is a green thread run by a Scheduler. The scheduler keeps the tasks that are ready to
+  run in an intrusive FIFO queue, and Scheduler:run() resumes them one after another without
+  returning to Lua in between. A task may call Resumers: the scheduler follows their hops
+  exactly like Resumer:outer_loop() does, so a task's Lua thread changes as it hops around,
+  and the task finishes when a hop returns to the main thread (or its thread exits).
+
+  Scheduler primitives suspend the calling task by yielding `scheduler_yield`, after having
+  put the task back in the ready queue or on a wait list.
+
+  Tasks waiting for I/O (see cr_Scheduler_wait_io()) are kept on a separate list. When no task
+  is ready, Scheduler:run() blocks in ppoll() until one of them can continue. While tasks are
+  ready, it also checks for I/O without blocking every POLL_INTERVAL switches, so busy tasks
+  can't starve the waiting ones.
+
+  Tasks that sleep, or wait with a timeout, also have a timer in the scheduler's heap. The same
+  checks expire timers, and when no task is ready ppoll() only blocks until the earliest one,
+  so a scheduler whose tasks are all asleep costs no CPU time.
+
+  Memory management: the scheduler's environment table maps lightuserdata(task) to the Task
+  userdata for every unfinished task, which keeps them alive while they are only referenced
+  from the queue and the wait lists. Each Task's environment table keeps its current thread
+  alive in slot 1. Channels don't keep the tasks blocked on them alive; instead, a Scheduler
+  that is collected takes its tasks off the Channels' wait queues.
+*/
+#define SCHEDULER_METATABLE "resumer.Scheduler"
+#define TASK_METATABLE "resumer.Task"
+
+#define POLL_INTERVAL 64
+
+static char scheduler_yield;
+
+// The innermost scheduler in Scheduler:run().
+static struct cr_scheduler *running_scheduler = NULL;
+
+
+struct cr_scheduler;
+
+struct cr_task {
+  lua_State *thread;           // Where the task continues. Holds its results once it is done.
+  struct cr_task *next;        // Link in the ready queue or a wait list.
+  struct cr_task *waiters;     // Tasks blocked in Scheduler:join() on this one, newest first.
+  struct cr_scheduler *owner;
+  struct cr_task *joining;     // The task this one waits for in Scheduler:join(), or NULL.
+  struct cr_io_wait *io_wait;  // What this task waits for in cr_Scheduler_wait_io(), or NULL.
+  struct cr_timer timer;       // In the scheduler's heap while sleeping or waiting with a timeout.
+  struct cr_task_channel *channel; // The Channel this task waits for, or NULL.
+  int channel_index;           // Stack index of its next value to send, or slot to receive into.
+  int channel_count;           // How many values it has left to send, or slots to receive into.
+  bool channel_sending;
+  int nargs;                   // Number of values on `thread` to resume it with.
+  bool done;
+  bool with_deadline;          // Waiting for `joining` in Scheduler:with_deadline().
+};
+
+struct cr_scheduler {
+  struct cr_task *head;        // Ready queue.
+  struct cr_task *tail;
+  struct cr_task *current;     // The task being run, or NULL.
+  struct cr_io_wait *io_waits; // Tasks waiting for I/O.
+  int io_count;
+  struct pollfd *pollfds;      // Scratch space for ppoll(), with room for `pollfds_size` entries.
+  int pollfds_size;
+  struct cr_timer_heap timers;
+  int live;                    // Spawned tasks that haven't finished.
+  bool running;
+};
+
+struct cr_task_channel {
+  int capacity;
+  int head;                    // Ring slot of the oldest buffered value, counting from 0.
+  int count;                   // Buffered values.
+  struct cr_task *senders;     // Tasks waiting for room, oldest first. Only while it's full.
+  struct cr_task *senders_tail;
+  struct cr_task *receivers;   // Tasks waiting for values, oldest first. Only while it's empty.
+  struct cr_task *receivers_tail;
+  bool closed;
+};
+
+
+static void cr_Scheduler_enqueue(struct cr_scheduler *scheduler, struct cr_task *task) {
+  task->next = NULL;
+  if (scheduler->tail != NULL) {
+    scheduler->tail->next = task;
+  } else {
+    scheduler->head = task;
+  }
+  scheduler->tail = task;
+}
+
+
+static inline struct cr_task *cr_Task_of_timer(struct cr_timer *timer) {
+  return (struct cr_task *) ((char *) timer - offsetof(struct cr_task, timer));
+}
+
+
+static struct cr_task *cr_Scheduler_current(lua_State *L, struct cr_scheduler *scheduler,
+                                            const char *method) {
+  struct cr_task *task = scheduler->current;
+  if (task == NULL || task->thread != L) {
+    luaL_error(L, "Scheduler:%s() must be called from one of the scheduler's tasks", method);
+  }
+  return task;
+}
+
+
+/*
+  Move the `n` values on top of L's stack to the suspended `thread`, for it to be resumed with.
+  Values for a suspended thread are always built on L: an error raised on the suspended thread
+  itself, like running out of memory while pushing, has no protected call there to unwind to.
+*/
+static void cr_Task_give(lua_State *L, lua_State *thread, int n) {
+  if (!lua_checkstack(thread, n)) luaL_error(L, "Scheduler could not extend a task's stack");
+  lua_xmove(L, thread, n);
+}
+
+
+static int cr_Task_push_results(lua_State *L, struct cr_task *task) {
+  // Copy (not move) the results, since any number of tasks may join a finished one. The copy
+  // is made on L, and moved back into the room the results left on the task's thread.
+  int nresults = lua_gettop(task->thread);
+  luaL_checkstack(L, 2 * nresults, "Scheduler:join() could not extend stack");
+  lua_xmove(task->thread, L, nresults);
+  int first = lua_gettop(L) - nresults + 1;
+  for (int i = 0; i < nresults; ++i) lua_pushvalue(L, first + i);
+  lua_xmove(L, task->thread, nresults);
+  return nresults;
+}
+
+
+/*
+  Switch `task` over to the thread on top of L's stack after a Resumer hop, keeping the thread
+  alive in the task's environment table. Pops the thread. The scheduler's environment table is
+  at index 2 of L's stack.
+*/
+static void cr_Task_set_thread(lua_State *L, struct cr_task *task) {
+  task->thread = lua_tothread(L, -1);       // stack: [..., thread]
+  lua_pushlightuserdata(L, task);
+  lua_rawget(L, 2);                         // stack: [..., thread, task]
+  lua_getfenv(L, -1);                       // stack: [..., thread, task, task env]
+  lua_pushvalue(L, -3);
+  lua_rawseti(L, -2, 1);
+  lua_pop(L, 3);
+}
+
+
+static void cr_Task_finish(lua_State *L, struct cr_scheduler *scheduler, struct cr_task *task) {
+  // The task's results are everything on its thread's stack. Hand them to all joiners, in the
+  // order they started waiting.
+  task->done = true;
+  --scheduler->live;
+  struct cr_task *waiters = NULL;
+  while (task->waiters != NULL) {
+    struct cr_task *waiter = task->waiters;
+    task->waiters = waiter->next;
+    waiter->next = waiters;
+    waiters = waiter;
+  }
+  while (waiters != NULL) {
+    struct cr_task *waiter = waiters;
+    waiters = waiter->next;
+    waiter->joining = NULL;
+    cr_timer_heap_remove(&scheduler->timers, &waiter->timer);
+    waiter->nargs = 0;
+    if (waiter->with_deadline) {
+      waiter->with_deadline = false;
+      lua_pushboolean(L, 1);
+      waiter->nargs = 1;
+    }
+    waiter->nargs += cr_Task_push_results(L, task);
+    cr_Task_give(L, waiter->thread, waiter->nargs);
+    cr_Scheduler_enqueue(scheduler, waiter);
+  }
+  lua_pushlightuserdata(L, task);
+  lua_pushnil(L);
+  lua_rawset(L, 2);                         // Only references from Lua keep it alive from now on.
+}
+
+
+// Take `task` off the waiters of the task it is joining.
+static void cr_Task_stop_joining(struct cr_task *task) {
+  struct cr_task **link = &task->joining->waiters;
+  while (*link != NULL && *link != task) link = &(*link)->next;
+  if (*link != NULL) *link = task->next;
+  task->next = NULL;
+  task->joining = NULL;
+}
+
+
+// Take `task` off the wait queue of the Channel it waits for.
+static void cr_TaskChannel_unlink(struct cr_task *task) {
+  struct cr_task_channel *channel = task->channel;
+  bool sending = task->channel_sending;
+  struct cr_task **link = sending ? &channel->senders : &channel->receivers;
+  struct cr_task *previous = NULL;
+  while (*link != NULL && *link != task) {
+    previous = *link;
+    link = &(*link)->next;
+  }
+  if (*link != NULL) {
+    *link = task->next;
+    if (sending && channel->senders_tail == task) channel->senders_tail = previous;
+    if (!sending && channel->receivers_tail == task) channel->receivers_tail = previous;
+  }
+  task->channel = NULL;
+}
+
+
+/*
+  Stop a suspended `task` wherever it waits and finish it, with the results nil, "task
+  cancelled". Its thread is never resumed again. A task waiting in Scheduler:with_deadline()
+  takes the task it waits for down with it.
+  stack: [scheduler, scheduler env]
+*/
+static void cr_Task_cancel(lua_State *L, struct cr_scheduler *scheduler, struct cr_task *task) {
+  struct cr_task *inner = task->with_deadline ? task->joining : NULL;
+  if (task->joining != NULL) {
+    cr_Task_stop_joining(task);
+  } else if (task->io_wait != NULL) {
+    struct cr_io_wait **link = &scheduler->io_waits;
+    while (*link != NULL && *link != task->io_wait) link = &(*link)->next;
+    if (*link != NULL) {
+      *link = task->io_wait->next;
+      --scheduler->io_count;
+    }
+    task->io_wait = NULL;
+  } else if (task->channel != NULL) {
+    cr_TaskChannel_unlink(task);
+  } else if (task->timer.index == 0) {
+    // Neither waiting nor asleep, so in the ready queue.
+    struct cr_task *previous = NULL;
+    for (struct cr_task *queued = scheduler->head; queued != NULL; queued = queued->next) {
+      if (queued == task) {
+        if (previous != NULL) {
+          previous->next = task->next;
+        } else {
+          scheduler->head = task->next;
+        }
+        if (scheduler->tail == task) scheduler->tail = previous;
+        break;
+      }
+      previous = queued;
+    }
+  }
+  cr_timer_heap_remove(&scheduler->timers, &task->timer);
+  task->with_deadline = false;
+  task->next = NULL;
+  lua_settop(task->thread, 0);
+  lua_pushnil(L);
+  lua_pushliteral(L, "task cancelled");
+  cr_Task_give(L, task->thread, 2);
+  cr_Task_finish(L, scheduler, task);
+  if (inner != NULL) cr_Task_cancel(L, scheduler, inner);
+}
+
+
+/*
+  Make the tasks whose timers have expired ready. A sleeping task just carries on. A task that
+  timed out in Scheduler:join() gets nil, "timeout"; in Scheduler:with_deadline(), the task it
+  waited for is cancelled and it gets false, "deadline exceeded".
+  stack: [scheduler, scheduler env]
+*/
+static void cr_Scheduler_expire(lua_State *L, struct cr_scheduler *scheduler) {
+  uint64_t now = cr_timer_now();
+  struct cr_timer *timer;
+  while ((timer = cr_timer_heap_first(&scheduler->timers)) != NULL && timer->deadline <= now) {
+    cr_timer_heap_remove(&scheduler->timers, timer);
+    struct cr_task *task = cr_Task_of_timer(timer);
+    task->nargs = 0;
+    if (task->joining != NULL) {
+      struct cr_task *target = task->joining;
+      cr_Task_stop_joining(task);
+      if (task->with_deadline) {
+        task->with_deadline = false;
+        cr_Task_cancel(L, scheduler, target);
+        lua_pushboolean(L, 0);
+        lua_pushliteral(L, "deadline exceeded");
+      } else {
+        lua_pushnil(L);
+        lua_pushliteral(L, "timeout");
+      }
+      cr_Task_give(L, task->thread, 2);
+      task->nargs = 2;
+    }
+    cr_Scheduler_enqueue(scheduler, task);
+  }
+}
+
+
+/*
+  Run `task` until it blocks in a scheduler primitive or finishes. Returns nonzero with an
+  error message pushed onto L's stack if the task raised an error.
+  stack: [scheduler, scheduler env]
+*/
+static int cr_Scheduler_step(lua_State *L, struct cr_scheduler *scheduler, struct cr_task *task) {
+  lua_State *thread = task->thread;
+  int nargs = task->nargs;
+  int status;
+
+  while (1) {
+    cr_gc_boundary(L);
+    ++cr_resumer_stats.switches;
+    cr_account_switch_to(thread);
+    status = lua_resume(thread, nargs);
+    nargs = lua_gettop(thread);
+
+    if (status == LUA_YIELD) {
+      if (nargs == 0) {
+        lua_pushliteral(L, "Scheduler:run() got an unexpected yield without a thread to resume");
+        break;
+      }
+      if (lua_touserdata(thread, -1) == &scheduler_yield) {
+        // The primitive already queued or parked the task.
+        cr_account_switch_to(L);
+        lua_pop(thread, 1);
+        return 0;
+      }
+      lua_State *next_thread = lua_tothread(thread, -1);
+      nargs = nargs - 1;
+      if (next_thread == NULL) {
+        // A Resumer yielded to the main thread, which for a task means it's done.
+        cr_account_switch_to(L);
+        lua_pop(thread, 1);
+        cr_Task_finish(L, scheduler, task);
+        return 0;
+      }
+      if (thread == next_thread) {
+        lua_pop(thread, 1);
+      } else {
+        lua_xmove(thread, L, 1);
+        cr_Task_set_thread(L, task);
+        luaL_checkstack(next_thread, nargs, "Scheduler:run() could not extend next thread stack");
+        lua_xmove(thread, next_thread, nargs);
+        thread = next_thread;
+      }
+
+    } else if (status == 0) {
+      cr_account_switch_to(L);
+      cr_account_remove(thread, NULL);
+      cr_Task_finish(L, scheduler, task);
+      return 0;
+
+    } else {
+      cr_account_switch_to(L);
+      cr_account_remove(thread, NULL);
+      lua_pushfstring(L, "error in thread: %s", lua_tostring(thread, -1));
+      break;
+    }
+  }
+  cr_account_switch_to(L);
+
+  // The task can't continue. Forget about it, but leave whoever joined it waiting.
+  task->done = true;
+  --scheduler->live;
+  lua_pushlightuserdata(L, task);
+  lua_pushnil(L);
+  lua_rawset(L, 2);
   return 1;
 }
 
 
+/*
+  Check for I/O that waiting tasks can do and for expired timers, and make those tasks ready.
+  Blocks until there is some I/O or the earliest timer expires if `block` is true. Returns
+  nonzero with an error message pushed onto L's stack if
+  ppoll() fails.
+*/
+static int cr_Scheduler_poll(lua_State *L, struct cr_scheduler *scheduler, bool block) {
+  if (scheduler->io_count > scheduler->pollfds_size) {
+    int size = scheduler->io_count * 2;
+    struct pollfd *pollfds = realloc(scheduler->pollfds, size * sizeof(*pollfds));
+    if (pollfds == NULL) {
+      lua_pushliteral(L, "Scheduler:run() could not allocate memory for ppoll()");
+      return 1;
+    }
+    scheduler->pollfds = pollfds;
+    scheduler->pollfds_size = size;
+  }
+  int n = 0;
+  for (struct cr_io_wait *wait = scheduler->io_waits; wait != NULL; wait = wait->next, ++n) {
+    scheduler->pollfds[n].fd = wait->fd;
+    scheduler->pollfds[n].events = wait->events;
+    scheduler->pollfds[n].revents = 0;
+  }
+
+  struct timespec timeout = {0, 0};
+  struct timespec *wait_for = block ? NULL : &timeout;
+  struct cr_timer *first = cr_timer_heap_first(&scheduler->timers);
+  if (block && first != NULL) {
+    uint64_t now = cr_timer_now();
+    uint64_t left = first->deadline > now ? first->deadline - now : 0;
+    timeout.tv_sec = left / 1000000000u;
+    timeout.tv_nsec = left % 1000000000u;
+    wait_for = &timeout;
+  }
+  int ready = 0;
+  // Without descriptors, a zero timeout would only make a system call to find nothing.
+  if (n != 0 || wait_for == NULL || timeout.tv_sec != 0 || timeout.tv_nsec != 0) {
+    ready = ppoll(scheduler->pollfds, n, wait_for, NULL);
+  }
+  if (ready == -1 && errno != EINTR) {
+    lua_pushfstring(L, "Scheduler:run() failed to poll: %s", strerror(errno));
+    return 1;
+  }
+
+  // The list is in the same order as the pollfds. Errors and hangups are left for the
+  // callbacks to run into.
+  struct cr_io_wait **link = &scheduler->io_waits;
+  for (int i = 0; ready > 0 && i < n; ++i) {
+    struct cr_io_wait *wait = *link;
+    if (scheduler->pollfds[i].revents != 0) {
+      --ready;
+      int nresults = wait->ready(L, wait);
+      if (nresults >= 0) {
+        cr_Task_give(L, wait->task->thread, nresults);
+        *link = wait->next;
+        --scheduler->io_count;
+        wait->task->io_wait = NULL;
+        wait->task->nargs = nresults;
+        cr_Scheduler_enqueue(scheduler, wait->task);
+        continue;
+      }
+    }
+    link = &wait->next;
+  }
+  if (scheduler->timers.count != 0) cr_Scheduler_expire(L, scheduler);
+  return 0;
+}
+
+
+struct cr_scheduler *cr_Scheduler_running(lua_State *L) {
+  struct cr_scheduler *scheduler = running_scheduler;
+  if (scheduler == NULL || scheduler->current == NULL || scheduler->current->thread != L) {
+    return NULL;
+  }
+  return scheduler;
+}
+
+
+int cr_Scheduler_wait_io(lua_State *L, struct cr_scheduler *scheduler, struct cr_io_wait *wait) {
+  wait->task = scheduler->current;
+  wait->task->io_wait = wait;
+  wait->next = scheduler->io_waits;
+  scheduler->io_waits = wait;
+  ++scheduler->io_count;
+  // Yield everything, so it stays on the thread's stack (and alive) until the task resumes.
+  luaL_checkstack(L, 1, "Scheduler could not extend stack");
+  lua_pushlightuserdata(L, &scheduler_yield);
+  return lua_yield(L, lua_gettop(L));
+}
+
+
+// The deadline `ms` milliseconds (argument `index`) from now.
+static uint64_t cr_Scheduler_deadline(lua_State *L, int index) {
+  lua_Number ms = luaL_checknumber(L, index);
+  luaL_argcheck(L, ms >= 0, index, "time must not be negative");
+  uint64_t now = cr_timer_now();
+  if (ms >= (lua_Number) (UINT64_MAX - now) / 1e6) return UINT64_MAX;
+  return now + (uint64_t) (ms * 1e6);
+}
+
+
+static void cr_Scheduler_add_timer(lua_State *L, struct cr_scheduler *scheduler,
+                                   struct cr_task *task, uint64_t deadline, const char *method) {
+  if (cr_timer_heap_push(L, &scheduler->timers, &task->timer, deadline)) {
+    luaL_error(L, "Scheduler:%s() could not allocate memory for a timer", method);
+  }
+}
+
+
+/*
+  resumer.Scheduler()
+    Create a scheduler with no tasks.
+*/
+int cr_new_Scheduler(lua_State *L) {
+  struct cr_scheduler *scheduler = lua_newuserdata(L, sizeof(*scheduler));
+  memset(scheduler, '\0', sizeof(*scheduler));
+  luaL_getmetatable(L, SCHEDULER_METATABLE);
+  lua_setmetatable(L, -2);
+  lua_newtable(L);
+  lua_setfenv(L, -2);
+  return 1;
+}
+
+
+/*
+  Scheduler:spawn(f, args...)
+    Create a task that will call `f(args...)` and add it to the end of the ready queue.
+    Returns the Task.
+*/
+static int cr_Scheduler_spawn(lua_State *L) {
+  struct cr_scheduler *scheduler = luaL_checkudata(L, 1, SCHEDULER_METATABLE);
+  luaL_checktype(L, 2, LUA_TFUNCTION);
+  int nargs = lua_gettop(L) - 2;            // stack: [scheduler, f, args...]
+
+  struct cr_task *task = lua_newuserdata(L, sizeof(*task));
+  memset(task, '\0', sizeof(*task));
+  task->owner = scheduler;
+  luaL_getmetatable(L, TASK_METATABLE);
+  lua_setmetatable(L, -2);                  // stack: [scheduler, f, args..., task]
+  lua_State *thread = lua_newthread(L);     // stack: [scheduler, f, args..., task, thread]
+  ++cr_resumer_stats.threads_created;
+  lua_createtable(L, 1, 0);
+  lua_insert(L, -2);
+  lua_rawseti(L, -2, 1);                    // stack: [scheduler, f, args..., task, {thread}]
+  lua_setfenv(L, -2);                       // stack: [scheduler, f, args..., task]
+  lua_insert(L, 2);                         // stack: [scheduler, task, f, args...]
+
+  luaL_checkstack(thread, nargs + 1, "Scheduler:spawn() could not extend new thread stack");
+  lua_xmove(L, thread, nargs + 1);          // stack: [scheduler, task]
+  task->thread = thread;
+  task->nargs = nargs;
+
+  lua_getfenv(L, 1);
+  lua_pushlightuserdata(L, task);
+  lua_pushvalue(L, 2);
+  lua_rawset(L, -3);
+  lua_pop(L, 1);
+
+  ++scheduler->live;
+  cr_Scheduler_enqueue(scheduler, task);
+  return 1;
+}
+
+
+/*
+  Scheduler:yield()
+    Move the calling task to the end of the ready queue, and run the next one.
+*/
+static int cr_Scheduler_yield(lua_State *L) {
+  struct cr_scheduler *scheduler = luaL_checkudata(L, 1, SCHEDULER_METATABLE);
+  struct cr_task *task = cr_Scheduler_current(L, scheduler, "yield");
+  task->nargs = 0;
+  cr_Scheduler_enqueue(scheduler, task);
+  lua_pushlightuserdata(L, &scheduler_yield);
+  return lua_yield(L, 1);
+}
+
+
+/*
+  Scheduler:join(task, [ms])
+    Wait until `task` has finished, and return whatever it returned. Only a task can wait, but
+    anyone can join a task that has already finished. If `ms` is given and `task` is still
+    running after that many milliseconds, returns nil, "timeout" instead.
+*/
+static int cr_Scheduler_join(lua_State *L) {
+  struct cr_scheduler *scheduler = luaL_checkudata(L, 1, SCHEDULER_METATABLE);
+  struct cr_task *target = luaL_checkudata(L, 2, TASK_METATABLE);
+  if (target->owner != scheduler) {
+    return luaL_error(L, "Scheduler:join() got a task from another scheduler");
+  }
+  if (target->done) {
+    lua_settop(L, 0);
+    return cr_Task_push_results(L, target);
+  }
+  struct cr_task *task = cr_Scheduler_current(L, scheduler, "join");
+  if (task == target) {
+    return luaL_error(L, "Scheduler:join() called by a task on itself");
+  }
+  if (!lua_isnoneornil(L, 3)) {
+    cr_Scheduler_add_timer(L, scheduler, task, cr_Scheduler_deadline(L, 3), "join");
+  }
+  task->joining = target;
+  task->next = target->waiters;
+  target->waiters = task;
+  lua_pushlightuserdata(L, &scheduler_yield);
+  return lua_yield(L, 1);
+}
+
+
+/*
+  Scheduler:sleep(ms)
+    Suspend the calling task for `ms` milliseconds, while other tasks run. Anywhere else than
+    in one of the scheduler's tasks, block for that long.
+*/
+static int cr_Scheduler_sleep(lua_State *L) {
+  struct cr_scheduler *scheduler = luaL_checkudata(L, 1, SCHEDULER_METATABLE);
+  uint64_t deadline = cr_Scheduler_deadline(L, 2);
+  struct cr_task *task = scheduler->current;
+  if (task == NULL || task->thread != L) {
+    uint64_t now;
+    while ((now = cr_timer_now()) < deadline) {
+      uint64_t left = deadline - now;
+      struct timespec timeout = {left / 1000000000u, left % 1000000000u};
+      if (ppoll(NULL, 0, &timeout, NULL) == -1 && errno != EINTR) {
+        return luaL_error(L, "Scheduler:sleep() failed: %s", strerror(errno));
+      }
+    }
+    return 0;
+  }
+  cr_Scheduler_add_timer(L, scheduler, task, deadline, "sleep");
+  lua_pushlightuserdata(L, &scheduler_yield);
+  return lua_yield(L, 1);
+}
+
+
+/*
+  Scheduler:with_deadline(ms, f, args...)
+    Call `f(args...)` in a task of its own, and wait at most `ms` milliseconds for it to
+    finish. Returns true and whatever `f` returned. If the time runs out first, the task is
+    cancelled, so it never runs again wherever it was waiting, and this returns false,
+    "deadline exceeded". Anyone joining the cancelled task gets nil, "task cancelled".
+*/
+static int cr_Scheduler_with_deadline(lua_State *L) {
+  struct cr_scheduler *scheduler = luaL_checkudata(L, 1, SCHEDULER_METATABLE);
+  uint64_t deadline = cr_Scheduler_deadline(L, 2);
+  luaL_checktype(L, 3, LUA_TFUNCTION);
+  struct cr_task *task = cr_Scheduler_current(L, scheduler, "with_deadline");
+  lua_remove(L, 2);                         // stack: [scheduler, f, args...]
+  cr_Scheduler_spawn(L);                    // stack: [scheduler, target]
+  struct cr_task *target = lua_touserdata(L, 2);
+  cr_Scheduler_add_timer(L, scheduler, task, deadline, "with_deadline");
+  task->joining = target;
+  task->with_deadline = true;
+  task->next = NULL;
+  target->waiters = task;
+  lua_pushlightuserdata(L, &scheduler_yield);
+  return lua_yield(L, 1);
+}
+
+
+/*
+  Scheduler:current()
+    Return the task that is running, or nil.
+*/
+static int cr_Scheduler_current_task(lua_State *L) {
+  struct cr_scheduler *scheduler = luaL_checkudata(L, 1, SCHEDULER_METATABLE);
+  if (scheduler->current == NULL) {
+    lua_pushnil(L);
+    return 1;
+  }
+  lua_getfenv(L, 1);
+  lua_pushlightuserdata(L, scheduler->current);
+  lua_rawget(L, -2);
+  return 1;
+}
+
+
+// The loop of Scheduler:run(), called protected with the scheduler at index 1.
+static int cr_Scheduler_run_loop(lua_State *L) {
+  struct cr_scheduler *scheduler = lua_touserdata(L, 1);
+  lua_getfenv(L, 1);                        // stack: [scheduler, scheduler env]
+  unsigned int switches = 0;
+  int error = 0;
+  while (!error && (scheduler->head != NULL || scheduler->io_waits != NULL ||
+                    scheduler->timers.count != 0)) {
+    struct cr_task *task = scheduler->head;
+    bool waiting = scheduler->io_waits != NULL || scheduler->timers.count != 0;
+    if (task == NULL || (waiting && ++switches % POLL_INTERVAL == 0)) {
+      // With nothing to run, collect garbage in between checking for I/O and timers.
+      struct cr_timer *first = cr_timer_heap_first(&scheduler->timers);
+      bool idle = task == NULL && cr_gc_idle(L, first != NULL ? first->deadline : UINT64_MAX);
+      error = cr_Scheduler_poll(L, scheduler, task == NULL && !idle);
+      continue;
+    }
+    scheduler->head = task->next;
+    if (scheduler->head == NULL) scheduler->tail = NULL;
+    task->next = NULL;
+    scheduler->current = task;
+    error = cr_Scheduler_step(L, scheduler, task);
+    scheduler->current = NULL;
+  }
+  if (error) return lua_error(L);
+  return 0;
+}
+
+
+/*
+  Scheduler:run()
+    Run tasks until none are ready or asleep. Returns the number of tasks that are left blocked.
+    An error in a task is re-raised here.
+
+  Errors can also come from the loop itself, such as running out of memory or stack space while
+  moving a task's values around, so it runs protected: either way, the scheduler is left ready
+  to run again, without the task that was running.
+*/
+static int cr_Scheduler_run(lua_State *L) {
+  struct cr_scheduler *scheduler = luaL_checkudata(L, 1, SCHEDULER_METATABLE);
+  if (scheduler->running) {
+    return luaL_error(L, "Scheduler:run() is already running");
+  }
+  lua_settop(L, 1);
+
+  struct cr_scheduler *outer_scheduler = running_scheduler;
+  running_scheduler = scheduler;
+  scheduler->running = true;
+  lua_pushcfunction(L, &cr_Scheduler_run_loop);
+  lua_pushvalue(L, 1);
+  int error = lua_pcall(L, 1, 0, 0);        // stack: [scheduler, (error)]
+  struct cr_task *task = scheduler->current;
+  scheduler->current = NULL;
+  scheduler->running = false;
+  running_scheduler = outer_scheduler;
+  if (error) {
+    cr_account_switch_to(L);
+    if (task != NULL && !task->done) {
+      task->done = true;
+      --scheduler->live;
+      lua_getfenv(L, 1);
+      lua_pushlightuserdata(L, task);
+      lua_pushnil(L);
+      lua_rawset(L, -3);
+      lua_pop(L, 1);
+    }
+    return lua_error(L);
+  }
+
+  lua_pushinteger(L, scheduler->live);
+  return 1;
+}
+
+
+/*
+  A Channel can outlive the Scheduler of a task blocked on it, so take such tasks off its
+  wait queues before their memory goes. Everything the env refers to is still intact here:
+  finalized userdata keep what they reach alive until the next cycle, and the blocked
+  thread's stack holds the Channel.
+*/
+static int cr_Scheduler_gc(lua_State *L) {
+  struct cr_scheduler *scheduler = luaL_checkudata(L, 1, SCHEDULER_METATABLE);
+  lua_getfenv(L, 1);
+  if (lua_istable(L, -1)) {
+    lua_pushnil(L);
+    while (lua_next(L, -2)) {
+      struct cr_task *task = lua_touserdata(L, -1);
+      if (task != NULL && task->channel != NULL) cr_TaskChannel_unlink(task);
+      lua_pop(L, 1);
+    }
+  }
+  lua_pop(L, 1);
+  free(scheduler->pollfds);
+  scheduler->pollfds = NULL;
+  cr_timer_heap_free(L, &scheduler->timers);
+  return 0;
+}
+
+
+static void cropen_scheduler(lua_State *L) {
+  luaL_Reg methods[8];
+  memset(&methods, '\0', sizeof(methods));
+  methods[0].name = "spawn";
+  methods[0].func = &cr_Scheduler_spawn;
+  methods[1].name = "yield";
+  methods[1].func = &cr_Scheduler_yield;
+  methods[2].name = "join";
+  methods[2].func = &cr_Scheduler_join;
+  methods[3].name = "current";
+  methods[3].func = &cr_Scheduler_current_task;
+  methods[4].name = "run";
+  methods[4].func = &cr_Scheduler_run;
+  methods[5].name = "sleep";
+  methods[5].func = &cr_Scheduler_sleep;
+  methods[6].name = "with_deadline";
+  methods[6].func = &cr_Scheduler_with_deadline;
+  luaL_newmetatable(L, SCHEDULER_METATABLE);
+  lua_newtable(L);
+  luaL_register(L, NULL, methods);
+  lua_setfield(L, -2, "__index");
+  lua_pushcfunction(L, &cr_Scheduler_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_pop(L, 1);
+  luaL_newmetatable(L, TASK_METATABLE);
+  lua_pop(L, 1);
+}
+
+
+/*
+  Channel
+
+  A bounded FIFO queue of values between tasks. Buffered values live in a ring of `capacity`
+  slots in the Channel's environment table, whose array part is allocated once, so passing
+  values doesn't allocate.
+
+  Tasks that can't go on wait in the channel's intrusive queues, linked through their `next`
+  fields like joiners: senders only while the ring is full, receivers only while it's empty.
+  A waiting sender's values stay on its stack until they are taken. A waiting receiver leaves
+  nil slots on its stack, which a sender fills in directly, so the values are there to be
+  returned when the scheduler resumes it. Either way a value moves between tasks once.
+*/
+#define CHANNEL_METATABLE "resumer.Channel"
+
+
+static inline int cr_TaskChannel_slot(struct cr_task_channel *channel, int i) {
+  return (channel->head + i) % channel->capacity + 1;
+}
+
+
+static void cr_TaskChannel_append(struct cr_task **head, struct cr_task **tail,
+                                  struct cr_task *task) {
+  task->next = NULL;
+  if (*tail != NULL) {
+    (*tail)->next = task;
+  } else {
+    *head = task;
+  }
+  *tail = task;
+}
+
+
+static struct cr_task *cr_TaskChannel_shift(struct cr_task **head, struct cr_task **tail) {
+  struct cr_task *task = *head;
+  *head = task->next;
+  if (*head == NULL) *tail = NULL;
+  task->next = NULL;
+  task->channel = NULL;
+  return task;
+}
+
+
+/*
+  Push the next value of the first waiting sender onto L's stack. The sender is made ready
+  once it has none left.
+*/
+static void cr_TaskChannel_take_sent(lua_State *L, struct cr_task_channel *channel) {
+  struct cr_task *sender = channel->senders;
+  // The copy goes into the slot its scheduler_yield marker left free, so it can't allocate.
+  lua_pushvalue(sender->thread, sender->channel_index++);
+  lua_xmove(sender->thread, L, 1);
+  if (--sender->channel_count == 0) {
+    cr_TaskChannel_shift(&channel->senders, &channel->senders_tail);
+    lua_settop(sender->thread, 0);
+    sender->nargs = 0;
+    cr_Scheduler_enqueue(sender->owner, sender);
+  }
+}
+
+
+// Move values from waiting senders into the ring while there is room.
+static void cr_TaskChannel_refill(lua_State *L, int ring, struct cr_task_channel *channel) {
+  while (channel->senders != NULL && channel->count < channel->capacity) {
+    cr_TaskChannel_take_sent(L, channel);
+    lua_rawseti(L, ring, cr_TaskChannel_slot(channel, channel->count));
+    ++channel->count;
+  }
+}
+
+
+static struct cr_task *cr_TaskChannel_current(lua_State *L, const char *method) {
+  struct cr_scheduler *scheduler = cr_Scheduler_running(L);
+  if (scheduler == NULL) {
+    luaL_error(L, "Channel:%s() would block outside a scheduler task", method);
+  }
+  return scheduler->current;
+}
+
+
+/*
+  resumer.Channel([capacity])
+    Create a channel that buffers up to `capacity` values (default 0: every send waits for a
+    receiver).
+*/
+static int cr_new_TaskChannel(lua_State *L) {
+  int capacity = luaL_optint(L, 1, 0);
+  luaL_argcheck(L, capacity >= 0, 1, "capacity must not be negative");
+  struct cr_task_channel *channel = lua_newuserdata(L, sizeof(*channel));
+  memset(channel, '\0', sizeof(*channel));
+  channel->capacity = capacity;
+  luaL_getmetatable(L, CHANNEL_METATABLE);
+  lua_setmetatable(L, -2);
+  lua_createtable(L, capacity, 0);
+  lua_setfenv(L, -2);
+  return 1;
+}
+
+
+static int cr_TaskChannel_send_values(lua_State *L, const char *method) {
+  struct cr_task_channel *channel = luaL_checkudata(L, 1, CHANNEL_METATABLE);
+  int last = lua_gettop(L);
+  for (int i = 2; i <= last; ++i) {
+    if (lua_isnil(L, i)) luaL_argerror(L, i, "can't send nil");
+  }
+  if (channel->closed) return luaL_error(L, "Channel:%s() on a closed channel", method);
+  luaL_checkstack(L, 2, "Channel could not extend stack");
+
+  // Fill in the slots of waiting receivers, of which there are only any while the ring is empty.
+  int i = 2;
+  while (i <= last && channel->receivers != NULL) {
+    struct cr_task *receiver = cr_TaskChannel_shift(&channel->receivers, &channel->receivers_tail);
+    int n = last - i + 1 < receiver->channel_count ? last - i + 1 : receiver->channel_count;
+    luaL_checkstack(L, n, "Channel could not extend stack");
+    for (int j = 0; j < n; ++j) lua_pushvalue(L, i++);
+    lua_settop(receiver->thread, receiver->channel_index - 1); // Its empty slots make room.
+    cr_Task_give(L, receiver->thread, n);
+    receiver->nargs = n;
+    cr_Scheduler_enqueue(receiver->owner, receiver);
+  }
+  if (i > last) return 0;
+
+  lua_getfenv(L, 1);
+  int ring = lua_gettop(L);
+  while (i <= last && channel->count < channel->capacity) {
+    lua_pushvalue(L, i++);
+    lua_rawseti(L, ring, cr_TaskChannel_slot(channel, channel->count));
+    ++channel->count;
+  }
+  if (i > last) return 0;
+
+  // Wait with the rest on the stack, which is yielded whole to keep it until they are taken.
+  struct cr_task *task = cr_TaskChannel_current(L, method);
+  task->channel = channel;
+  task->channel_index = i;
+  task->channel_count = last - i + 1;
+  task->channel_sending = true;
+  cr_TaskChannel_append(&channel->senders, &channel->senders_tail, task);
+  lua_pushlightuserdata(L, &scheduler_yield);
+  return lua_yield(L, lua_gettop(L));
+}
+
+
+static int cr_TaskChannel_receive_values(lua_State *L, int wanted, const char *method) {
+  struct cr_task_channel *channel = luaL_checkudata(L, 1, CHANNEL_METATABLE);
+  lua_settop(L, 1);
+  luaL_checkstack(L, wanted + 3, "Channel could not extend stack");
+  lua_getfenv(L, 1);                        // stack: [channel, ring]
+  int n = 0;
+  while (n < wanted) {
+    if (channel->count != 0) {
+      lua_rawgeti(L, 2, channel->head + 1);
+      lua_pushnil(L);
+      lua_rawseti(L, 2, channel->head + 1);
+      channel->head = (channel->head + 1) % channel->capacity;
+      --channel->count;
+    } else if (channel->senders != NULL) {
+      // Only without a ring: otherwise refilling it keeps the senders' values in there.
+      cr_TaskChannel_take_sent(L, channel);
+    } else {
+      break;
+    }
+    ++n;
+    cr_TaskChannel_refill(L, 2, channel);
+  }
+  if (n != 0) return n;
+  if (channel->closed) {
+    lua_pushnil(L);
+    return 1;
+  }
+
+  // Wait with `wanted` slots for a sender to fill in, and yield them to keep the stack that big.
+  struct cr_task *task = cr_TaskChannel_current(L, method);
+  for (int j = 0; j < wanted; ++j) lua_pushnil(L);
+  task->channel = channel;
+  task->channel_index = 3;
+  task->channel_count = wanted;
+  task->channel_sending = false;
+  cr_TaskChannel_append(&channel->receivers, &channel->receivers_tail, task);
+  lua_pushlightuserdata(L, &scheduler_yield);
+  return lua_yield(L, lua_gettop(L));
+}
+
+
+/*
+  Channel:send(value)
+    Add `value` to the channel, waiting for room if it is full.
+*/
+static int cr_TaskChannel_send(lua_State *L) {
+  luaL_checkany(L, 2);
+  lua_settop(L, 2);
+  return cr_TaskChannel_send_values(L, "send");
+}
+
+
+/*
+  Channel:send_many(values...)
+    Add all the values to the channel, in order, waiting for room as often as it takes.
+*/
+static int cr_TaskChannel_send_many(lua_State *L) {
+  return cr_TaskChannel_send_values(L, "send_many");
+}
+
+
+/*
+  Channel:recv()
+    Take the oldest value from the channel, waiting for one if it is empty. Returns nil once
+    the channel is closed and empty.
+*/
+static int cr_TaskChannel_recv(lua_State *L) {
+  return cr_TaskChannel_receive_values(L, 1, "recv");
+}
+
+
+/*
+  Channel:recv_many(n)
+    Take up to `n` values from the channel, in order, waiting only if there are none. Returns
+    nil once the channel is closed and empty.
+*/
+static int cr_TaskChannel_recv_many(lua_State *L) {
+  int wanted = luaL_checkint(L, 2);
+  luaL_argcheck(L, wanted >= 1, 2, "must receive at least one value");
+  return cr_TaskChannel_receive_values(L, wanted, "recv_many");
+}
+
+
+/*
+  Channel:close()
+    Refuse further sends. Values already sent can still be received, after which receivers
+    get nil.
+*/
+static int cr_TaskChannel_close(lua_State *L) {
+  struct cr_task_channel *channel = luaL_checkudata(L, 1, CHANNEL_METATABLE);
+  channel->closed = true;
+  while (channel->receivers != NULL) {
+    struct cr_task *receiver = cr_TaskChannel_shift(&channel->receivers, &channel->receivers_tail);
+    lua_settop(receiver->thread, receiver->channel_index);
+    receiver->nargs = 1;
+    cr_Scheduler_enqueue(receiver->owner, receiver);
+  }
+  return 0;
+}
+
+
+static int cr_TaskChannel_len(lua_State *L) {
+  struct cr_task_channel *channel = luaL_checkudata(L, 1, CHANNEL_METATABLE);
+  lua_pushinteger(L, channel->count);
+  return 1;
+}
+
+
+static void cropen_channel_type(lua_State *L) {
+  luaL_Reg methods[6];
+  memset(&methods, '\0', sizeof(methods));
+  methods[0].name = "send";
+  methods[0].func = &cr_TaskChannel_send;
+  methods[1].name = "send_many";
+  methods[1].func = &cr_TaskChannel_send_many;
+  methods[2].name = "recv";
+  methods[2].func = &cr_TaskChannel_recv;
+  methods[3].name = "recv_many";
+  methods[3].func = &cr_TaskChannel_recv_many;
+  methods[4].name = "close";
+  methods[4].func = &cr_TaskChannel_close;
+  luaL_newmetatable(L, CHANNEL_METATABLE);
+  lua_newtable(L);
+  luaL_register(L, NULL, methods);
+  lua_setfield(L, -2, "__index");
+  lua_pushcfunction(L, &cr_TaskChannel_len);
+  lua_setfield(L, -2, "__len");
+  lua_pop(L, 1);
+}
+
+
 void cropen_resumer(lua_State *L) {
-  luaL_Reg library[2];
+  luaL_Reg library[6];
   memset(&library, '\0', sizeof(library));
-  library[0].name = "Resumer";
-  library[0].func = &cr_new_Resumer;
-  luaL_register(L, "resumer", library);
+  library[0].name = "Scheduler";
+  library[0].func = &cr_new_Scheduler;
+  library[1].name = "Channel";
+  library[1].func = &cr_new_TaskChannel;
+  library[2].name = "usage";
+  library[2].func = &cr_Resumer_usage;
+  library[3].name = "set_quota";
+  library[3].func = &cr_Resumer_set_quota;
+  library[4].name = "gc_budget";
+  library[4].func = &cr_gc_budget;
+  cropen_scheduler(L);
+  cropen_channel_type(L);
+  luaL_register(L, "resumer", library);     // stack: [resumer]
+
+  struct cr_thread_pool *pool = lua_newuserdata(L, sizeof(*pool));
+  pool->size = DEFAULT_POOL_SIZE;
+  lua_createtable(L, 1, 0);
+  pool->threads = lua_newthread(L);
+  lua_rawseti(L, -2, 1);
+  lua_setfenv(L, -2);                       // stack: [resumer, pool]
+
+  luaL_newmetatable(L, ACCOUNT_METATABLE);
+  lua_pushcfunction(L, &cr_account_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_pop(L, 1);
+  lua_pushvalue(L, -1);                     // stack: [resumer, pool, pool]
+  lua_pushcclosure(L, &cr_new_Resumer, 1);
+  lua_setfield(L, -3, "Resumer");
+  lua_pushcclosure(L, &cr_pool_size, 1);    // stack: [resumer, pool_size]
+  lua_setfield(L, -2, "pool_size");
+  lua_pop(L, 1);
 }
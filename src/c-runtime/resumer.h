@@ -11,10 +11,113 @@
     created from the function passed to its constructor.
 
     Resumers require support from a mainloop.
+
+    Threads whose function has returned are reused by later Resumers, up to the number set
+    with resumer.pool_size(n), starting over with the globals as their environment. So don't
+    keep a finished Resumer's thread, as returned by coroutine.running(): resuming it would
+    resume whichever Resumer got the thread next.
+
+    Only works as the closure registered by cropen_resumer().
 */
 int cr_new_Resumer(lua_State *);
 
 
+/*
+  resumer.usage(Resumer) -> ms, bytes
+  resumer.set_quota(Resumer, [ms], [bytes])
+    The first call of either, which must come before the Resumer first runs, starts charging
+    its thread for the wall-clock time it runs and the bytes it allocates, which usage()
+    returns. With a quota (nil or zero for none), the thread gets an error once it goes over:
+    as soon as it allocates past `bytes`, and the next time it is resumed after running past
+    `ms`.
+
+  resumer.gc_budget([us]) -> us
+    Collect garbage incrementally in the time between switches, for up to `us` microseconds at
+    a time, rather than in whichever slice happens to allocate. Returns the previous budget;
+    zero, the default, turns this off.
+*/
+
+// For the interrupt hook: raise an error in L if the running Resumer thread is over quota.
+void cr_Resumer_enforce_quota(lua_State *);
+
+
+/*
+  new Scheduler()
+    A Scheduler runs tasks (green threads) from a FIFO ready queue natively, so switching from
+    one task to the next never returns to Lua.
+
+    Scheduler:spawn(f, args...) -> Task
+    Scheduler:yield()
+    Scheduler:join(Task, [ms]) -> results..., or nil, "timeout"
+    Scheduler:current() -> Task or nil
+    Scheduler:run() -> number of tasks left blocked
+    Scheduler:sleep(ms)
+    Scheduler:with_deadline(ms, f, args...) -> true, results..., or false, "deadline exceeded"
+
+    Sleeping tasks wait on a heap of monotonic-clock deadlines (see timer.h), and Scheduler:run()
+    waits for the earliest of them in ppoll() when no task is ready.
+*/
+int cr_new_Scheduler(lua_State *);
+
+
+/*
+  resumer.Channel([capacity])
+    A bounded FIFO queue of (non-nil) values between Scheduler tasks, buffering up to
+    `capacity` of them (default 0: every send waits for a receiver).
+
+    Channel:send(value)
+    Channel:send_many(values...)
+    Channel:recv() -> value, or nil once closed and empty
+    Channel:recv_many(n) -> up to n values, or nil once closed and empty
+    Channel:close()
+    #Channel -> number of buffered values
+
+    Senders wait while it is full and receivers while it is empty, which only tasks can do.
+    The batch variants wait once per batch rather than per value; send_many() called outside
+    a task may have sent part of its values when it raises that it would block.
+*/
+
+
+/*
+  For C functions that make a task wait for a file descriptor.
+
+  A C function called from a task (cr_Scheduler_running() tells) suspends the task with
+  `return cr_Scheduler_wait_io(L, scheduler, wait)`. When ppoll() reports any of `events` on
+  `fd`, the scheduler calls `ready` with its own running thread, never the suspended task's.
+  It returns -1 to keep waiting, or pushes the values the C function should return onto that
+  thread and returns how many, which the scheduler then moves to the task. The values on L's
+  stack, and `wait` itself if it lives there, are kept alive until then.
+*/
+struct cr_task;
+struct cr_scheduler;
+
+struct cr_io_wait {
+  int fd;
+  short events;
+  int (*ready)(lua_State *thread, struct cr_io_wait *);
+  struct cr_task *task;       // Set by the scheduler.
+  struct cr_io_wait *next;    // Set by the scheduler.
+};
+
+// The scheduler running the task on L, or NULL if L isn't a scheduler's current task.
+struct cr_scheduler *cr_Scheduler_running(lua_State *);
+int cr_Scheduler_wait_io(lua_State *, struct cr_scheduler *, struct cr_io_wait *);
+
+
+/*
+  Counters for run statistics: every lua_resume() into a Resumer's or task's thread, every
+  thread created for one rather than taken from the pool, and every garbage collector step
+  taken between switches under resumer.gc_budget().
+*/
+struct cr_resumer_stats {
+  unsigned long switches;
+  unsigned long threads_created;
+  unsigned long gc_steps;
+};
+
+extern struct cr_resumer_stats cr_resumer_stats;
+
+
 void cropen_resumer(lua_State *);
 
 
@@ -0,0 +1,27 @@
+#include "sandbox_api.h"
+#include "../sandbox.h"
+
+#include <string.h>
+
+
+static int cr_sandbox_remaining_cpu(lua_State *L) {
+  lua_pushnumber(L, sandbox_remaining_cpu());
+  return 1;
+}
+
+
+static int cr_sandbox_cpu_exceeded(lua_State *L) {
+  lua_pushboolean(L, sandbox_cpu_exceeded);
+  return 1;
+}
+
+
+void cropen_sandbox(lua_State *L) {
+  luaL_Reg library[3];
+  memset(&library, '\0', sizeof(library));
+  library[0].name = "remaining_cpu";
+  library[0].func = &cr_sandbox_remaining_cpu;
+  library[1].name = "cpu_exceeded";
+  library[1].func = &cr_sandbox_cpu_exceeded;
+  luaL_register(L, "sandbox", library);
+}
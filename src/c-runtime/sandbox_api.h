@@ -0,0 +1,20 @@
+#ifndef CR_SANDBOX_API_H
+#define CR_SANDBOX_API_H
+
+#include "lj_headers.h"
+
+
+/*
+  sandbox.remaining_cpu()
+    Return the CPU time in seconds left before the script's CPU budget runs out. Zero once it
+    has, and math.huge if there is no budget.
+
+  sandbox.cpu_exceeded()
+    Return true once the CPU budget has run out. After that, the script has a grace period
+    (as long as the budget given with --cpu-ms, or one second with --cpu) to clean up before
+    it is killed.
+*/
+void cropen_sandbox(lua_State *);
+
+
+#endif
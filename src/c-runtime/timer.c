@@ -0,0 +1,98 @@
+#define _GNU_SOURCE
+#include "timer.h"
+
+#include <stdbool.h>
+#include <time.h>
+
+
+#define INITIAL_CAPACITY 16
+
+
+uint64_t cr_timer_now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+
+static inline bool before(const struct cr_timer *a, const struct cr_timer *b) {
+  return a->deadline < b->deadline || (a->deadline == b->deadline && a->sequence < b->sequence);
+}
+
+
+static inline void place(struct cr_timer_heap *heap, size_t i, struct cr_timer *timer) {
+  heap->timers[i] = timer;
+  timer->index = i + 1;
+}
+
+
+// Move `timer` up from the hole at `i` to where it belongs.
+static void sift_up(struct cr_timer_heap *heap, size_t i, struct cr_timer *timer) {
+  while (i != 0) {
+    size_t parent = (i - 1) / 2;
+    if (!before(timer, heap->timers[parent])) break;
+    place(heap, i, heap->timers[parent]);
+    i = parent;
+  }
+  place(heap, i, timer);
+}
+
+
+// Move `timer` down from the hole at `i` to where it belongs.
+static void sift_down(struct cr_timer_heap *heap, size_t i, struct cr_timer *timer) {
+  while (1) {
+    size_t child = 2 * i + 1;
+    if (child >= heap->count) break;
+    if (child + 1 < heap->count && before(heap->timers[child + 1], heap->timers[child])) {
+      ++child;
+    }
+    if (!before(heap->timers[child], timer)) break;
+    place(heap, i, heap->timers[child]);
+    i = child;
+  }
+  place(heap, i, timer);
+}
+
+
+int cr_timer_heap_push(lua_State *L, struct cr_timer_heap *heap, struct cr_timer *timer,
+                       uint64_t deadline) {
+  if (heap->count == heap->capacity) {
+    size_t capacity = heap->capacity != 0 ? heap->capacity * 2 : INITIAL_CAPACITY;
+    void *ud;
+    lua_Alloc alloc = lua_getallocf(L, &ud);
+    struct cr_timer **timers = alloc(ud, heap->timers, heap->capacity * sizeof(*timers),
+                                     capacity * sizeof(*timers));
+    if (timers == NULL) return -1;
+    heap->timers = timers;
+    heap->capacity = capacity;
+  }
+  timer->deadline = deadline;
+  timer->sequence = heap->sequence++;
+  sift_up(heap, heap->count++, timer);
+  return 0;
+}
+
+
+void cr_timer_heap_remove(struct cr_timer_heap *heap, struct cr_timer *timer) {
+  if (timer->index == 0) return;
+  size_t i = timer->index - 1;
+  timer->index = 0;
+  struct cr_timer *last = heap->timers[--heap->count];
+  if (last == timer) return;
+  // Fill the hole with the last timer, which may belong above or below it.
+  if (i != 0 && before(last, heap->timers[(i - 1) / 2])) {
+    sift_up(heap, i, last);
+  } else {
+    sift_down(heap, i, last);
+  }
+}
+
+
+void cr_timer_heap_free(lua_State *L, struct cr_timer_heap *heap) {
+  void *ud;
+  lua_Alloc alloc = lua_getallocf(L, &ud);
+  if (heap->timers != NULL) alloc(ud, heap->timers, heap->capacity * sizeof(*heap->timers), 0);
+  heap->timers = NULL;
+  heap->count = 0;
+  heap->capacity = 0;
+}
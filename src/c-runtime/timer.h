@@ -0,0 +1,53 @@
+#ifndef CR_TIMER_H
+#define CR_TIMER_H
+
+#include "lj_headers.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/*
+  A binary min-heap of deadlines, for the Scheduler's sleeping and timed-out tasks.
+
+  Timers are intrusive: the heap only holds pointers to timers embedded in their owners, and
+  each timer knows its position, so removing one that hasn't expired takes O(log n). Timers
+  with the same deadline expire in the order they were added.
+
+  Deadlines are in nanoseconds of CLOCK_MONOTONIC, which the vDSO reads without a system call.
+*/
+struct cr_timer {
+  uint64_t deadline;
+  uint64_t sequence;  // Breaks ties between equal deadlines.
+  size_t index;       // Position in the heap plus one, or 0 while not in a heap.
+};
+
+struct cr_timer_heap {
+  struct cr_timer **timers;
+  size_t count;
+  size_t capacity;
+  uint64_t sequence;
+};
+
+
+uint64_t cr_timer_now(void);
+
+/*
+  Returns 0, or -1 if there was no memory to grow the heap, in which case nothing changed. The
+  heap grows through L's allocator, so it counts against the script's memory limit.
+*/
+int cr_timer_heap_push(lua_State *L, struct cr_timer_heap *, struct cr_timer *,
+                       uint64_t deadline);
+
+// Does nothing if the timer isn't in the heap.
+void cr_timer_heap_remove(struct cr_timer_heap *, struct cr_timer *);
+
+// The timer with the earliest deadline, or NULL if the heap is empty.
+static inline struct cr_timer *cr_timer_heap_first(const struct cr_timer_heap *heap) {
+  return heap->count != 0 ? heap->timers[0] : NULL;
+}
+
+void cr_timer_heap_free(lua_State *L, struct cr_timer_heap *);
+
+
+#endif
@@ -0,0 +1,310 @@
+/*
+  Shared-memory channels between a host process and a sandboxed script.
+  Copyright (C) 2017 Collin RM Stocks. All rights reserved.
+*/
+
+#ifndef CHANNEL_RING_H
+#define CHANNEL_RING_H
+
+#include <errno.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+
+/*
+  A channel is a shared memory region holding two single-producer, single-consumer rings of
+  messages, one in each direction, plus a doorbell: a connected socket, one end held by the
+  host and one by the sandbox. Sending and receiving only touch the shared memory. The
+  doorbell is only rung to wake up a side that waits because its ring was empty or full, so
+  a stream that keeps both sides busy makes no system calls at all.
+
+  This header is all a host needs, and is also what the sandbox itself uses. To set up a
+  channel, the host:
+    - creates a memfd, sizes it to channel_region_size(ring_size) with ftruncate(), maps it
+      with MAP_SHARED and calls channel_region_init() on it;
+    - creates a socketpair(AF_UNIX, SOCK_STREAM) for the doorbell;
+    - runs `luajit-sandbox --channel NAME=MEMFD:DOORBELL script.lua` with the memfd and one
+      end of the socket pair inherited as MEMFD and DOORBELL (see channel.open() in
+      c-runtime/channel.h for the script's side);
+    - calls channel_attach() with the mapping and the other end of the socket pair, made
+      non-blocking, then sends on CHANNEL_TO_SANDBOX and receives on CHANNEL_FROM_SANDBOX with
+      channel_send() and channel_recv() below, or with the non-blocking channel_try_send(),
+      channel_peek() and channel_consume() from its own event loop.
+
+  Either side can scribble over the shared memory, so neither trusts it: the ring size is
+  copied into the private `struct channel` once, every offset is taken modulo it, and message
+  lengths are clamped to it.
+
+  Each message is a 32-bit length in host byte order, followed by that many bytes, written
+  contiguously modulo the ring size. The rings' head and tail count bytes modulo 2^32.
+*/
+#define CHANNEL_MAGIC 0x4c435342 // "BSCL"
+#define CHANNEL_VERSION 1
+#define CHANNEL_MESSAGE_HEADER_SIZE 4
+
+enum channel_direction {
+  CHANNEL_TO_SANDBOX = 0,
+  CHANNEL_FROM_SANDBOX = 1,
+};
+
+struct channel_ring {
+  // Written by the producer.
+  _Atomic uint32_t head;             // Bytes written so far.
+  _Atomic uint32_t closed;           // Set once the producer will send nothing more.
+  _Atomic uint32_t producer_waiting; // Set by a producer about to wait for room.
+  char producer_padding[52];
+  // Written by the consumer.
+  _Atomic uint32_t tail;             // Bytes read so far.
+  _Atomic uint32_t consumer_waiting; // Set by a consumer about to wait for a message.
+  char consumer_padding[56];
+};
+
+struct channel_region {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t ring_size;  // Bytes of messages each ring holds. A power of two.
+  char padding[52];
+  struct channel_ring rings[2];  // Indexed by enum channel_direction.
+  // Followed by the data of rings[0], then that of rings[1], ring_size bytes each.
+};
+
+
+struct channel {
+  struct channel_region *region;
+  uint32_t ring_size;
+  int doorbell;
+};
+
+
+static inline size_t channel_region_size(uint32_t ring_size) {
+  return sizeof(struct channel_region) + 2 * (size_t) ring_size;
+}
+
+
+static inline void channel_region_init(struct channel_region *region, uint32_t ring_size) {
+  memset(region, '\0', sizeof(*region));
+  region->magic = CHANNEL_MAGIC;
+  region->version = CHANNEL_VERSION;
+  region->ring_size = ring_size;
+}
+
+
+// Set up `channel` for a mapped region of `size` bytes. Returns false if it isn't valid.
+static inline bool channel_attach(struct channel *channel, void *mapping, size_t size,
+                                  int doorbell) {
+  struct channel_region *region = mapping;
+  if (size < sizeof(*region)) return false;
+  uint32_t ring_size = region->ring_size;
+  if (region->magic != CHANNEL_MAGIC || region->version != CHANNEL_VERSION ||
+      ring_size <= CHANNEL_MESSAGE_HEADER_SIZE || (ring_size & (ring_size - 1)) != 0 ||
+      channel_region_size(ring_size) > size) {
+    return false;
+  }
+  channel->region = region;
+  channel->ring_size = ring_size;
+  channel->doorbell = doorbell;
+  return true;
+}
+
+
+// The longest message a ring can take.
+static inline uint32_t channel_max_message(const struct channel *channel) {
+  return channel->ring_size - CHANNEL_MESSAGE_HEADER_SIZE;
+}
+
+
+static inline unsigned char *channel_ring_data(const struct channel *channel,
+                                               enum channel_direction direction) {
+  return (unsigned char *) (channel->region + 1) + (size_t) direction * channel->ring_size;
+}
+
+
+/*
+  Append a message to a ring. Returns 1 once it is sent, 0 if there isn't room yet, or -1 if
+  it is longer than channel_max_message(). After 0, wait for the doorbell and try again.
+  After 1, ring the doorbell if `*wake` was set, since the consumer is waiting.
+*/
+static inline int channel_try_send(struct channel *channel, enum channel_direction direction,
+                                   const void *message, uint32_t length, bool *wake) {
+  struct channel_ring *ring = &channel->region->rings[direction];
+  uint32_t size = channel->ring_size;
+  *wake = false;
+  if (length > channel_max_message(channel)) return -1;
+  uint32_t needed = CHANNEL_MESSAGE_HEADER_SIZE + length;
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  if (size - (head - atomic_load_explicit(&ring->tail, memory_order_acquire)) < needed) {
+    // Ask to be woken, then check again, in case the consumer made room before it could see.
+    atomic_store_explicit(&ring->producer_waiting, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (size - (head - atomic_load_explicit(&ring->tail, memory_order_acquire)) < needed) return 0;
+  }
+
+  unsigned char *data = channel_ring_data(channel, direction);
+  const unsigned char *header = (const unsigned char *) &length;
+  for (uint32_t i = 0; i < CHANNEL_MESSAGE_HEADER_SIZE; ++i) data[(head + i) & (size - 1)] = header[i];
+  uint32_t start = (head + CHANNEL_MESSAGE_HEADER_SIZE) & (size - 1);
+  uint32_t first = length < size - start ? length : size - start;
+  memcpy(data + start, message, first);
+  memcpy(data, (const unsigned char *) message + first, length - first);
+
+  atomic_store_explicit(&ring->head, head + needed, memory_order_release);
+  atomic_thread_fence(memory_order_seq_cst);
+  *wake = atomic_load_explicit(&ring->consumer_waiting, memory_order_relaxed) &&
+          atomic_exchange_explicit(&ring->consumer_waiting, 0, memory_order_relaxed);
+  return 1;
+}
+
+
+/*
+  Find the next message of a ring, without consuming it. Returns 1 if there is one, setting
+  the pointers and lengths of its two parts (the second is empty unless it wraps around the
+  end of the ring). Returns 0 if there isn't: then wait for the doorbell and try again, unless
+  the ring is closed, which `*closed` tells.
+*/
+static inline int channel_peek(struct channel *channel, enum channel_direction direction,
+                               const unsigned char **first, uint32_t *first_length,
+                               const unsigned char **second, uint32_t *second_length,
+                               bool *closed) {
+  struct channel_ring *ring = &channel->region->rings[direction];
+  uint32_t size = channel->ring_size;
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  // Checked before the head, which the producer updated last before closing.
+  *closed = atomic_load_explicit(&ring->closed, memory_order_acquire);
+  if (atomic_load_explicit(&ring->head, memory_order_acquire) == tail) {
+    if (*closed) return 0;
+    // Ask to be woken, then check again, in case a message came before the producer could see.
+    atomic_store_explicit(&ring->consumer_waiting, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    *closed = atomic_load_explicit(&ring->closed, memory_order_acquire);
+    if (atomic_load_explicit(&ring->head, memory_order_acquire) == tail) return 0;
+  }
+
+  const unsigned char *data = channel_ring_data(channel, direction);
+  uint32_t length;
+  unsigned char *header = (unsigned char *) &length;
+  for (uint32_t i = 0; i < CHANNEL_MESSAGE_HEADER_SIZE; ++i) header[i] = data[(tail + i) & (size - 1)];
+  if (length > channel_max_message(channel)) length = channel_max_message(channel); // corrupt
+  uint32_t start = (tail + CHANNEL_MESSAGE_HEADER_SIZE) & (size - 1);
+  *first = data + start;
+  *first_length = length < size - start ? length : size - start;
+  *second = data;
+  *second_length = length - *first_length;
+  return 1;
+}
+
+
+/*
+  Consume the message found by channel_peek(), whose length is the sum of its parts. Returns
+  whether the producer is waiting for room, in which case ring the doorbell.
+*/
+static inline bool channel_consume(struct channel *channel, enum channel_direction direction,
+                                   uint32_t length) {
+  struct channel_ring *ring = &channel->region->rings[direction];
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  atomic_store_explicit(&ring->tail, tail + CHANNEL_MESSAGE_HEADER_SIZE + length,
+                        memory_order_release);
+  atomic_thread_fence(memory_order_seq_cst);
+  return atomic_load_explicit(&ring->producer_waiting, memory_order_relaxed) &&
+         atomic_exchange_explicit(&ring->producer_waiting, 0, memory_order_relaxed);
+}
+
+
+static inline void channel_ring_doorbell(const struct channel *channel) {
+  // If the socket is full, the other side has plenty of wakeups pending already.
+  char bell = 0;
+  while (write(channel->doorbell, &bell, 1) == -1 && errno == EINTR) {}
+}
+
+
+// Mark a ring as closed: its consumer gets everything sent so far, then end of stream.
+static inline void channel_close(struct channel *channel, enum channel_direction direction) {
+  atomic_store_explicit(&channel->region->rings[direction].closed, 1, memory_order_release);
+  atomic_thread_fence(memory_order_seq_cst);
+  channel_ring_doorbell(channel);
+}
+
+
+/*
+  Read all pending rings of the doorbell, before checking the rings again. Returns -1 once
+  the other side has closed its end (or on errors), 0 otherwise. Expects a non-blocking
+  doorbell.
+*/
+static inline int channel_drain_doorbell(const struct channel *channel) {
+  char bells[64];
+  while (1) {
+    ssize_t n = read(channel->doorbell, bells, sizeof(bells));
+    if (n == 0) return -1;
+    if (n == -1 && errno == EINTR) continue;
+    if (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+    if (n < (ssize_t) sizeof(bells)) return 0;
+  }
+}
+
+
+// For hosts: wait until the doorbell rings, then drain it.
+static inline int channel_wait_doorbell(const struct channel *channel) {
+  struct pollfd pollfd;
+  pollfd.fd = channel->doorbell;
+  pollfd.events = POLLIN;
+  if (poll(&pollfd, 1, -1) == -1 && errno != EINTR) return -1;
+  return channel_drain_doorbell(channel);
+}
+
+
+/*
+  For hosts: send a message, waiting for room if needed. Returns 0, or -1 with errno set to
+  EMSGSIZE if the message is too long, or EPIPE if the sandbox has exited.
+*/
+static inline int channel_send(struct channel *channel, const void *message, uint32_t length) {
+  bool wake;
+  int sent;
+  while ((sent = channel_try_send(channel, CHANNEL_TO_SANDBOX, message, length, &wake)) == 0) {
+    if (channel_wait_doorbell(channel)) {
+      errno = EPIPE;
+      return -1;
+    }
+  }
+  if (sent == -1) {
+    errno = EMSGSIZE;
+    return -1;
+  }
+  if (wake) channel_ring_doorbell(channel);
+  return 0;
+}
+
+
+/*
+  For hosts: receive a message into `buffer`, waiting for one if needed. Returns its length
+  (messages longer than `capacity` are truncated), or -1 at the end of the stream: when the
+  script has closed the channel or exited.
+*/
+static inline ssize_t channel_recv(struct channel *channel, void *buffer, size_t capacity) {
+  const unsigned char *first, *second;
+  uint32_t first_length, second_length;
+  bool closed;
+  while (!channel_peek(channel, CHANNEL_FROM_SANDBOX, &first, &first_length,
+                       &second, &second_length, &closed)) {
+    if (closed || channel_wait_doorbell(channel)) {
+      // The script may have sent its last messages right before exiting.
+      if (channel_peek(channel, CHANNEL_FROM_SANDBOX, &first, &first_length,
+                       &second, &second_length, &closed)) {
+        break;
+      }
+      return -1;
+    }
+  }
+  uint32_t length = first_length + second_length;
+  size_t n = first_length < capacity ? first_length : capacity;
+  memcpy(buffer, first, n);
+  memcpy((unsigned char *) buffer + n, second,
+         second_length < capacity - n ? second_length : capacity - n);
+  if (channel_consume(channel, CHANNEL_FROM_SANDBOX, length)) channel_ring_doorbell(channel);
+  return length < capacity ? length : capacity;
+}
+
+#endif
@@ -0,0 +1,67 @@
+/*
+  Deferred work for the Lua VM.
+  Copyright (C) 2017 Collin RM Stocks. All rights reserved.
+*/
+
+#include "interrupt.h"
+#include "allocator.h"
+#include "profile.h"
+#include "c-runtime/resumer.h"
+
+#include <luajit-2.0/lauxlib.h>
+#include <luajit-2.0/luajit.h>
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+
+static lua_State *attached_state = NULL;
+static atomic_int pending = 0;
+
+
+static void interrupt_hook(lua_State *L, lua_Debug *ar) {
+  (void) ar;
+  // Remove the hook before collecting the requests, so a request that arrives in between
+  // re-arms it instead of being lost.
+  lua_sethook(L, NULL, 0, 0);
+  int requests = atomic_exchange(&pending, 0);
+
+  // Before raising an error, which unwinds the stack being sampled.
+  if (requests & INTERRUPT_PROFILE) {
+    profile_sample(L);
+  }
+  bool out_of_memory = false;
+  if (requests & INTERRUPT_COLLECT) {
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    out_of_memory = allocator_collected();
+  }
+  if (requests & INTERRUPT_QUOTA) {
+    cr_Resumer_enforce_quota(L);
+  }
+  if (requests & INTERRUPT_CPU) {
+    // Leave the grace period to the interpreter, where hooks run: a compiled loop the clean-up
+    // re-enters would otherwise never see another request.
+    luaJIT_setmode(L, 0, LUAJIT_MODE_ENGINE | LUAJIT_MODE_FLUSH);
+    luaJIT_setmode(L, 0, LUAJIT_MODE_ENGINE | LUAJIT_MODE_OFF);
+    luaL_error(L, "CPU budget exceeded");
+  }
+  if (out_of_memory) {
+    luaL_error(L, "not enough memory");
+  }
+}
+
+
+void interrupt_attach(lua_State *L) {
+  attached_state = L;
+  atomic_store(&pending, 0);
+}
+
+
+void interrupt_request(int request) {
+  atomic_fetch_or(&pending, request);
+  if (attached_state != NULL) {
+    // The same trick luajit.c uses for SIGINT: lua_sethook() is safe to call asynchronously.
+    lua_sethook(attached_state, interrupt_hook, LUA_MASKCALL | LUA_MASKRET | LUA_MASKCOUNT, 1);
+  }
+}
@@ -0,0 +1,34 @@
+/*
+  Deferred work for the Lua VM.
+  Copyright (C) 2017 Collin RM Stocks. All rights reserved.
+*/
+
+#ifndef INTERRUPT_H
+#define INTERRUPT_H
+
+#include <luajit-2.0/lua.h>
+
+
+/*
+  Some work has to wait for a point where the VM is in a consistent state, because it is
+  noticed somewhere that must not touch the Lua state (a signal handler, or the allocator
+  in the middle of an allocation). Requests are merged into a set of flags and serviced by a
+  one-shot hook the next time the interpreter runs. Compiled traces don't run hooks, so a
+  request may wait until the current trace exits, and one that never does only ends at the
+  CPU grace period. Traces can't be flushed when the request is made instead, since that
+  frees the machine code the interrupted trace may be running; the hook flushes them and
+  turns the compiler off when it delivers INTERRUPT_CPU, so the clean-up after it runs
+  interpreted.
+*/
+enum interrupt_request {
+  INTERRUPT_COLLECT = 1, // Run a full garbage collection cycle.
+  INTERRUPT_CPU = 2,     // Raise a "CPU budget exceeded" error in the running script.
+  INTERRUPT_PROFILE = 4, // Take the profiler's samples with the running thread's stack.
+  INTERRUPT_QUOTA = 8,   // Raise an error in the running Resumer thread if it is over quota.
+};
+
+
+void interrupt_attach(lua_State *);
+void interrupt_request(int); // Async-signal-safe.
+
+#endif
@@ -0,0 +1,142 @@
+/*
+  JIT compiler settings for scripts.
+  Copyright (C) 2017 Collin RM Stocks. All rights reserved.
+*/
+
+#define _GNU_SOURCE
+
+#include "jit_tuning.h"
+
+#include <luajit-2.0/lauxlib.h>
+#include <luajit-2.0/luajit.h>
+#include <luajit-2.0/lualib.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+
+#define JIT_TUNING_MAX_PARAMS 32
+#define JIT_TUNING_PARAM_SIZE 24
+
+
+struct profile {
+  const char *name;
+  const char *spec;
+};
+
+/*
+  Machine code areas count towards the sandbox's address space limit like any other mapping,
+  so a profile that allows more of them takes that much less from --memory's headroom.
+*/
+static const struct profile profiles[] = {
+  // A run of a few milliseconds doesn't live long enough to earn back compiling everything
+  // that gets warm, so only the hottest loops and exits get traces, in smaller areas.
+  { "short-lived", "hotloop=200,hotexit=40,sizemcode=16,maxmcode=256" },
+  // Long numeric scripts run into the default trace and machine code limits, after which
+  // LuaJIT flushes every trace and starts compiling them all over again.
+  { "throughput", "maxtrace=4000,maxrecord=8000,maxside=200,maxsnap=1000,sizemcode=128,"
+                  "maxmcode=4096" },
+  { NULL, NULL }
+};
+
+// The parameters of jit.opt.start() in LuaJIT 2.0 (JIT_PARAMDEF in lj_jit.h).
+static const char *const parameter_names[] = {
+  "maxtrace", "maxrecord", "maxirconst", "maxside", "maxsnap", "hotloop", "hotexit", "tryside",
+  "instunroll", "loopunroll", "callunroll", "recunroll", "sizemcode", "maxmcode", NULL
+};
+
+static bool engine_off = false;
+static char params[JIT_TUNING_MAX_PARAMS][JIT_TUNING_PARAM_SIZE];
+static unsigned int param_count = 0;
+
+
+static bool valid_parameter(const char *param, size_t length) {
+  const char *equals = memchr(param, '=', length);
+  if (equals == NULL || length >= JIT_TUNING_PARAM_SIZE) return false;
+  size_t name_length = equals - param;
+  const char *const *name = parameter_names;
+  while (*name != NULL && (strlen(*name) != name_length || memcmp(*name, param, name_length))) {
+    ++name;
+  }
+  if (*name == NULL || equals + 1 == param + length) return false;
+  uint64_t value = 0;
+  for (const char *digit = equals + 1; digit != param + length; ++digit) {
+    if (*digit < '0' || *digit > '9') return false;
+    value = value * 10 + (*digit - '0');
+    if (value > INT32_MAX) return false;
+  }
+  // Hot counters are 16 bits wide and count down twice per loop iteration.
+  if (!strcmp(*name, "hotloop") && (value == 0 || value > 32767)) return false;
+  return true;
+}
+
+
+/*
+  Parse `spec` into the settings after the ones already there, returning the new number of
+  parameters, or -1 if it is malformed. `off` is where the engine setting goes.
+*/
+static int parse(const char *spec, unsigned int count, bool *off, int depth) {
+  const char *item = spec;
+  while (1) {
+    const char *end = strchrnul(item, ',');
+    size_t length = end - item;
+    const struct profile *profile = profiles;
+    while (profile->name != NULL &&
+           (strlen(profile->name) != length || memcmp(profile->name, item, length))) {
+      ++profile;
+    }
+    if (length == 2 && !memcmp(item, "on", 2)) {
+      *off = false;
+    } else if (length == 3 && !memcmp(item, "off", 3)) {
+      *off = true;
+    } else if (profile->name != NULL && depth == 0) {
+      int n = parse(profile->spec, count, off, 1);
+      if (n == -1) return -1;
+      count = n;
+    } else if (valid_parameter(item, length) && count < JIT_TUNING_MAX_PARAMS) {
+      memcpy(params[count], item, length);
+      params[count][length] = '\0';
+      ++count;
+    } else {
+      return -1;
+    }
+    if (*end == '\0') return count;
+    item = end + 1;
+  }
+}
+
+
+int jit_tuning_parse(const char *spec) {
+  bool off = engine_off;
+  int count = parse(spec, param_count, &off, 0);
+  if (count == -1) return 1;
+  engine_off = off;
+  param_count = count;
+  return 0;
+}
+
+
+void jit_tuning_attach(lua_State *L) {
+  if (param_count != 0) {
+    // The parameters only limit what is compiled from now on, so they must be set before the
+    // script loads. Every one of them was checked already, so this can't raise an error.
+    luaL_checkstack(L, param_count + 4, "setting JIT parameters");
+    lua_getfield(L, LUA_REGISTRYINDEX, "_LOADED");
+    lua_getfield(L, -1, LUA_JITLIBNAME ".opt");
+    if (lua_istable(L, -1)) {
+      lua_getfield(L, -1, "start");
+      for (unsigned int i = 0; i < param_count; ++i) lua_pushstring(L, params[i]);
+      if (lua_pcall(L, param_count, 0, 0)) {
+        fprintf(stderr, "failed to set JIT parameters: %s\n", lua_tostring(L, -1));
+        lua_pop(L, 1);
+      }
+    } else {
+      fputs("failed to set JIT parameters: jit.opt is not loaded\n", stderr);
+    }
+    lua_pop(L, 2);
+  }
+  // The script may still turn it back on with jit.on(); this is tuning, not a restriction.
+  if (engine_off) luaJIT_setmode(L, 0, LUAJIT_MODE_ENGINE | LUAJIT_MODE_OFF);
+}
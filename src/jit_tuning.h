@@ -0,0 +1,30 @@
+/*
+  JIT compiler settings for scripts.
+  Copyright (C) 2017 Collin RM Stocks. All rights reserved.
+*/
+
+#ifndef JIT_TUNING_H
+#define JIT_TUNING_H
+
+#include <luajit-2.0/lua.h>
+
+
+/*
+  Add the settings in `spec`, a comma-separated list of profile names and jit.opt parameters:
+
+    off          turn the JIT compiler off
+    on           turn it back on (it is on by default)
+    short-lived  compile only the hottest code, in smaller machine code areas
+    throughput   allow more and longer traces, and more machine code
+    name=value   set one of jit.opt's parameters, e.g. hotloop=20 or maxmcode=2048
+
+  Later settings override earlier ones, including those of a profile. May be called more than
+  once, before any state is created. Returns 0, or 1 if `spec` is malformed, in which case
+  nothing was added.
+*/
+int jit_tuning_parse(const char *spec);
+
+// Apply the settings to a new state, before it loads the script.
+void jit_tuning_attach(lua_State *);
+
+#endif
@@ -2,7 +2,19 @@
 #include <stdlib.h>
 
 #include "luajit_wrapper.h"
+#include "allocator.h"
+#include "interrupt.h"
+#include "jit_tuning.h"
+#include "output.h"
+#include "prelude.h"
+#include "profile.h"
+#include "stats.h"
+#include "c-runtime/aio.h"
+#include "c-runtime/channel.h"
+#include "c-runtime/codec.h"
+#include "c-runtime/data.h"
 #include "c-runtime/resumer.h"
+#include "c-runtime/sandbox_api.h"
 
 #include <luajit-2.0/lua.h>
 #include <luajit-2.0/lualib.h>
@@ -42,10 +54,23 @@ static const char *fd_reader(lua_State *L, void *data, size_t *size) {
 }
 
 
-static int load_fd(lua_State *L, int fd) {
-  struct fd_reader_closure closure;
-  closure.fd = fd;
-  int error = lua_load(L, fd_reader, &closure, "script");
+struct buffer_reader_closure {
+  const char *buffer;
+  size_t size;
+};
+
+
+static const char *buffer_reader(lua_State *L, void *data, size_t *size) {
+  // Hand over the whole buffer at once, so lua_load() works on it in place.
+  (void) L;
+  struct buffer_reader_closure *closure = (struct buffer_reader_closure *) data;
+  *size = closure->size;
+  closure->size = 0;
+  return closure->buffer;
+}
+
+
+static int check_load_error(int error) {
   if (error == LUA_ERRSYNTAX) {
     fprintf(stderr, "syntax error\n");
     return 1;
@@ -57,30 +82,107 @@ static int load_fd(lua_State *L, int fd) {
 }
 
 
+static int load_fd(lua_State *L, int fd) {
+  struct fd_reader_closure closure;
+  closure.fd = fd;
+  return check_load_error(lua_load(L, fd_reader, &closure, "script"));
+}
+
+
+static int load_buffer(lua_State *L, const char *buffer, size_t size) {
+  struct buffer_reader_closure closure;
+  closure.buffer = buffer;
+  closure.size = size;
+  return check_load_error(lua_load(L, buffer_reader, &closure, "script"));
+}
+
+
+static int load_script(lua_State *L, const struct luajit_wrapper_script *script) {
+  if (script->buffer != NULL) {
+    return load_buffer(L, script->buffer, script->size);
+  }
+  return load_fd(L, script->fd);
+}
+
+
+static int traceback(lua_State *L) {
+  // The error handler. Like debug.traceback(), which can't be used before the script has
+  // opened the debug library.
+  const char *message = lua_tostring(L, 1);
+  if (message == NULL && !lua_isnoneornil(L, 1)) return 1; // leave other error values alone
+  luaL_traceback(L, L, message, 1);
+  return 1;
+}
+
+
+static void open_libraries(lua_State *L) {
+  // Like luaL_openlibs(), which leaves ffi in package.preload, with io's flushes wrapped.
+  luaL_openlibs(L);
+  lua_getglobal(L, LUA_IOLIBNAME); // stack: io
+  output_attach_io(L);
+  lua_pop(L, 1);
+}
+
+
 static void initialize_vm(lua_State *L) {
   // Don't bother checking for errors in putenv() here. It can only possibly fail with ENOMEM
   // and if we've already run out of memory at this point, there are bigger problems.
   putenv("LUA_PATH="); // disable require() search path for lua files
   putenv("LUA_CPATH="); // disable require() search path for shared objects
-  luaL_openlibs(L);
+  open_libraries(L);
+  prelude_attach(L);
   cropen_resumer(L);
-  lua_getglobal(L, "debug"); // stack: debug
-  lua_getfield(L, -1, "traceback"); // stack: debug, debug.traceback
-  lua_remove(L, -2); // stack: debug.traceback
+  cropen_codec(L);
+  cropen_aio(L);
+  cropen_channel(L);
+  cropen_sandbox(L);
+  cropen_data(L);
+  lua_pushcfunction(L, traceback); // stack: traceback
 }
 
 
-int luajit_wrapper_load_and_run(int fd) {
-  // Initialize the Lua state.
-  int error;
+lua_State *luajit_wrapper_new_state(void) {
+  // Create a Lua state with all libraries loaded, ready for luajit_wrapper_run().
   lua_State *L;
   L = luaL_newstate();
   if (L == NULL) {
     fprintf(stderr, "failed to allocate memory\n");
-    return 1;
+    return NULL;
   }
+  allocator_install(L);
+  interrupt_attach(L);
   initialize_vm(L);
-  error = load_fd(L, fd) || run(L);
-  lua_close(L);
+  jit_tuning_attach(L);
+  stats_attach(L);
+  return L;
+}
+
+
+int luajit_wrapper_run(lua_State *L, const struct luajit_wrapper_script *script) {
+  // Load the script and run it in a state from luajit_wrapper_new_state().
+  stats_phase(STATS_LOADING);
+  int error = load_script(L, script);
+  if (!error) {
+    profile_mark("[startup]");
+    stats_phase(STATS_RUNNING);
+    error = run(L);
+  }
+  stats_phase(STATS_DONE);
+  return error;
+}
+
+
+int luajit_wrapper_load_and_run(const struct luajit_wrapper_script *script) {
+  // Initialize the Lua state.
+  int error;
+  lua_State *L;
+  L = luajit_wrapper_new_state();
+  if (L == NULL) return 1;
+  error = luajit_wrapper_run(L, script);
+  fflush(NULL); // so a report sent to stdout or stderr comes after the script's output
+  output_flush();
+  stats_report(error ? "error" : "ok");
+  profile_report();
+  allocator_close(L);
   return error;
 }
@@ -1,6 +1,24 @@
 #ifndef LUAJIT_WRAPPER_H
 #define LUAJIT_WRAPPER_H
 
-int luajit_wrapper_load_and_run(int);
+#include <luajit-2.0/lua.h>
+
+#include <stddef.h>
+
+
+/*
+  A script to load: read from `fd`, unless `buffer` is set, in which case the `size` bytes
+  at `buffer` are loaded in place. Either way, it may be Lua source or a LuaJIT bytecode image.
+*/
+struct luajit_wrapper_script {
+  int fd;
+  const char *buffer;
+  size_t size;
+};
+
+
+lua_State *luajit_wrapper_new_state(void);
+int luajit_wrapper_run(lua_State *, const struct luajit_wrapper_script *);
+int luajit_wrapper_load_and_run(const struct luajit_wrapper_script *);
 
 #endif
@@ -5,11 +5,22 @@
 
 #define _GNU_SOURCE
 
+#include "allocator.h"
+#include "batch.h"
+#include "bytecode_cache.h"
+#include "jit_tuning.h"
 #include "luajit_wrapper.h"
+#include "output.h"
+#include "profile.h"
 #include "sandbox.h"
+#include "server.h"
+#include "stats.h"
+#include "c-runtime/channel.h"
+#include "c-runtime/data.h"
 
 #include <argp.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -21,6 +32,20 @@ extern char **environ;
 
 
 #define ERR_TO_STDOUT (1000)
+#define SERVE (1001)
+#define CACHE_DIR (1002)
+#define CPU_MS (1003)
+#define STATS_FD (1004)
+#define BATCH (1005)
+#define JOBS (1006)
+#define PIN_CPUS (1007)
+#define COMPLETION_ORDER (1008)
+#define CHANNEL (1009)
+#define DATA (1010)
+#define PROFILE_FD (1011)
+#define PROFILE_INTERVAL (1012)
+#define OUTPUT_LIMIT (1013)
+#define JIT (1014)
 
 
 const char *argp_program_version = "luajit-sandbox 0.0.0 (development)";
@@ -30,13 +55,22 @@ static char args_doc[] = "[program-file]";
 static struct argp_option options[] = {
   {
     "cpu", 't', "seconds", 0,
-    "Maximum CPU time in seconds. The script will be notified when its time expires, "
-    "and will be allowed one additional CPU second to clean up and exit gracefully. "
-    "If the script does not exit by this hard limit, it is brutally killed. "
-    "Zero means unlimited.\n"
+    "Maximum CPU time in seconds. When it expires, a \"CPU budget exceeded\" error is "
+    "raised in the script, which may catch it, and the script is allowed one additional "
+    "CPU second to clean up and exit gracefully. If the script does not exit by this hard "
+    "limit, it is stopped with \"CPU time limit exceeded\" and exit status 1. A loop "
+    "compiled by the JIT only sees the error once it leaves compiled code, so a tight one "
+    "runs until the hard limit. Zero means unlimited.\n"
     "Default: cpu=1",
     0
   },
+  {
+    "cpu-ms", CPU_MS, "milliseconds", 0,
+    "Maximum CPU time in milliseconds. Overrides --cpu. When it expires, a \"CPU budget "
+    "exceeded\" error is raised in the script, which may catch it. The script then gets "
+    "the same amount of CPU time again to clean up and exit before it is killed.",
+    0
+  },
   {
     "memory", 'm', "value", 0,
     "Maximum amount of memory available to the script in MiB. "
@@ -44,12 +78,113 @@ static struct argp_option options[] = {
     "Default: memory=50",
     0
   },
+  {
+    "output-limit", OUTPUT_LIMIT, "bytes", 0,
+    "Maximum number of bytes the script may write to stdout and stderr together. Anything "
+    "after that is dropped, and a note is written to stderr. Zero means unlimited.\n"
+    "Default: output-limit=0",
+    0
+  },
+  {
+    "jit", JIT, "settings", 0,
+    "Tune the JIT compiler before the script loads, with a comma-separated list of profiles "
+    "and jit.opt parameters: \"off\", \"short-lived\" (compile only the hottest code, with "
+    "less machine code), \"throughput\" (allow more and longer traces, and more machine "
+    "code), or name=value for hotloop, hotexit, maxtrace, maxrecord, maxside, maxsnap, "
+    "sizemcode, maxmcode (both in KiB) and the other parameters of jit.opt.start(). Later "
+    "settings override earlier ones, and it may be given more than once. Machine code counts "
+    "towards the address space allowed by --memory.",
+    0
+  },
   {
     "err-to-stdout", ERR_TO_STDOUT, 0, 0,
     "Errors should be printed to stdout instead of stderr. "
     "Internally redirects stderr to stdout.",
     0
   },
+  {
+    "serve", SERVE, 0, 0,
+    "Instead of running a single program, read length-framed requests from stdin and write "
+    "framed output and exit statuses to stdout (see src/server.h for the wire format). "
+    "Each request runs in a forked copy of an already initialized VM, inside its own "
+    "sandbox, with the memory and CPU limits given in the request.",
+    0
+  },
+  {
+    "batch", BATCH, "manifest", 0,
+    "Instead of running a single program, run every program listed in the manifest file, "
+    "one path per line, and write their output and exit statuses to stdout as the same "
+    "frames as --serve, tagged with the manifest line number. The sandbox is set up once, "
+    "and each program runs in a forked child of the sandboxed process with the given memory "
+    "and CPU limits.",
+    0
+  },
+  {
+    "jobs", JOBS, "count", 0,
+    "With --batch, keep this many workers running scripts in parallel, each in its own "
+    "sandbox. The process started here only hands out scripts and gathers results, and "
+    "never runs any Lua code itself.",
+    0
+  },
+  {
+    "pin-cpus", PIN_CPUS, 0, 0,
+    "With --jobs, pin each worker to a different CPU, going round the CPUs this process "
+    "is allowed to run on.",
+    0
+  },
+  {
+    "completion-order", COMPLETION_ORDER, 0, 0,
+    "With --jobs, write each script's results as soon as it finishes, instead of in the "
+    "order of the manifest.",
+    0
+  },
+  {
+    "cache-dir", CACHE_DIR, "directory", 0,
+    "Cache compiled bytecode in this directory, keyed by a hash of the script, and reuse "
+    "it on later runs of the same script instead of parsing it again. The directory must "
+    "not be writable by anyone you wouldn't trust to run code outside the sandbox.",
+    0
+  },
+  {
+    "stats-fd", STATS_FD, "fd", 0,
+    "When the script ends, write one line of JSON with statistics about the run to this "
+    "file descriptor: how it ended, CPU time, peak RSS, load and run time, heap allocation, "
+    "GC cycles, Resumer switches, and JIT traces compiled and aborted (by reason) with the "
+    "machine code they took. It is written even if the script is stopped for exceeding its "
+    "CPU time or making a forbidden system call.",
+    0
+  },
+  {
+    "profile-fd", PROFILE_FD, "fd", 0,
+    "Sample the script's Lua stack while it runs, and when it ends, write the samples to this "
+    "file descriptor as collapsed stacks for flame graph tools, including which thread they "
+    "were in and whether they were in compiled code. Also written if the script is stopped "
+    "for exceeding its CPU time. Not for --serve or --batch.",
+    0
+  },
+  {
+    "profile-interval", PROFILE_INTERVAL, "microseconds", 0,
+    "With --profile-fd, take a sample every this much user CPU time. The kernel may not "
+    "sample more often than its timer tick.\n"
+    "Default: profile-interval=1000",
+    0
+  },
+  {
+    "channel", CHANNEL, "name=memfd:doorbell", 0,
+    "Open a shared-memory channel to the host, which the script can get with "
+    "channel.open(name). memfd is a file descriptor of a memfd laid out as described in "
+    "src/channel_ring.h, and doorbell one end of a connected socket used to wake up a side "
+    "waiting for the other. May be given more than once. Not for --serve or --batch.",
+    0
+  },
+  {
+    "data", DATA, "name=path", 0,
+    "Map the file at path read-only before setting up the sandbox, and give it to scripts "
+    "as sandbox.data.name. It is shared rather than copied, and does not count towards "
+    "--memory. The file must not be changed or truncated until every script is done. "
+    "May be given more than once.",
+    0
+  },
   {
     0, 0, 0, OPTION_DOC,
     "When initializing the sandbox, open file descriptors are not closed. This means they "
@@ -64,7 +199,28 @@ static struct argp_option options[] = {
 struct args_struct {
   struct sandbox_settings sandbox_settings;
   char *script_file;
+  char *cache_dir;
+  char *batch;
+  unsigned int jobs;
+  bool pin_cpus;
+  bool completion_order;
+  size_t output_limit;
+  int stats_fd;
+  int profile_fd;
+  unsigned long profile_interval;
+  unsigned int channel_count;
+  struct {
+    char *name;
+    int memfd;
+    int doorbell;
+  } channels[CR_CHANNEL_MAX];
+  unsigned int data_count;
+  struct {
+    char *name;
+    char *path;
+  } data[CR_DATA_MAX];
   bool err_to_stdout;
+  bool serve;
 };
 
 
@@ -82,6 +238,14 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
       }
       args->sandbox_settings.max_cpu_time = parsed_value;
       break;
+    case CPU_MS:
+      parsed_value = strtoul(arg, &end, 10);
+      if (arg == end || *end != '\0' || errno == ERANGE || parsed_value > UINT_MAX) {
+        argp_error(state, "invalid value for --cpu-ms: %s", arg);
+        return EINVAL;
+      }
+      args->sandbox_settings.max_cpu_ms = parsed_value;
+      break;
     case 'm':
       parsed_value = strtoul(arg, &end, 10);
       if (arg == end || *end != '\0' || errno == ERANGE) {
@@ -90,9 +254,120 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
       }
       args->sandbox_settings.max_memory = parsed_value << 20;
       break;
+    case OUTPUT_LIMIT:
+      parsed_value = strtoul(arg, &end, 10);
+      if (arg == end || *end != '\0' || errno == ERANGE) {
+        argp_error(state, "invalid value for --output-limit: %s", arg);
+        return EINVAL;
+      }
+      args->output_limit = parsed_value;
+      break;
+    case JIT:
+      // Kept in the jit_tuning module, since every mode creates its states through it.
+      if (jit_tuning_parse(arg)) {
+        argp_error(state, "invalid value for --jit: %s", arg);
+        return EINVAL;
+      }
+      break;
     case ERR_TO_STDOUT:
       args->err_to_stdout = true;
       break;
+    case SERVE:
+      args->serve = true;
+      break;
+    case CACHE_DIR:
+      args->cache_dir = arg;
+      break;
+    case BATCH:
+      args->batch = arg;
+      break;
+    case JOBS:
+      parsed_value = strtoul(arg, &end, 10);
+      if (arg == end || *end != '\0' || errno == ERANGE || parsed_value == 0 ||
+          parsed_value > 4096) {
+        argp_error(state, "invalid value for --jobs: %s", arg);
+        return EINVAL;
+      }
+      args->jobs = parsed_value;
+      break;
+    case PIN_CPUS:
+      args->pin_cpus = true;
+      break;
+    case COMPLETION_ORDER:
+      args->completion_order = true;
+      break;
+    case STATS_FD:
+      parsed_value = strtoul(arg, &end, 10);
+      if (arg == end || *end != '\0' || errno == ERANGE || parsed_value > INT_MAX) {
+        argp_error(state, "invalid value for --stats-fd: %s", arg);
+        return EINVAL;
+      }
+      args->stats_fd = parsed_value;
+      break;
+    case PROFILE_FD:
+      parsed_value = strtoul(arg, &end, 10);
+      if (arg == end || *end != '\0' || errno == ERANGE || parsed_value > INT_MAX) {
+        argp_error(state, "invalid value for --profile-fd: %s", arg);
+        return EINVAL;
+      }
+      args->profile_fd = parsed_value;
+      break;
+    case PROFILE_INTERVAL:
+      parsed_value = strtoul(arg, &end, 10);
+      if (arg == end || *end != '\0' || errno == ERANGE || parsed_value == 0) {
+        argp_error(state, "invalid value for --profile-interval: %s", arg);
+        return EINVAL;
+      }
+      args->profile_interval = parsed_value;
+      break;
+    case CHANNEL: {
+      // name=memfd:doorbell
+      char *equals = strchr(arg, '=');
+      char *colon = NULL;
+      unsigned long doorbell = 0;
+      if (equals != NULL) {
+        char *memfd = equals + 1;
+        errno = 0;
+        parsed_value = strtoul(memfd, &end, 10);
+        if (end != memfd && *end == ':' && errno != ERANGE) {
+          colon = end;
+          errno = 0;
+          doorbell = strtoul(colon + 1, &end, 10);
+        }
+      }
+      if (equals == arg || colon == NULL || end == colon + 1 || *end != '\0' ||
+          errno == ERANGE || parsed_value > INT_MAX || doorbell > INT_MAX) {
+        argp_error(state, "invalid value for --channel: %s", arg);
+        return EINVAL;
+      }
+      if (args->channel_count == CR_CHANNEL_MAX) {
+        argp_error(state, "too many channels (at most %d)", CR_CHANNEL_MAX);
+        return EINVAL;
+      }
+      *equals = '\0';
+      args->channels[args->channel_count].name = arg;
+      args->channels[args->channel_count].memfd = parsed_value;
+      args->channels[args->channel_count].doorbell = doorbell;
+      ++args->channel_count;
+      break;
+    }
+    case DATA: {
+      // name=path
+      char *equals = strchr(arg, '=');
+      if (equals == NULL || equals == arg || equals[1] == '\0') {
+        argp_error(state, "invalid value for --data: %s", arg);
+        return EINVAL;
+      }
+      if (args->data_count == CR_DATA_MAX) {
+        argp_error(state, "too many data mounts (at most %d)", CR_DATA_MAX);
+        return EINVAL;
+      }
+      *equals = '\0';
+      args->data[args->data_count].name = arg;
+      args->data[args->data_count].path = equals + 1;
+      ++args->data_count;
+      break;
+    }
     case ARGP_KEY_ARG:
       if (args->script_file == NULL) { // Only allow setting the script file once.
         args->script_file = arg;
@@ -107,25 +382,91 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
 static struct argp argp = { options, parse_opt, args_doc, doc, 0, 0, 0 };
 
 
-int main(int argc, char **argv) {
-  // If this process was run with environment variables, clear them all
-  // by loading the process image again.
-  if (environ[0] != NULL) {
-    char *new_environ[] = {NULL};
-    execve("/proc/self/exe", argv, new_environ);
-    // If execve() returned, it failed.
-    perror("failed to restart process without environment");
-    return 1;
+static void clear_environment(void) {
+  // Clear the environment variables this process was run with. Dropping them from environ is
+  // not enough: their strings stay on the stack, where a script using the ffi could read them,
+  // and in /proc/self/environ. So they are overwritten in place first.
+  for (char **variable = environ; *variable != NULL; ++variable) {
+    memset(*variable, '\0', strlen(*variable));
   }
+  clearenv();
+}
+
+
+int main(int argc, char **argv) {
+  clear_environment();
 
   // Set defaults and parse args.
   struct args_struct args;
   args.sandbox_settings.max_memory = ((size_t) 50) << 20;
   args.sandbox_settings.max_cpu_time = 1;
+  args.sandbox_settings.max_cpu_ms = 0;
+  args.sandbox_settings.fork_scripts = false;
+  args.sandbox_settings.mapped_data = 0;
   args.script_file = NULL;
+  args.cache_dir = NULL;
+  args.batch = NULL;
+  args.jobs = 0;
+  args.pin_cpus = false;
+  args.completion_order = false;
+  args.output_limit = 0;
+  args.stats_fd = -1;
+  args.profile_fd = -1;
+  args.profile_interval = 1000;
+  args.channel_count = 0;
+  args.data_count = 0;
   args.err_to_stdout = false;
+  args.serve = false;
   argp_parse(&argp, argc, argv, 0, 0, &args);
 
+  // Every script in server and batch mode would share the same channels and profile.
+  if (args.channel_count != 0 && (args.batch != NULL || args.serve)) {
+    fputs("--channel does not work with --serve or --batch\n", stderr);
+    return 1;
+  }
+  if (args.profile_fd != -1 && (args.batch != NULL || args.serve)) {
+    fputs("--profile-fd does not work with --serve or --batch\n", stderr);
+    return 1;
+  }
+
+  // Data files are mapped in every mode, so that forked scripts and workers share them.
+  for (unsigned int i = 0; i < args.data_count; ++i) {
+    if (cr_data_mount(args.data[i].name, args.data[i].path)) return 1;
+  }
+  args.sandbox_settings.mapped_data = cr_data_mapped_size();
+
+  // In server and batch mode, stdout carries frames, so redirecting stderr is done per script.
+  if (args.batch != NULL) {
+    if (args.script_file != NULL || args.serve || args.cache_dir != NULL) {
+      fputs("--batch does not take a program file, --serve or --cache-dir\n", stderr);
+      return 1;
+    }
+    struct batch_settings batch_settings;
+    batch_settings.sandbox_settings = args.sandbox_settings;
+    batch_settings.err_to_stdout = args.err_to_stdout;
+    batch_settings.output_limit = args.output_limit;
+    batch_settings.jobs = args.jobs;
+    batch_settings.pin_workers = args.pin_cpus;
+    batch_settings.completion_order = args.completion_order;
+    return batch_run(args.batch, &batch_settings);
+  }
+  if (args.jobs != 0) {
+    fputs("--jobs only works with --batch\n", stderr);
+    return 1;
+  }
+  if (args.serve) {
+    if (args.script_file != NULL) {
+      fputs("--serve does not take a program file\n", stderr);
+      return 1;
+    }
+    struct server_settings server_settings;
+    server_settings.err_to_stdout = args.err_to_stdout;
+    server_settings.output_limit = args.output_limit;
+    server_settings.cache_dir = args.cache_dir;
+    server_settings.mapped_data = args.sandbox_settings.mapped_data;
+    return server_run(&server_settings);
+  }
+
   // Redirect stderr to stdout if requested.
   if (args.err_to_stdout) {
     if (dup2(1, 2) == -1) {
@@ -144,10 +485,30 @@ int main(int argc, char **argv) {
     }
   }
 
+  struct luajit_wrapper_script script;
+  script.fd = progfile;
+  script.buffer = NULL;
+  script.size = 0;
+
+  // The cache directory is only touched here, before the sandbox is set up.
+  if (args.cache_dir != NULL) {
+    if (bytecode_cache_load(args.cache_dir, &script)) return 1;
+  }
+
+  if (output_open(args.output_limit)) return 1;
+
   // Set up sandbox.
+  for (unsigned int i = 0; i < args.channel_count; ++i) {
+    if (cr_channel_attach(args.channels[i].name, args.channels[i].memfd, args.channels[i].doorbell)) {
+      return 1;
+    }
+  }
+  stats_open(args.stats_fd);
+  if (profile_open(args.profile_fd, args.profile_interval)) return 1;
   if (sandbox_init(&args.sandbox_settings)) return 1;
+  allocator_set_limit(args.sandbox_settings.max_memory);
 
-  if (luajit_wrapper_load_and_run(progfile)) {
+  if (luajit_wrapper_load_and_run(&script)) {
     return 1;
   }
 
@@ -0,0 +1,240 @@
+/*
+  Buffered output for scripts.
+  Copyright (C) 2017 Collin RM Stocks. All rights reserved.
+*/
+
+#define _GNU_SOURCE
+
+#include "output.h"
+
+#include <luajit-2.0/lauxlib.h>
+#include <luajit-2.0/lualib.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+
+#define OUTPUT_BUFFER_SIZE (64 << 10)
+
+
+// Where a stream's output goes, and whether it counts against the limit.
+struct stream {
+  int fd;
+  bool limited;
+};
+
+static const struct stream script_in = {0, true};
+static const struct stream script_out = {1, true};
+static const struct stream script_err = {2, true};
+static const struct stream diagnostics_err = {2, false};
+
+static char buffer[OUTPUT_BUFFER_SIZE];   // Holds stdout only: stderr is written straight away.
+static volatile size_t buffered = 0;     // Bytes in `buffer` so far.
+static volatile sig_atomic_t busy = 0;   // Set while `buffer` is being changed or written.
+static size_t limit = 0;
+static size_t accepted = 0;
+static bool truncated = false;
+// The script's stdin, stdout and stderr, and stderr for this program's own messages.
+static FILE *script_streams[3] = {NULL, NULL, NULL};
+static FILE *diagnostics = NULL;
+
+
+static void write_all(int fd, struct iovec *parts, int count) {
+  // Output that can't be written (a closed pipe, say) is dropped, as stdio would. But `fd` may
+  // have been made non-blocking by whoever shares it, and then it's only full for now.
+  while (count != 0) {
+    ssize_t n = writev(fd, parts, count);
+    if (n == -1 && errno == EINTR) continue;
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      struct pollfd pollfd = {.fd = fd, .events = POLLOUT};
+      if (ppoll(&pollfd, 1, NULL, NULL) == -1 && errno != EINTR) return;
+      continue;
+    }
+    if (n <= 0) return;
+    while (count != 0 && (size_t) n >= parts->iov_len) {
+      n -= parts->iov_len;
+      ++parts;
+      --count;
+    }
+    if (count != 0) {
+      parts->iov_base = (char *) parts->iov_base + n;
+      parts->iov_len -= n;
+    }
+  }
+}
+
+
+// Write what is buffered followed by `data` to stdout, in one system call if possible.
+static void write_through(const char *data, size_t size) {
+  struct iovec parts[2];
+  parts[0].iov_base = buffer;
+  parts[0].iov_len = buffered;
+  parts[1].iov_base = (void *) data;
+  parts[1].iov_len = size;
+  write_all(1, parts + (buffered == 0), 1 + (buffered != 0 && size != 0));
+  buffered = 0;
+}
+
+
+static void append(int fd, const char *data, size_t size) {
+  busy = 1;
+  if (fd != 1) {
+    // Whatever went to stdout before still comes first.
+    write_through(NULL, 0);
+    struct iovec part;
+    part.iov_base = (void *) data;
+    part.iov_len = size;
+    write_all(fd, &part, 1);
+  } else if (size <= OUTPUT_BUFFER_SIZE - buffered) {
+    memcpy(buffer + buffered, data, size);
+    buffered += size;
+  } else {
+    write_through(data, size);
+  }
+  busy = 0;
+}
+
+
+static ssize_t cookie_write(void *cookie, const char *data, size_t size) {
+  const struct stream *stream = cookie;
+  size_t allowed = size;
+  if (stream->limited && limit != 0) {
+    if (accepted >= limit) return size;
+    if (allowed > limit - accepted) allowed = limit - accepted;
+    accepted += allowed;
+  }
+  append(stream->fd, data, allowed);
+  if (allowed != size && !truncated) {
+    static const char note[] = "\noutput truncated: the script wrote more than --output-limit\n";
+    truncated = true;
+    append(2, note, sizeof(note) - 1);
+  }
+  return size; // Dropped output still counts as written, so the script carries on.
+}
+
+
+static ssize_t cookie_read(void *cookie, char *data, size_t size) {
+  // Whatever the script wrote may be what the other end is waiting for before it replies.
+  (void) cookie;
+  output_flush();
+  ssize_t n;
+  do {
+    n = read(0, data, size);
+  } while (n == -1 && errno == EINTR);
+  return n;
+}
+
+
+static FILE *open_stream(const struct stream *stream, const char *mode) {
+  cookie_io_functions_t functions;
+  memset(&functions, '\0', sizeof(functions));
+  functions.read = &cookie_read;
+  functions.write = &cookie_write;
+  FILE *file = fopencookie((void *) stream, mode, functions);
+  // Writes go straight to `buffer`, which is bigger than anything stdio would buffer.
+  if (file != NULL && stream->fd != 0) setvbuf(file, NULL, _IONBF, 0);
+  return file;
+}
+
+
+static int open_streams(void) {
+  // Once per process, by output_open() or output_attach_io(), whichever comes first.
+  if (diagnostics != NULL) return 0;
+  script_streams[0] = open_stream(&script_in, "r");
+  script_streams[1] = open_stream(&script_out, "w");
+  script_streams[2] = open_stream(&script_err, "w");
+  diagnostics = open_stream(&diagnostics_err, "w");
+  return script_streams[0] == NULL || script_streams[1] == NULL || script_streams[2] == NULL ||
+         diagnostics == NULL;
+}
+
+
+static void flush_at_exit(void) {
+  // exit() flushes stdio only after the atexit() handlers, so whatever it holds goes first.
+  fflush(NULL);
+  output_flush();
+}
+
+
+int output_open(size_t output_limit) {
+  limit = output_limit;
+  fflush(NULL);
+  if (open_streams() || atexit(&flush_at_exit)) {
+    perror("failed to set up output buffering");
+    return 1;
+  }
+  stdin = script_streams[0];
+  stdout = script_streams[1];
+  stderr = diagnostics;
+  return 0;
+}
+
+
+static int flush_then_output(lua_State *L) {
+  // Calls the original function, in upvalue 1, with the same arguments, then flushes.
+  lua_pushvalue(L, lua_upvalueindex(1));
+  lua_insert(L, 1);
+  lua_call(L, lua_gettop(L) - 1, LUA_MULTRET);
+  output_flush();
+  return lua_gettop(L);
+}
+
+
+static void wrap_flush(lua_State *L, int table) {
+  lua_getfield(L, table, "flush");
+  if (lua_isfunction(L, -1)) {
+    lua_pushcclosure(L, &flush_then_output, 1);
+    lua_setfield(L, table, "flush");
+  } else {
+    lua_pop(L, 1);
+  }
+}
+
+
+static void set_standard_file(lua_State *L, int table, const char *name, FILE *file) {
+  // Like Lua 5.1's, LuaJIT's file handles start with their FILE *.
+  lua_getfield(L, table, name);
+  FILE **handle = luaL_checkudata(L, -1, LUA_FILEHANDLE);
+  *handle = file;
+  lua_pop(L, 1);
+}
+
+
+void output_attach_io(lua_State *L) {
+  // io.flush(), and file:flush(), whose method table is the file metatable itself.
+  int table = lua_gettop(L);
+  wrap_flush(L, table);
+  luaL_getmetatable(L, LUA_FILEHANDLE);
+  if (lua_istable(L, -1)) wrap_flush(L, lua_gettop(L));
+  lua_pop(L, 1);
+  // The io library took C's standard files when it was opened, which may have been before
+  // output_open(), and in any case stderr is for diagnostics once that has run.
+  if (open_streams()) luaL_error(L, "failed to set up output buffering");
+  set_standard_file(L, table, "stdin", script_streams[0]);
+  set_standard_file(L, table, "stdout", script_streams[1]);
+  set_standard_file(L, table, "stderr", script_streams[2]);
+}
+
+
+void output_flush(void) {
+  if (buffered == 0) return;
+  busy = 1;
+  write_through(NULL, 0);
+  busy = 0;
+}
+
+
+void output_flush_from_signal(void) {
+  if (busy || buffered == 0) return;
+  int errno_save = errno;
+  write_through(NULL, 0);
+  errno = errno_save;
+}
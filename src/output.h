@@ -0,0 +1,45 @@
+/*
+  Buffered output for scripts.
+  Copyright (C) 2017 Collin RM Stocks. All rights reserved.
+*/
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <luajit-2.0/lua.h>
+
+#include <stddef.h>
+
+
+/*
+  Send the script's stdout through one large buffer, whatever buffering the script asks stdio
+  for. It is written out with writev() when it fills up, when the script flushes a file,
+  before it reads stdin or uses aio, before anything goes to stderr, and when the process
+  exits. Stderr is not buffered, so what is written to it comes out at once, in order with
+  stdout.
+
+  After `limit` bytes written by the script (zero for no limit), further output is dropped
+  and a note is written to stderr once. C's stderr is then kept apart from the script's
+  io.stderr, so this program's own messages, such as the script's error, are never dropped.
+
+  Call in the process that runs the script. Returns 0, or 1 after printing an error.
+*/
+int output_open(size_t limit);
+
+/*
+  Point the io library's standard files at the script's streams, whether or not
+  output_open() has run yet, and wrap its flush functions, which stdio alone doesn't tell
+  this layer about. Expects the io table on top of the stack.
+*/
+void output_attach_io(lua_State *);
+
+void output_flush(void);
+
+/*
+  Write what is buffered, for the signal handlers that end a run or may be followed by
+  SIGKILL. Async-signal-safe, but does nothing if the signal arrived in the middle of this
+  layer's own work.
+*/
+void output_flush_from_signal(void);
+
+#endif
@@ -0,0 +1,56 @@
+/*
+  Trusted Lua modules embedded at build time.
+  Copyright (C) 2017 Collin RM Stocks. All rights reserved.
+*/
+
+#include "prelude.h"
+
+#include <luajit-2.0/lauxlib.h>
+#include <luajit-2.0/lualib.h>
+
+#include <stddef.h>
+
+// Generated by the makefile: the bytecode of each module, and PRELUDE_MODULES listing them.
+#include "prelude_modules.h"
+
+
+struct prelude_module {
+  const char *name;
+  const unsigned char *bytecode;
+  size_t size;
+};
+
+#define PRELUDE_MODULE(name, bytecode, size) { name, bytecode, size },
+
+static const struct prelude_module modules[] = {
+  PRELUDE_MODULES
+  { NULL, NULL, 0 }
+};
+
+
+static int load_module(lua_State *L) {
+  // package.preload loader. Upvalue 1 is a light userdata pointing at the module.
+  const struct prelude_module *module = lua_touserdata(L, lua_upvalueindex(1));
+  if (luaL_loadbuffer(L, (const char *) module->bytecode, module->size, module->name)) {
+    return lua_error(L);
+  }
+  lua_pushstring(L, module->name);
+  lua_call(L, 1, 1);
+  return 1;
+}
+
+
+void prelude_attach(lua_State *L) {
+  lua_getglobal(L, LUA_LOADLIBNAME);
+  lua_getfield(L, -1, "preload"); // stack: package, package.preload
+  for (const struct prelude_module *module = modules; module->name != NULL; ++module) {
+    lua_getfield(L, -1, module->name);
+    int taken = !lua_isnil(L, -1);
+    lua_pop(L, 1);
+    if (taken) continue;
+    lua_pushlightuserdata(L, (void *) module);
+    lua_pushcclosure(L, &load_module, 1);
+    lua_setfield(L, -2, module->name);
+  }
+  lua_pop(L, 2);
+}
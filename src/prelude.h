@@ -0,0 +1,21 @@
+/*
+  Trusted Lua modules embedded at build time.
+  Copyright (C) 2017 Collin RM Stocks. All rights reserved.
+*/
+
+#ifndef PRELUDE_H
+#define PRELUDE_H
+
+#include <luajit-2.0/lua.h>
+
+
+/*
+  The makefile compiles every prelude/name.lua to LuaJIT bytecode and builds it into the
+  program. This registers each of them in package.preload, so a script's require "name" loads
+  it from memory, without touching the file system or the parser. A module is only loaded the
+  first time it is required. Names that are already in package.preload, like ffi, are left
+  alone.
+*/
+void prelude_attach(lua_State *);
+
+#endif
@@ -0,0 +1,285 @@
+/*
+  Sampling profiler for scripts.
+  Copyright (C) 2017 Collin RM Stocks. All rights reserved.
+*/
+
+#define _GNU_SOURCE
+
+#include "profile.h"
+#include "interrupt.h"
+
+#include <errno.h>
+#include <link.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+
+#define PROFILE_MAX_DEPTH 64
+#define PROFILE_MAX_STACKS 4096 // A power of two.
+#define PROFILE_NAMES_SIZE (1 << 20)
+#define PROFILE_MAX_CODE_RANGES 32
+#define PROFILE_COMPILED_SUFFIX "_[j]"
+
+
+#define err(v, msg) do { if (v) { perror(msg); return 1; } } while (0)
+
+
+struct stack {
+  uint32_t hash;
+  uint32_t offset; // into names
+  uint32_t length;
+  unsigned long samples; // Zero for an unused slot. Set last, so a report never sees half a stack.
+};
+
+// The code of this program and any libraries it loaded. Anything else is compiled traces.
+struct code_range {
+  uintptr_t start;
+  uintptr_t end;
+};
+
+static int profile_fd = -1;
+static volatile sig_atomic_t reported = 0;
+static struct code_range code_ranges[PROFILE_MAX_CODE_RANGES];
+static int code_range_count = 0;
+static atomic_ulong due_interpreted = 0;
+static atomic_ulong due_compiled = 0;
+
+static struct stack stacks[PROFILE_MAX_STACKS];
+static unsigned int stack_count = 0;
+static char names[PROFILE_NAMES_SIZE];
+static size_t names_used = 0;
+static unsigned long dropped = 0;
+
+
+static bool in_code_ranges(uintptr_t address) {
+  for (int i = 0; i < code_range_count; ++i) {
+    if (address >= code_ranges[i].start && address < code_ranges[i].end) return true;
+  }
+  return false;
+}
+
+
+static void catch_vtalrm(int sig, siginfo_t *info, void *context) {
+  /*
+    Signal handler for the profiling timer. It only counts the sample, by where the program
+    was interrupted, and leaves walking the Lua stack to the interrupt hook.
+  */
+  (void) sig;
+  (void) info;
+  int errno_save = errno;
+  uintptr_t pc = ((ucontext_t *) context)->uc_mcontext.gregs[REG_RIP];
+  atomic_fetch_add(in_code_ranges(pc) ? &due_interpreted : &due_compiled, 1);
+  interrupt_request(INTERRUPT_PROFILE);
+  errno = errno_save;
+}
+
+
+static int add_code_ranges(struct dl_phdr_info *info, size_t size, void *data) {
+  (void) size;
+  (void) data;
+  for (int i = 0; i < info->dlpi_phnum; ++i) {
+    const ElfW(Phdr) *header = &info->dlpi_phdr[i];
+    if (header->p_type != PT_LOAD || !(header->p_flags & PF_X)) continue;
+    if (code_range_count == PROFILE_MAX_CODE_RANGES) return 1;
+    code_ranges[code_range_count].start = info->dlpi_addr + header->p_vaddr;
+    code_ranges[code_range_count].end = code_ranges[code_range_count].start + header->p_memsz;
+    ++code_range_count;
+  }
+  return 0;
+}
+
+
+int profile_open(int fd, unsigned long interval_us) {
+  profile_fd = fd;
+  if (fd == -1) return 0;
+  // The JIT compiler maps its traces later, so they are not among the ranges found now.
+  dl_iterate_phdr(&add_code_ranges, NULL);
+
+  struct sigaction action;
+  memset(&action, '\0', sizeof(action));
+  action.sa_sigaction = &catch_vtalrm;
+  action.sa_flags = SA_SIGINFO | SA_RESTART; // don't make the script's I/O fail with EINTR
+  err(sigaction(SIGVTALRM, &action, NULL), "failed to set profiler handler");
+  // The sandbox doesn't allow setting timers, so this one runs from now on.
+  struct itimerval timer;
+  timer.it_value.tv_sec = interval_us / 1000000;
+  timer.it_value.tv_usec = interval_us % 1000000;
+  timer.it_interval = timer.it_value;
+  err(setitimer(ITIMER_VIRTUAL, &timer, NULL), "failed to set profiler timer");
+  return 0;
+}
+
+
+static void add_samples(const char *text, size_t length, unsigned long samples) {
+  if (samples == 0) return;
+  uint32_t hash = 2166136261u; // FNV-1a
+  for (size_t i = 0; i < length; ++i) hash = (hash ^ (unsigned char) text[i]) * 16777619u;
+  for (uint32_t i = 0; i < PROFILE_MAX_STACKS; ++i) {
+    struct stack *stack = &stacks[(hash + i) & (PROFILE_MAX_STACKS - 1)];
+    if (stack->samples == 0) {
+      // Keep the table at most three quarters full, so probing stays short.
+      if (stack_count >= PROFILE_MAX_STACKS / 4 * 3 || length > PROFILE_NAMES_SIZE - names_used) {
+        break;
+      }
+      memcpy(names + names_used, text, length);
+      stack->hash = hash;
+      stack->offset = names_used;
+      stack->length = length;
+      names_used += length;
+      ++stack_count;
+      stack->samples = samples;
+      return;
+    }
+    if (stack->hash == hash && stack->length == length &&
+        memcmp(names + stack->offset, text, length) == 0) {
+      stack->samples += samples;
+      return;
+    }
+  }
+  dropped += samples;
+}
+
+
+struct text {
+  char data[8192];
+  size_t size;
+};
+
+
+static void append(struct text *text, const char *part) {
+  // Leave room for the compiled-code suffix.
+  size_t room = sizeof(text->data) - sizeof(PROFILE_COMPILED_SUFFIX) - text->size;
+  for (; *part != '\0' && room != 0; ++part, --room) text->data[text->size++] = *part;
+}
+
+
+// Append part of a frame, without the characters the collapsed-stack format gives a meaning.
+static void append_name(struct text *text, const char *part) {
+  size_t start = text->size;
+  append(text, part);
+  for (size_t i = start; i < text->size; ++i) {
+    if (text->data[i] == ';' || text->data[i] == '\n') text->data[i] = '_';
+  }
+}
+
+
+static void append_number(struct text *text, unsigned long value) {
+  char digits[24];
+  size_t i = sizeof(digits);
+  digits[--i] = '\0';
+  do {
+    digits[--i] = '0' + value % 10;
+    value /= 10;
+  } while (value != 0);
+  append(text, digits + i);
+}
+
+
+// Attribute the due samples to `text`, split by whether they were in compiled code.
+static void add_due_samples(struct text *text) {
+  add_samples(text->data, text->size, atomic_exchange(&due_interpreted, 0));
+  memcpy(text->data + text->size, PROFILE_COMPILED_SUFFIX, sizeof(PROFILE_COMPILED_SUFFIX) - 1);
+  add_samples(text->data, text->size + sizeof(PROFILE_COMPILED_SUFFIX) - 1,
+              atomic_exchange(&due_compiled, 0));
+}
+
+
+void profile_sample(lua_State *L) {
+  if (profile_fd == -1) return;
+  lua_Debug frames[PROFILE_MAX_DEPTH];
+  int depth = 0;
+  while (depth < PROFILE_MAX_DEPTH && lua_getstack(L, depth, &frames[depth])) ++depth;
+
+  struct text text;
+  text.size = 0;
+  append(&text, lua_pushthread(L) ? "main" : "thread");
+  lua_pop(L, 1);
+  if (depth == PROFILE_MAX_DEPTH) append(&text, ";...");
+  for (int i = depth - 1; i >= 0; --i) {
+    lua_Debug *frame = &frames[i];
+    lua_getinfo(L, "Sln", frame);
+    const char *name = frame->name;
+    if (name == NULL) name = strcmp(frame->what, "main") == 0 ? "main chunk" : "?";
+    append(&text, ";");
+    append_name(&text, name);
+    append(&text, " (");
+    append_name(&text, frame->short_src);
+    if (frame->linedefined >= 0) {
+      append(&text, ":");
+      append_number(&text, frame->linedefined);
+    }
+    append(&text, ")");
+  }
+  if (depth != 0 && frames[0].currentline >= 0) {
+    append(&text, ";");
+    append_name(&text, frames[0].short_src);
+    append(&text, ":");
+    append_number(&text, frames[0].currentline);
+  }
+  add_due_samples(&text);
+}
+
+
+void profile_mark(const char *frame) {
+  if (profile_fd == -1) return;
+  struct text text;
+  text.size = 0;
+  append_name(&text, frame);
+  add_due_samples(&text);
+}
+
+
+static void write_all(const char *data, size_t size) {
+  size_t done = 0;
+  while (done < size) {
+    ssize_t n = write(profile_fd, data + done, size - done);
+    if (n <= 0) break;
+    done += n;
+  }
+}
+
+
+// Write `frame samples` as a line, going through the same buffer as the stacks.
+static void write_line(struct text *text, const char *frame, size_t length, unsigned long samples) {
+  if (samples == 0) return;
+  if (sizeof(text->data) - text->size < length + 32) {
+    write_all(text->data, text->size);
+    text->size = 0;
+  }
+  if (sizeof(text->data) - text->size < length + 32) {
+    write_all(frame, length);
+  } else {
+    memcpy(text->data + text->size, frame, length);
+    text->size += length;
+  }
+  append(text, " ");
+  append_number(text, samples);
+  append(text, "\n");
+}
+
+
+void profile_report(void) {
+  // Only the first caller writes, whether that's the normal end of the run or a signal.
+  if (profile_fd == -1 || reported) return;
+  reported = 1;
+
+  struct text text;
+  text.size = 0;
+  for (uint32_t i = 0; i < PROFILE_MAX_STACKS; ++i) {
+    unsigned long samples = stacks[i].samples;
+    write_line(&text, names + stacks[i].offset, stacks[i].length, samples);
+  }
+  // Samples taken since the last safe point, such as all of a trace that never exited.
+  write_line(&text, "[unattributed]", strlen("[unattributed]"), atomic_load(&due_interpreted));
+  write_line(&text, "[unattributed]" PROFILE_COMPILED_SUFFIX,
+             strlen("[unattributed]" PROFILE_COMPILED_SUFFIX), atomic_load(&due_compiled));
+  write_line(&text, "[dropped]", strlen("[dropped]"), dropped);
+  write_all(text.data, text.size);
+}
@@ -0,0 +1,36 @@
+/*
+  Sampling profiler for scripts.
+  Copyright (C) 2017 Collin RM Stocks. All rights reserved.
+*/
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <luajit-2.0/lua.h>
+
+
+/*
+  Sample the script every `interval_us` of user CPU time, and write the samples to `fd` at the
+  end of the run in the collapsed-stack format flame graph tools read: one line per distinct
+  stack, frames from the root separated by ';', then the number of samples.
+
+  The root frame is "main" or "thread" (a Resumer's or coroutine's), then each function as
+  "name (source:line defined)", then the line that was running as "source:line". Samples taken
+  in compiled code have "_[j]" appended to the last frame. Compiled code doesn't run hooks, so
+  those are attributed to the stack where the trace exits to the interpreter.
+
+  Call before the sandbox is set up; -1 disables profiling. Returns 0, or 1 after printing an
+  error.
+*/
+int profile_open(int fd, unsigned long interval_us);
+
+// Take the samples that are due, from the interrupt hook.
+void profile_sample(lua_State *);
+
+// Attribute the samples that are due to `frame`, for time spent outside of any Lua code.
+void profile_mark(const char *frame);
+
+// Write the samples, once. Async-signal-safe, so the signal handlers that end a run can use it.
+void profile_report(void);
+
+#endif
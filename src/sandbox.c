@@ -7,17 +7,30 @@
 #include <sched.h>
 
 #include "sandbox.h"
+#include "interrupt.h"
+#include "output.h"
+#include "profile.h"
+#include "sandbox_filter.h"
+#include "stats.h"
 
 #include <errno.h>
-#include <seccomp.h> // libseccomp
+#include <linux/seccomp.h>
+#include <math.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/prctl.h>
 #include <sys/resource.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
 
 
 volatile bool sandbox_cpu_exceeded = false;
+static bool cpu_limited = false;
+static unsigned long cpu_budget = 0;
+static unsigned long cpu_grace = 0;
 
 
 #define err(v, msg) do { if (v) { perror(msg); return 1; } } while (0)
@@ -27,11 +40,19 @@ static void catch_xcpu(int sig) {
   /*
     Signal handler to set the sandbox_cpu_exceeded flag and update the current
     CPU limit to the hard limit. Does not report errors, since the program
-    state is unknown and IO might be unsafe.
+    state is unknown and IO might be unsafe; the stats and profile reports
+    only write out what the handlers already recorded.
   */
   (void) sig;
   int errno_save = errno;
-  sandbox_cpu_exceeded = true;
+  if (!sandbox_cpu_exceeded) {
+    sandbox_cpu_exceeded = true;
+    interrupt_request(INTERRUPT_CPU);
+  }
+  // The hard limit kills without another chance, so report everything now.
+  output_flush_from_signal();
+  stats_report("cpu");
+  profile_report();
   struct rlimit lim;
   if (!getrlimit(RLIMIT_CPU, &lim)) {
     lim.rlim_cur = lim.rlim_max;
@@ -41,12 +62,60 @@ static void catch_xcpu(int sig) {
 }
 
 
+static void catch_prof(int sig) {
+  /*
+    Signal handler for the CPU interval timer. The first expiry is the soft limit: it sets the
+    sandbox_cpu_exceeded flag and raises an error in the script at the next safe point. The
+    timer then runs once more for the grace period. Compiled traces never reach a safe point,
+    so if it expires again, the script is stopped here.
+  */
+  (void) sig;
+  int errno_save = errno;
+  if (!sandbox_cpu_exceeded) {
+    sandbox_cpu_exceeded = true;
+    interrupt_request(INTERRUPT_CPU);
+  } else {
+    static const char message[] = "CPU time limit exceeded\n";
+    output_flush_from_signal();
+    (void) !write(2, message, sizeof(message) - 1);
+    stats_report("cpu");
+    profile_report();
+    _exit(1);
+  }
+  errno = errno_save;
+}
+
+
 static void catch_sys(int sig) {
   (void) sig;
+  output_flush_from_signal();
+  stats_report("sigsys");
+  profile_report();
   exit(1);
 }
 
 
+static int start_cpu_limits(void) {
+  struct itimerval timer;
+  if (cpu_limited) {
+    // Start the interval timer enforcing the soft limit with millisecond resolution.
+    timer.it_value.tv_sec = cpu_budget / 1000;
+    timer.it_value.tv_usec = cpu_budget % 1000 * 1000;
+    timer.it_interval.tv_sec = cpu_grace / 1000;
+    timer.it_interval.tv_usec = cpu_grace % 1000 * 1000;
+    err(setitimer(ITIMER_PROF, &timer, NULL), "failed to set CPU budget timer");
+  }
+  // RLIMIT_CPU only has a resolution of seconds. It is kept as the backstop behind the timer:
+  // the soft limit falls at or after the end of the grace period, and the hard limit kills.
+  struct rlimit lim;
+  lim.rlim_cur = (cpu_budget + cpu_grace + 999) / 1000;
+  if (!cpu_limited) lim.rlim_cur = RLIM_INFINITY; // interpret zero as unlimited CPU
+  lim.rlim_max = (lim.rlim_cur == RLIM_INFINITY) ? RLIM_INFINITY : (lim.rlim_cur + 1);
+  err(setrlimit(RLIMIT_CPU, &lim), "failed to set CPU limit");
+  return 0;
+}
+
+
 int sandbox_init(const struct sandbox_settings *sandbox_settings) {
   struct sigaction action;
   // Set up signal handler for detecting reaching the soft CPU limit.
@@ -59,66 +128,62 @@ int sandbox_init(const struct sandbox_settings *sandbox_settings) {
   action.sa_handler = &catch_sys;
   err(sigaction(SIGSYS, &action, NULL), "failed to set sandbox violation exit handler");
 
+  // The soft CPU limit, in milliseconds, and how long the script gets to clean up after it.
+  cpu_budget = sandbox_settings->max_cpu_time * 1000UL;
+  cpu_grace = 1000;
+  if (sandbox_settings->max_cpu_ms != 0) {
+    cpu_budget = sandbox_settings->max_cpu_ms;
+    cpu_grace = sandbox_settings->max_cpu_ms;
+  }
+  cpu_limited = cpu_budget != 0;
+  if (cpu_limited) {
+    memset(&action, '\0', sizeof(action));
+    action.sa_handler = &catch_prof;
+    action.sa_flags = SA_RESTART; // don't make the script's I/O fail with EINTR
+    err(sigaction(SIGPROF, &action, NULL), "failed to set CPU budget handler");
+  }
+
   // Set up resource limits.
   struct rlimit lim;
   lim.rlim_cur = 0;
   lim.rlim_max = 0;
   err(setrlimit(RLIMIT_CORE, &lim), "failed to set core size limit");
-  lim.rlim_cur = sandbox_settings->max_memory;
-  if (lim.rlim_cur == 0) lim.rlim_cur = RLIM_INFINITY; // interpret zero as unlimited memory
+  // The Lua heap itself is limited exactly by the allocator. This only backstops everything
+  // else (machine code, the C heap, mapping overhead), so it is deliberately generous. Data
+  // files are already mapped and don't count against the script, so they are added on top.
+  lim.rlim_cur = sandbox_settings->max_memory * 2 + (((rlim_t) 64) << 20) +
+                 sandbox_settings->mapped_data;
+  if (sandbox_settings->max_memory == 0) lim.rlim_cur = RLIM_INFINITY; // interpret zero as unlimited memory
   lim.rlim_max = lim.rlim_cur;
   err(setrlimit(RLIMIT_AS, &lim), "failed to set memory limit");
-  lim.rlim_cur = sandbox_settings->max_cpu_time;
-  if (lim.rlim_cur == 0) lim.rlim_cur = RLIM_INFINITY; // interpret zero as unlimited CPU
-  lim.rlim_max = (lim.rlim_cur == RLIM_INFINITY) ? RLIM_INFINITY : (lim.rlim_cur + 1);
-  err(setrlimit(RLIMIT_CPU, &lim), "failed to set CPU limit");
+  // CPU time is limited per script, so with fork_scripts, only in the children.
+  if (!sandbox_settings->fork_scripts && start_cpu_limits()) return 1;
 
   // Switch to a new user namespace. This has the effect of dropping any capabilities
   // held in the parent namespace.
   err(unshare(CLONE_NEWUSER), "failed to switch to a new user namespace");
 
-  // Initialize the seccomp filter.
-  scmp_filter_ctx ctx;
-  ctx = seccomp_init(SCMP_ACT_TRAP); // send SIGSYS on violation (catchable)
-
-  // System call whitelist:
-  int any_errors = 0;
-  any_errors |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(exit), 0);
-  any_errors |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(exit_group), 0);
-  any_errors |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(rt_sigreturn), 0);
-  any_errors |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(read), 0);
-  any_errors |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(write), 0);
-  any_errors |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(brk), 0);
-  any_errors |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(mmap), 0);
-  any_errors |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(mremap), 0);
-  any_errors |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(munmap), 0);
-  any_errors |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(fstat), 0);
-  any_errors |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(mprotect), 0);
-  any_errors |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(dup), 0);
-  any_errors |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(dup2), 0);
-  any_errors |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(dup3), 0);
-  any_errors |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(fcntl), 0);
-  any_errors |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(close), 0);
-
-  // Return errors on the following system calls:
-  any_errors |= seccomp_rule_add(ctx, SCMP_ACT_ERRNO(EACCES), SCMP_SYS(access), 0);
-  any_errors |= seccomp_rule_add(ctx, SCMP_ACT_ERRNO(EACCES), SCMP_SYS(lstat), 0);
-  any_errors |= seccomp_rule_add(ctx, SCMP_ACT_ERRNO(EACCES), SCMP_SYS(open), 0);
-  any_errors |= seccomp_rule_add(ctx, SCMP_ACT_ERRNO(EACCES), SCMP_SYS(readlink), 0);
-  any_errors |= seccomp_rule_add(ctx, SCMP_ACT_ERRNO(EACCES), SCMP_SYS(stat), 0);
-
-  // Allow getting and setting RLIMIT_CPU:
-  any_errors |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(getrlimit), 1, SCMP_A0(SCMP_CMP_EQ, RLIMIT_CPU));
-  any_errors |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(setrlimit), 1, SCMP_A0(SCMP_CMP_EQ, RLIMIT_CPU));
-
-  any_errors |= seccomp_load(ctx); // apply the filter
-
-  seccomp_release(ctx); // release the memory storing the filter
-
-  if (any_errors) {
-    fputs("failed to load seccomp filter", stderr);
-    return 1;
-  }
+  // Apply the seccomp filter. Violations send SIGSYS, which is caught above.
+  const struct sock_fprog *filter = &sandbox_filter;
+  if (sandbox_settings->fork_scripts) filter = &sandbox_batch_filter;
+  err(prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0), "failed to forbid gaining privileges");
+  err(prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, filter), "failed to load seccomp filter");
 
   return 0;
 }
+
+
+int sandbox_enter_child(void) {
+  if (start_cpu_limits()) return 1;
+  err(prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &sandbox_child_filter),
+      "failed to load child seccomp filter");
+  return 0;
+}
+
+
+double sandbox_remaining_cpu(void) {
+  if (!cpu_limited) return INFINITY;
+  struct itimerval timer;
+  if (sandbox_cpu_exceeded || getitimer(ITIMER_PROF, &timer)) return 0;
+  return timer.it_value.tv_sec + timer.it_value.tv_usec / 1e6;
+}
@@ -12,10 +12,23 @@
 struct sandbox_settings {
   size_t max_memory;
   unsigned int max_cpu_time;
+  unsigned int max_cpu_ms; // Replaces max_cpu_time when nonzero.
+  bool fork_scripts;       // The sandboxed process forks a child for each script (--batch).
+  size_t mapped_data;      // Bytes of read-only files mapped before the sandbox (--data).
 };
 
 extern volatile bool sandbox_cpu_exceeded;
 
 int sandbox_init(const struct sandbox_settings *);
 
+/*
+  With fork_scripts, sandbox_init() leaves the CPU limits to the children and also allows the
+  system calls the parent needs to fork them and collect their output. Call this in each
+  child before running its script: it starts the CPU limits and takes those calls away again.
+*/
+int sandbox_enter_child(void);
+
+// CPU time in seconds left before the soft limit. Zero once it has passed, infinite if unlimited.
+double sandbox_remaining_cpu(void);
+
 #endif
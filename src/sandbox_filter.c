@@ -0,0 +1,138 @@
+/*
+  Seccomp filters for the sandbox, built at compile time.
+  Copyright (C) 2017 Collin RM Stocks. All rights reserved.
+*/
+
+#define _GNU_SOURCE
+
+#include "sandbox_filter.h"
+
+#include <errno.h>
+#include <linux/audit.h>
+#include <linux/seccomp.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <time.h>
+
+
+/*
+  The filters used to be built by libseccomp on every start. These programs make the same
+  decisions (tests/sandbox/seccomp-filter.c checks that against libseccomp), but are plain
+  constants, and check the system calls a running script makes most often first.
+
+  Every rule starts with the system call number in the accumulator and leaves it there if it
+  doesn't match. Arguments are 64 bits wide and compared in two halves.
+*/
+#if !defined(__x86_64__)
+#error "The seccomp filters are only written for x86-64."
+#endif
+
+#define X32_SYSCALL_BIT 0x40000000
+
+#define ARG_LOW(n) (offsetof(struct seccomp_data, args) + 8 * (n))
+#define ARG_HIGH(n) (ARG_LOW(n) + 4)
+
+#define LOAD(offset) BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (offset))
+#define RETURN(action) BPF_STMT(BPF_RET | BPF_K, (action))
+
+#define RULE(name, action) \
+  BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, __NR_##name, 0, 1), \
+  RETURN(action)
+
+#define RULE_ARG(name, n, value, action) \
+  BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, __NR_##name, 0, 6), \
+  LOAD(ARG_HIGH(n)), \
+  BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (uint32_t) ((uint64_t) (value) >> 32), 0, 3), \
+  LOAD(ARG_LOW(n)), \
+  BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (uint32_t) (value), 0, 1), \
+  RETURN(action), \
+  LOAD(offsetof(struct seccomp_data, nr))
+
+#define ALLOW SECCOMP_RET_ALLOW
+#define DENY(error) (SECCOMP_RET_ERRNO | (error))
+
+// Kill outright if the call comes from another ABI, whose numbers mean other calls.
+#define CHECK_ARCHITECTURE \
+  LOAD(offsetof(struct seccomp_data, arch)), \
+  BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, AUDIT_ARCH_X86_64, 1, 0), \
+  RETURN(SECCOMP_RET_KILL), \
+  LOAD(offsetof(struct seccomp_data, nr)), \
+  BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, X32_SYSCALL_BIT, 0, 1), \
+  RETURN(SECCOMP_RET_KILL)
+
+#define SANDBOX_RULES \
+  /* The calls a running script makes all the time. */ \
+  RULE(read, ALLOW), \
+  RULE(write, ALLOW), \
+  RULE(writev, ALLOW), /* flushing the output buffer, see output.h */ \
+  RULE(mmap, ALLOW), \
+  RULE(munmap, ALLOW), \
+  RULE(brk, ALLOW), \
+  RULE(mremap, ALLOW), \
+  RULE(mprotect, ALLOW), \
+  RULE_ARG(ppoll, 3, 0, ALLOW), /* waiting for file descriptors, without a signal mask */ \
+  RULE(rt_sigreturn, ALLOW), \
+  RULE(fstat, ALLOW), \
+  RULE(fcntl, ALLOW), \
+  RULE(close, ALLOW), \
+  RULE(dup, ALLOW), \
+  RULE(dup2, ALLOW), \
+  RULE(dup3, ALLOW), \
+  RULE(exit, ALLOW), \
+  RULE(exit_group, ALLOW), \
+  /* Only RLIMIT_CPU, raised to the hard limit when the soft one runs out. */ \
+  RULE_ARG(getrlimit, 0, RLIMIT_CPU, ALLOW), \
+  RULE_ARG(setrlimit, 0, RLIMIT_CPU, ALLOW), \
+  /* The CPU budget timer, resource usage and the clock, for sandbox.* and --stats-fd. */ \
+  RULE_ARG(getitimer, 0, ITIMER_PROF, ALLOW), \
+  RULE_ARG(getrusage, 0, RUSAGE_SELF, ALLOW), \
+  RULE_ARG(clock_gettime, 0, CLOCK_MONOTONIC, ALLOW), \
+  /* File system access fails instead of killing the script. */ \
+  RULE(access, DENY(EACCES)), \
+  RULE(lstat, DENY(EACCES)), \
+  RULE(open, DENY(EACCES)), \
+  RULE(readlink, DENY(EACCES)), \
+  RULE(stat, DENY(EACCES))
+
+#define BATCH_PARENT_RULES \
+  RULE(clone, ALLOW), \
+  RULE(set_robust_list, ALLOW), \
+  RULE(wait4, ALLOW), \
+  RULE(pipe2, ALLOW), \
+  RULE_ARG(setitimer, 0, ITIMER_PROF, ALLOW), \
+  RULE_ARG(prctl, 0, PR_SET_SECCOMP, ALLOW)
+
+
+static const struct sock_filter sandbox_program[] = {
+  CHECK_ARCHITECTURE,
+  SANDBOX_RULES,
+  RETURN(SECCOMP_RET_TRAP),
+};
+
+static const struct sock_filter sandbox_batch_program[] = {
+  CHECK_ARCHITECTURE,
+  SANDBOX_RULES,
+  BATCH_PARENT_RULES,
+  RETURN(SECCOMP_RET_TRAP),
+};
+
+static const struct sock_filter sandbox_child_program[] = {
+  CHECK_ARCHITECTURE,
+  RULE(clone, SECCOMP_RET_TRAP),
+  RULE(wait4, SECCOMP_RET_TRAP),
+  RULE(pipe2, SECCOMP_RET_TRAP),
+  RULE(setitimer, SECCOMP_RET_TRAP),
+  RULE(prctl, SECCOMP_RET_TRAP),
+  RETURN(SECCOMP_RET_ALLOW),
+};
+
+
+#define PROGRAM(program) { sizeof(program) / sizeof(program[0]), (struct sock_filter *) program }
+
+const struct sock_fprog sandbox_filter = PROGRAM(sandbox_program);
+const struct sock_fprog sandbox_batch_filter = PROGRAM(sandbox_batch_program);
+const struct sock_fprog sandbox_child_filter = PROGRAM(sandbox_child_program);
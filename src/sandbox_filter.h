@@ -0,0 +1,25 @@
+/*
+  Seccomp filters for the sandbox, built at compile time.
+  Copyright (C) 2017 Collin RM Stocks. All rights reserved.
+*/
+
+#ifndef SANDBOX_FILTER_H
+#define SANDBOX_FILTER_H
+
+#include <linux/filter.h>
+
+
+/*
+  Ready to install with prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, ...), after
+  PR_SET_NO_NEW_PRIVS.
+
+  sandbox_filter: what a script may do. Anything else raises SIGSYS.
+  sandbox_batch_filter: sandbox_filter, plus what a --batch parent needs to fork children
+    and collect their output.
+  sandbox_child_filter: stacked on sandbox_batch_filter in each child, to take that away again.
+*/
+extern const struct sock_fprog sandbox_filter;
+extern const struct sock_fprog sandbox_batch_filter;
+extern const struct sock_fprog sandbox_child_filter;
+
+#endif
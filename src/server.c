@@ -0,0 +1,264 @@
+/*
+  Pre-forked server mode.
+  Copyright (C) 2017 Collin RM Stocks. All rights reserved.
+*/
+
+#define _GNU_SOURCE
+
+#include "server.h"
+#include "allocator.h"
+#include "bytecode_cache.h"
+#include "luajit_wrapper.h"
+#include "output.h"
+#include "sandbox.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+
+#define CHUNK_SIZE (65536)
+
+
+#define err(v, msg) do { if (v) { perror(msg); return 1; } } while (0)
+
+
+static char frame_buffer[sizeof(struct server_frame) + CHUNK_SIZE];
+
+
+ssize_t server_read_full(int fd, void *buffer, size_t size) {
+  // Like read(), but only returns a short count at end of file.
+  size_t done = 0;
+  while (done < size) {
+    ssize_t n = read(fd, (char *) buffer + done, size - done);
+    if (n == -1 && errno == EINTR) continue;
+    if (n == -1) return -1;
+    if (n == 0) break;
+    done += n;
+  }
+  return done;
+}
+
+
+int server_write_full(int fd, const void *buffer, size_t size) {
+  size_t done = 0;
+  while (done < size) {
+    ssize_t n = write(fd, (const char *) buffer + done, size - done);
+    if (n == -1 && errno == EINTR) continue;
+    if (n == -1) return -1;
+    done += n;
+  }
+  return 0;
+}
+
+
+static int send_frame(uint32_t id, uint32_t type, uint32_t length) {
+  /*
+    Write a frame whose payload has already been placed in frame_buffer, after room for the
+    header. Header and payload go out in a single write, so frames are never interleaved.
+  */
+  struct server_frame frame;
+  memset(&frame, '\0', sizeof(frame));
+  frame.id = id;
+  frame.type = type;
+  frame.length = length;
+  memcpy(frame_buffer, &frame, sizeof(frame));
+  return server_write_full(1, frame_buffer, sizeof(frame) + length);
+}
+
+
+static int spool_script(uint32_t length) {
+  // Copy the script from stdin into an anonymous file the child can read with load_fd().
+  int script = memfd_create("script", MFD_CLOEXEC);
+  if (script == -1) {
+    perror("failed to create script file");
+    return -1;
+  }
+  while (length > 0) {
+    size_t chunk = length < CHUNK_SIZE ? length : CHUNK_SIZE;
+    ssize_t n = server_read_full(0, frame_buffer, chunk);
+    if (n != (ssize_t) chunk || server_write_full(script, frame_buffer, chunk)) {
+      fputs("failed to read script from request\n", stderr);
+      close(script);
+      return -1;
+    }
+    length -= chunk;
+  }
+  if (lseek(script, 0, SEEK_SET) == -1) {
+    perror("failed to rewind script file");
+    close(script);
+    return -1;
+  }
+  return script;
+}
+
+
+static void run_child(lua_State *L, const struct server_request *request, int script,
+                      const struct server_settings *settings) {
+  // Runs in the forked child and never returns.
+  signal(SIGPIPE, SIG_DFL);
+  if (output_open(settings->output_limit)) exit(1);
+
+  struct luajit_wrapper_script wrapper_script;
+  wrapper_script.fd = script;
+  wrapper_script.buffer = NULL;
+  wrapper_script.size = 0;
+  // Compiling on a cache miss happens here, in the child, so the server never parses scripts.
+  if (settings->cache_dir != NULL) {
+    if (bytecode_cache_load(settings->cache_dir, &wrapper_script)) exit(1);
+  }
+
+  struct sandbox_settings sandbox_settings;
+  sandbox_settings.max_memory = request->max_memory;
+  sandbox_settings.max_cpu_time = request->max_cpu_time;
+  sandbox_settings.max_cpu_ms = request->max_cpu_ms;
+  sandbox_settings.fork_scripts = false;
+  sandbox_settings.mapped_data = settings->mapped_data;
+  if (sandbox_init(&sandbox_settings)) exit(1);
+  allocator_set_limit(request->max_memory);
+
+  exit(luajit_wrapper_run(L, &wrapper_script) ? 1 : 0);
+}
+
+
+pid_t server_fork_job(struct server_job *job, uint32_t id, int devnull, bool err_to_stdout) {
+  int stdout_pipe[2], stderr_pipe[2];
+  if (pipe2(stdout_pipe, O_CLOEXEC) == -1) {
+    perror("failed to create output pipe");
+    return -1;
+  }
+  if (pipe2(stderr_pipe, O_CLOEXEC) == -1) {
+    perror("failed to create output pipe");
+    close(stdout_pipe[0]);
+    close(stdout_pipe[1]);
+    return -1;
+  }
+
+  job->id = id;
+  job->pid = fork();
+  if (job->pid == 0) {
+    // The child gets its own output pipes and /dev/null as stdin, so it can neither read
+    // other requests nor write frames.
+    if (dup2(devnull, 0) == -1 || dup2(stdout_pipe[1], 1) == -1 ||
+        dup2(err_to_stdout ? stdout_pipe[1] : stderr_pipe[1], 2) == -1) {
+      _exit(1);
+    }
+    close(devnull);
+    close(stdout_pipe[0]);
+    close(stdout_pipe[1]);
+    close(stderr_pipe[0]);
+    close(stderr_pipe[1]);
+    return 0;
+  }
+
+  close(stdout_pipe[1]);
+  close(stderr_pipe[1]);
+  job->output[0] = stdout_pipe[0];
+  job->output[1] = stderr_pipe[0];
+  if (job->pid == -1) {
+    perror("failed to fork");
+    close(job->output[0]);
+    close(job->output[1]);
+  }
+  return job->pid;
+}
+
+
+static int start_job(struct server_job *job, lua_State *L, const struct server_request *request,
+                     int devnull, const struct server_settings *settings) {
+  int script = spool_script(request->script_length);
+  if (script == -1) return 1;
+  pid_t pid = server_fork_job(job, request->id, devnull, settings->err_to_stdout);
+  if (pid == 0) run_child(L, request, script, settings);
+  close(script);
+  return pid == -1;
+}
+
+
+int server_finish_job(struct server_job *job) {
+  // Forward the child's output as frames until both pipes close, then report how it exited.
+  static const uint32_t types[2] = { SERVER_FRAME_STDOUT, SERVER_FRAME_STDERR };
+  int error = 0;
+
+  while (job->output[0] != -1 || job->output[1] != -1) {
+    struct pollfd fds[2];
+    for (int i = 0; i < 2; ++i) {
+      fds[i].fd = job->output[i]; // poll() ignores negative descriptors.
+      fds[i].events = POLLIN;
+      fds[i].revents = 0;
+    }
+    if (ppoll(fds, 2, NULL, NULL) == -1) { // no signal mask, so batch mode's sandbox allows it
+      if (errno == EINTR) continue;
+      perror("failed to wait for script output");
+      return 1;
+    }
+    for (int i = 0; i < 2; ++i) {
+      if (fds[i].revents == 0) continue;
+      ssize_t n = read(job->output[i], frame_buffer + sizeof(struct server_frame), CHUNK_SIZE);
+      if (n == -1 && errno == EINTR) continue;
+      if (n <= 0) {
+        close(job->output[i]);
+        job->output[i] = -1;
+        continue;
+      }
+      if (!error && send_frame(job->id, types[i], n)) {
+        perror("failed to write response");
+        error = 1; // Keep draining so the child is not blocked on a full pipe.
+      }
+    }
+  }
+
+  int status;
+  while (waitpid(job->pid, &status, 0) == -1) {
+    if (errno != EINTR) {
+      perror("failed to wait for script");
+      return 1;
+    }
+  }
+  int32_t exit_code = WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+  memcpy(frame_buffer + sizeof(struct server_frame), &exit_code, sizeof(exit_code));
+  if (!error && send_frame(job->id, SERVER_FRAME_EXIT, sizeof(exit_code))) {
+    perror("failed to write response");
+    error = 1;
+  }
+  return error;
+}
+
+
+int server_run(const struct server_settings *settings) {
+  // A client hanging up should surface as a write error rather than killing the server.
+  signal(SIGPIPE, SIG_IGN);
+
+  int devnull = open("/dev/null", O_RDONLY | O_CLOEXEC);
+  err(devnull == -1, "failed to open /dev/null");
+
+  // Everything up to here is paid once; every request starts from a copy of this state.
+  lua_State *L = luajit_wrapper_new_state();
+  if (L == NULL) return 1;
+
+  while (1) {
+    struct server_request request;
+    ssize_t n = server_read_full(0, &request, sizeof(request));
+    err(n == -1, "failed to read request");
+    if (n == 0) break; // Clean end of input.
+    if (n != sizeof(request)) {
+      fputs("truncated request header\n", stderr);
+      return 1;
+    }
+
+    struct server_job job;
+    if (start_job(&job, L, &request, devnull, settings)) return 1;
+    if (server_finish_job(&job)) return 1;
+  }
+
+  allocator_close(L);
+  close(devnull);
+  return 0;
+}
@@ -0,0 +1,86 @@
+/*
+  Pre-forked server mode.
+  Copyright (C) 2017 Collin RM Stocks. All rights reserved.
+*/
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+
+/*
+  Wire format. All integers are in host byte order, since both ends of the pipe or socket
+  are expected to live on the same machine.
+
+  Each request is a `struct server_request` followed by `script_length` bytes of Lua
+  source. Each request produces any number of SERVER_FRAME_STDOUT and SERVER_FRAME_STDERR
+  frames followed by exactly one SERVER_FRAME_EXIT frame, all tagged with the request's id.
+  A `struct server_frame` header is followed by `length` bytes of payload.
+*/
+struct server_request {
+  uint32_t id;            // Echoed back in every response frame.
+  uint32_t script_length; // Number of bytes of Lua source following this header.
+  uint64_t max_memory;    // Bytes. Zero means unlimited.
+  uint32_t max_cpu_time;  // Seconds. Zero means unlimited.
+  uint32_t max_cpu_ms;    // Milliseconds. Replaces max_cpu_time when nonzero.
+};
+// max_cpu_ms used to be a reserved field that had to be zero, so older clients still get
+// max_cpu_time. The header has no reserved fields left to check.
+
+enum server_frame_type {
+  SERVER_FRAME_STDOUT = 1, // Payload: bytes written by the script to stdout.
+  SERVER_FRAME_STDERR = 2, // Payload: bytes written by the script to stderr.
+  SERVER_FRAME_EXIT = 3,   // Payload: int32_t exit code, or 128 + signal number if killed.
+};
+
+struct server_frame {
+  uint32_t id;
+  uint32_t type;
+  uint32_t length;
+  uint32_t reserved;
+};
+
+
+struct server_settings {
+  bool err_to_stdout;
+  const char *cache_dir; // NULL to disable the bytecode cache.
+  size_t mapped_data;    // See struct sandbox_settings.
+  size_t output_limit;   // Bytes of output per script, zero for no limit (see output.h).
+};
+
+
+/*
+  Read requests from stdin and write response frames to stdout until stdin is closed.
+  A Lua state is initialized once, before any request is read, and every request runs
+  in a forked copy of it inside a freshly initialized sandbox.
+*/
+int server_run(const struct server_settings *);
+
+
+/*
+  A forked child whose output is forwarded as frames tagged with `id`. Also used by batch
+  mode (see batch.h).
+*/
+struct server_job {
+  uint32_t id;
+  pid_t pid;
+  int output[2]; // Read ends of the child's stdout and stderr pipes, or -1 once closed.
+};
+
+/*
+  Like fork(), but in the child, stdin is `devnull` and stdout and stderr are the job's pipes.
+  Returns 0 in the child, the child's pid in the parent, or -1 after printing an error.
+*/
+pid_t server_fork_job(struct server_job *, uint32_t id, int devnull, bool err_to_stdout);
+
+// Forward the job's output as frames until it exits, then send its SERVER_FRAME_EXIT frame.
+int server_finish_job(struct server_job *);
+
+// Like read() and write(), but retry on EINTR and short counts. Reads are only short at EOF.
+ssize_t server_read_full(int fd, void *, size_t);
+int server_write_full(int fd, const void *, size_t);
+
+#endif
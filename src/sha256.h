@@ -0,0 +1,24 @@
+/*
+  SHA-256 message digest.
+  Copyright (C) 2017 Collin RM Stocks. All rights reserved.
+*/
+
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_SIZE (32)
+
+struct sha256 {
+  uint32_t state[8];
+  uint64_t length; // Total bytes hashed so far.
+  unsigned char block[64];
+};
+
+void sha256_init(struct sha256 *);
+void sha256_update(struct sha256 *, const void *, size_t);
+void sha256_final(struct sha256 *, unsigned char digest[SHA256_DIGEST_SIZE]);
+
+#endif
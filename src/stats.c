@@ -0,0 +1,281 @@
+/*
+  Per-run resource and VM statistics.
+  Copyright (C) 2017 Collin RM Stocks. All rights reserved.
+*/
+
+#define _GNU_SOURCE
+
+#include "stats.h"
+#include "allocator.h"
+#include "c-runtime/resumer.h"
+
+#include <luajit-2.0/lauxlib.h>
+#include <luajit-2.0/lualib.h>
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#define GC_SENTINEL_METATABLE "stats.gc_sentinel"
+
+
+static int stats_fd = -1;
+static volatile sig_atomic_t reported = 0;
+static struct timespec phase_times[STATS_DONE + 1];
+static volatile sig_atomic_t last_phase = -1;
+static unsigned long gc_cycles = 0;
+static unsigned long jit_traces = 0;
+static unsigned long jit_aborts = 0;
+static unsigned long jit_flushes = 0;
+static uint64_t jit_mcode_bytes = 0;
+
+/*
+  Why traces were aborted, as the error numbers of TREDEF in LuaJIT 2.0's lj_traceerr.h, with
+  the detail left out of the messages that have any. The last slot counts anything else, such
+  as errors that aren't trace errors.
+*/
+static const char *const jit_abort_reasons[] = {
+  "error thrown or hook called during recording", "trace too long", "trace too deep",
+  "too many snapshots", "blacklisted", "NYI: bytecode",
+  "leaving loop in root trace", "inner loop in root trace", "loop unroll limit reached",
+  "bad argument type", "JIT compilation disabled for function", "call unroll limit reached",
+  "down-recursion, restarting", "NYI: C function", "NYI: FastFunc",
+  "NYI: unsupported variant of FastFunc", "NYI: return to lower frame",
+  "store with nil or NaN key", "missing metamethod", "looping index lookup",
+  "NYI: mixed sparse/dense table",
+  "symbol not in cache", "NYI: unsupported C type conversion", "NYI: unsupported C function type",
+  "guard would always fail", "too many PHIs", "persistent type instability",
+  "failed to allocate mcode memory", "machine code too long", "hit mcode limit (retrying)",
+  "too many spill slots", "inconsistent register allocation", "NYI: cannot assemble IR instruction",
+  "NYI: PHI shuffling too complex", "NYI: register coalescing too complex",
+  "other"
+};
+
+#define JIT_ABORT_REASONS (sizeof(jit_abort_reasons) / sizeof(*jit_abort_reasons))
+
+static unsigned long jit_aborts_by_reason[JIT_ABORT_REASONS];
+
+
+/*
+  A userdata that nothing refers to, whose finalizer counts a finished GC cycle and makes the
+  next one.
+*/
+static void new_gc_sentinel(lua_State *L) {
+  lua_newuserdata(L, 1);
+  luaL_getmetatable(L, GC_SENTINEL_METATABLE);
+  lua_setmetatable(L, -2);
+  lua_pop(L, 1);
+}
+
+
+static int gc_sentinel_gc(lua_State *L) {
+  ++gc_cycles;
+  new_gc_sentinel(L);
+  return 0;
+}
+
+
+/*
+  Handler for jit.attach(f, "trace"), which only runs while the JIT compiler is busy anyway.
+  Called with what happened, the trace number, and for an abort, the error number as the fifth
+  argument. Upvalue 1 is jit.util.tracemc().
+*/
+static int jit_trace_event(lua_State *L) {
+  const char *what = lua_tostring(L, 1);
+  if (what == NULL) return 0;
+  if (!strcmp(what, "stop")) {
+    ++jit_traces;
+    // The trace's machine code, as a string. Only its length is wanted.
+    lua_pushvalue(L, lua_upvalueindex(1));
+    lua_pushvalue(L, 2);
+    if (!lua_pcall(L, 1, 1, 0)) jit_mcode_bytes += lua_objlen(L, -1);
+  } else if (!strcmp(what, "abort")) {
+    ++jit_aborts;
+    size_t reason = JIT_ABORT_REASONS - 1;
+    if (lua_type(L, 5) == LUA_TNUMBER && lua_tointeger(L, 5) >= 0 &&
+        (size_t) lua_tointeger(L, 5) < JIT_ABORT_REASONS - 1) {
+      reason = lua_tointeger(L, 5);
+    }
+    ++jit_aborts_by_reason[reason];
+  } else if (!strcmp(what, "flush")) {
+    ++jit_flushes;
+  }
+  return 0;
+}
+
+
+void stats_open(int fd) {
+  stats_fd = fd;
+}
+
+
+void stats_attach(lua_State *L) {
+  if (stats_fd == -1) return;
+  luaL_newmetatable(L, GC_SENTINEL_METATABLE);
+  lua_pushcfunction(L, &gc_sentinel_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_pop(L, 1);
+  new_gc_sentinel(L);
+
+  // Without trace events, the counts stay zero.
+  lua_getglobal(L, "jit");
+  lua_getfield(L, LUA_REGISTRYINDEX, "_LOADED");
+  lua_getfield(L, -1, LUA_JITLIBNAME ".util"); // stack: jit, _LOADED, jit.util
+  if (lua_istable(L, -3) && lua_istable(L, -1)) {
+    lua_getfield(L, -3, "attach");
+    lua_getfield(L, -2, "tracemc"); // stack: jit, _LOADED, jit.util, attach, tracemc
+    lua_pushcclosure(L, &jit_trace_event, 1);
+    lua_pushliteral(L, "trace");
+    if (lua_pcall(L, 2, 0, 0)) lua_pop(L, 1);
+  }
+  lua_pop(L, 3);
+}
+
+
+void stats_phase(enum stats_phase phase) {
+  clock_gettime(CLOCK_MONOTONIC, &phase_times[phase]);
+  last_phase = phase;
+}
+
+
+// Closes the abort reasons, if they fit, then the record, so it is always left room.
+#define RECORD_END "}}\n"
+
+/*
+  Big enough for every counter and every abort reason at 20 digits each, about 2.4 KB. An
+  entry that doesn't fit anyway is dropped whole, so the record always stays valid JSON.
+*/
+struct record {
+  char data[4096];
+  size_t size;
+  bool full; // Part of the current entry didn't fit.
+};
+
+
+static void append(struct record *record, const char *text) {
+  size_t length = strlen(text);
+  if (length > sizeof(record->data) - (sizeof(RECORD_END) - 1) - record->size) {
+    record->full = true;
+    return;
+  }
+  memcpy(record->data + record->size, text, length);
+  record->size += length;
+}
+
+
+// Finish the entry that started at `start`, dropping it unless it all fit. Returns whether it did.
+static bool end_entry(struct record *record, size_t start) {
+  bool kept = !record->full;
+  if (!kept) record->size = start;
+  record->full = false;
+  return kept;
+}
+
+
+static void append_digits(struct record *record, uint64_t value) {
+  char digits[24];
+  size_t i = sizeof(digits);
+  digits[--i] = '\0';
+  do {
+    digits[--i] = '0' + value % 10;
+    value /= 10;
+  } while (value != 0);
+  append(record, digits + i);
+}
+
+
+static void append_number(struct record *record, const char *name, uint64_t value) {
+  size_t start = record->size;
+  append(record, ",\"");
+  append(record, name);
+  append(record, "\":");
+  append_digits(record, value);
+  end_entry(record, start);
+}
+
+
+static uint64_t microseconds_between(const struct timespec *start, const struct timespec *end) {
+  int64_t us = (int64_t) (end->tv_sec - start->tv_sec) * 1000000 +
+               (end->tv_nsec - start->tv_nsec) / 1000;
+  return us > 0 ? us : 0;
+}
+
+
+static uint64_t timeval_microseconds(const struct timeval *time) {
+  return (uint64_t) time->tv_sec * 1000000 + time->tv_usec;
+}
+
+
+void stats_report(const char *outcome) {
+  // Only the first caller writes, whether that's the normal end of the run or a signal.
+  if (stats_fd == -1 || reported) return;
+  reported = 1;
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  uint64_t load_us = 0;
+  uint64_t run_us = 0;
+  int phase = last_phase;
+  if (phase >= STATS_LOADING) {
+    load_us = microseconds_between(&phase_times[STATS_LOADING],
+                                   phase >= STATS_RUNNING ? &phase_times[STATS_RUNNING] : &now);
+  }
+  if (phase >= STATS_RUNNING) {
+    run_us = microseconds_between(&phase_times[STATS_RUNNING],
+                                  phase >= STATS_DONE ? &phase_times[STATS_DONE] : &now);
+  }
+  struct rusage usage;
+  memset(&usage, '\0', sizeof(usage));
+  getrusage(RUSAGE_SELF, &usage);
+
+  struct record record;
+  record.size = 0;
+  record.full = false;
+  append(&record, "{\"outcome\":\"");
+  append(&record, outcome);
+  append(&record, "\"");
+  append_number(&record, "user_us", timeval_microseconds(&usage.ru_utime));
+  append_number(&record, "sys_us", timeval_microseconds(&usage.ru_stime));
+  append_number(&record, "max_rss_kb", usage.ru_maxrss);
+  append_number(&record, "load_us", load_us);
+  append_number(&record, "run_us", run_us);
+  append_number(&record, "heap_allocated_bytes", allocator_stats.total);
+  append_number(&record, "heap_peak_bytes", allocator_stats.peak);
+  append_number(&record, "heap_failures", allocator_stats.failures);
+  append_number(&record, "gc_cycles", gc_cycles);
+  append_number(&record, "resumer_switches", cr_resumer_stats.switches);
+  append_number(&record, "threads_created", cr_resumer_stats.threads_created);
+  append_number(&record, "resumer_gc_steps", cr_resumer_stats.gc_steps);
+  append_number(&record, "jit_traces", jit_traces);
+  append_number(&record, "jit_aborts", jit_aborts);
+  append_number(&record, "jit_flushes", jit_flushes);
+  append_number(&record, "jit_mcode_bytes", jit_mcode_bytes);
+  size_t reasons_start = record.size;
+  append(&record, ",\"jit_abort_reasons\":{");
+  bool reasons = end_entry(&record, reasons_start);
+  const char *separator = "\"";
+  for (size_t i = 0; reasons && i < JIT_ABORT_REASONS; ++i) {
+    if (jit_aborts_by_reason[i] == 0) continue;
+    size_t start = record.size;
+    append(&record, separator);
+    append(&record, jit_abort_reasons[i]);
+    append(&record, "\":");
+    append_digits(&record, jit_aborts_by_reason[i]);
+    if (end_entry(&record, start)) separator = ",\"";
+  }
+  const char *end = reasons ? RECORD_END : RECORD_END + 1;
+  memcpy(record.data + record.size, end, strlen(end));
+  record.size += strlen(end);
+
+  size_t done = 0;
+  while (done < record.size) {
+    ssize_t n = write(stats_fd, record.data + done, record.size - done);
+    if (n <= 0) break;
+    done += n;
+  }
+}
@@ -0,0 +1,34 @@
+/*
+  Per-run resource and VM statistics.
+  Copyright (C) 2017 Collin RM Stocks. All rights reserved.
+*/
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <luajit-2.0/lua.h>
+
+
+enum stats_phase {
+  STATS_LOADING,
+  STATS_RUNNING,
+  STATS_DONE,
+};
+
+
+/*
+  Write a report to `fd` at the end of the run. Call before the sandbox is set up; -1 (the
+  default) disables reporting. Counters that cost something to maintain are only attached to a
+  state while reporting is enabled.
+*/
+void stats_open(int fd);
+void stats_attach(lua_State *);
+void stats_phase(enum stats_phase);
+
+/*
+  Write the report, once: a single line of JSON with `outcome` and all the statistics.
+  Async-signal-safe, so the signal handlers that end a run can use it.
+*/
+void stats_report(const char *outcome);
+
+#endif
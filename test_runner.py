@@ -4,6 +4,7 @@ import argparse
 from collections import defaultdict
 import difflib
 import os
+import re
 import shlex
 import subprocess
 import sys
@@ -181,6 +182,24 @@ class DiffTestRunner(TestRunnerBase):
             for line in diff
         )
 
+    @staticmethod
+    def matches(reference_output, output):
+        # A reference line starting with '~ ' is a regular expression for one line of output, and
+        # one starting with '~* ' for any number of lines. Every other line must match exactly.
+        lines = reference_output.splitlines(True)
+        if not any(line.startswith(('~ ', '~* ')) for line in lines):
+            return output == reference_output
+        pattern = ''
+        for line in lines:
+            text = line.rstrip('\n')
+            if text.startswith('~ '):
+                pattern += '(?:' + text[2:] + ')' + re.escape(line[len(text):])
+            elif text.startswith('~* '):
+                pattern += '(?:(?:' + text[3:] + ')\n)*'
+            else:
+                pattern += re.escape(line)
+        return re.fullmatch(pattern, output) is not None
+
     def register_runner(self, extension, runner):
         self.__runners_by_extension[extension] = runner
 
@@ -216,7 +235,7 @@ class DiffTestRunner(TestRunnerBase):
         except FileNotFoundError:
             return 'Reference output file not found: {}'.format(reference_path)
 
-        succeeded = (output == reference_output)
+        succeeded = self.matches(reference_output, output)
 
         if not succeeded:
             self.capture_output(self.diff(reference_output, output))
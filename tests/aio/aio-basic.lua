@@ -0,0 +1,25 @@
+io.stdout:setvbuf "no"
+local scheduler = resumer.Scheduler()
+
+-- The test runner closes stdin, so this task waits (or not) until end of file.
+local reader = scheduler:spawn(function ()
+  return aio.read(0, 100)
+end)
+
+for _, name in ipairs {"a", "b"} do
+  scheduler:spawn(function ()
+    for i = 1, 3 do
+      print("wrote", aio.write(1, name .. i .. "\n"))
+      scheduler:yield()
+    end
+  end)
+end
+
+print("blocked", scheduler:run())
+print("read", scheduler:join(reader))
+
+-- Outside a task, the calls just block.
+print("wrote", aio.write(1, "outside\n"))
+print("read", aio.read(0, 100))
+local ok, message, code = aio.read(-1, 1)
+print(ok, message, code)
@@ -0,0 +1,4 @@
+--! luajit-sandbox
+print(type(channel), type(channel.open))
+print(pcall(channel.open, "missing"))
+print(pcall(channel.open))
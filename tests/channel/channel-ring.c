@@ -0,0 +1,301 @@
+/*
+  Round-trip messages through a real channel, a memfd shared with a child process that plays
+  the sandbox's side, and check what channel_ring.h does with regions and messages it must
+  not trust, and which --channel values the executable refuses. Run by `make test`, or as
+  bin/channel-ring-test [exe].
+*/
+
+#define _GNU_SOURCE
+
+#include "../../src/channel_ring.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Small enough that messages wrap around the end of the ring and senders wait for room.
+#define RING_SIZE 256
+#define MESSAGES 10000
+
+
+static int failures = 0;
+
+#define check(condition) \
+  do { \
+    if (!(condition)) { \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+      ++failures; \
+    } \
+  } while (0)
+
+
+static void fail(const char *message) {
+  perror(message);
+  exit(1);
+}
+
+
+static void *map_region(int memfd) {
+  void *mapping = mmap(NULL, channel_region_size(RING_SIZE), PROT_READ | PROT_WRITE, MAP_SHARED,
+                       memfd, 0);
+  if (mapping == MAP_FAILED) fail("mmap");
+  return mapping;
+}
+
+
+// A message of `length` bytes that depends on its number, so a misplaced byte shows.
+static uint32_t fill_message(unsigned char *message, long i) {
+  uint32_t length = (uint32_t) (i * 7 % (RING_SIZE - CHANNEL_MESSAGE_HEADER_SIZE + 1));
+  for (uint32_t j = 0; j < length; ++j) message[j] = (unsigned char) (i + j * 31);
+  message[0] = i % 3 == 0 ? 'c' : 'e'; // Counted or echoed, if there is a first byte.
+  return length;
+}
+
+
+static void sandbox_send(struct channel *channel, const void *message, uint32_t length) {
+  bool wake;
+  int sent;
+  while ((sent = channel_try_send(channel, CHANNEL_FROM_SANDBOX, message, length, &wake)) == 0) {
+    if (channel_wait_doorbell(channel)) exit(2);
+  }
+  if (sent == -1) exit(3);
+  if (wake) channel_ring_doorbell(channel);
+}
+
+
+/*
+  The sandbox's side: echo messages starting with 'e', only count the others, and once the
+  host closes its ring, reply with the count and close ours.
+*/
+static void run_sandbox(int memfd, int doorbell) {
+  struct channel channel;
+  if (!channel_attach(&channel, map_region(memfd), channel_region_size(RING_SIZE), doorbell)) {
+    exit(4);
+  }
+  unsigned char message[RING_SIZE];
+  long counted = 0;
+  while (1) {
+    const unsigned char *first, *second;
+    uint32_t first_length, second_length;
+    bool closed;
+    if (!channel_peek(&channel, CHANNEL_TO_SANDBOX, &first, &first_length,
+                      &second, &second_length, &closed)) {
+      if (closed) break;
+      if (channel_wait_doorbell(&channel)) exit(5);
+      continue;
+    }
+    uint32_t length = first_length + second_length;
+    memcpy(message, first, first_length);
+    memcpy(message + first_length, second, second_length);
+    if (channel_consume(&channel, CHANNEL_TO_SANDBOX, length)) channel_ring_doorbell(&channel);
+    if (length != 0 && message[0] == 'e') {
+      sandbox_send(&channel, message, length);
+    } else {
+      ++counted;
+    }
+  }
+  sandbox_send(&channel, &counted, sizeof(counted));
+  channel_close(&channel, CHANNEL_FROM_SANDBOX);
+  exit(0);
+}
+
+
+static void test_round_trip(void) {
+  int memfd = memfd_create("channel-ring-test", 0);
+  if (memfd == -1 || ftruncate(memfd, channel_region_size(RING_SIZE))) fail("memfd");
+  void *mapping = map_region(memfd);
+  channel_region_init(mapping, RING_SIZE);
+  int doorbell[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, doorbell)) fail("socketpair");
+  fcntl(doorbell[0], F_SETFL, O_NONBLOCK);
+  fcntl(doorbell[1], F_SETFL, O_NONBLOCK);
+
+  fflush(stdout); // Or the child prints it again when it exits.
+  pid_t pid = fork();
+  if (pid == -1) fail("fork");
+  if (pid == 0) {
+    close(doorbell[0]);
+    run_sandbox(memfd, doorbell[1]);
+  }
+  close(doorbell[1]);
+  struct channel channel;
+  check(channel_attach(&channel, mapping, channel_region_size(RING_SIZE), doorbell[0]));
+
+  // Counted messages pile up in the ring between echoes, so both sides wait for each other.
+  unsigned char message[RING_SIZE], reply[RING_SIZE];
+  long counted = 0, echoed = 0;
+  for (long i = 0; i < MESSAGES; ++i) {
+    uint32_t length = fill_message(message, i);
+    check(channel_send(&channel, message, length) == 0);
+    if (length != 0 && message[0] == 'e') {
+      check(channel_recv(&channel, reply, sizeof(reply)) == (ssize_t) length);
+      check(memcmp(reply, message, length) == 0);
+      ++echoed;
+    } else {
+      ++counted;
+    }
+  }
+  channel_close(&channel, CHANNEL_TO_SANDBOX);
+  long sandbox_counted = -1;
+  check(channel_recv(&channel, &sandbox_counted, sizeof(sandbox_counted)) ==
+        sizeof(sandbox_counted));
+  check(sandbox_counted == counted);
+  check(channel_recv(&channel, reply, sizeof(reply)) == -1);
+  int status;
+  check(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+  // With the sandbox gone, a send that has to wait for room fails instead of hanging.
+  bool wake;
+  while (channel_try_send(&channel, CHANNEL_TO_SANDBOX, message, 100, &wake) == 1) {}
+  errno = 0;
+  check(channel_send(&channel, message, 100) == -1 && errno == EPIPE);
+  printf("round trip: %ld echoed, %ld counted\n", echoed, counted);
+
+  munmap(mapping, channel_region_size(RING_SIZE));
+  close(doorbell[0]);
+  close(memfd);
+}
+
+
+static void test_untrusted(void) {
+  static union {
+    struct channel_region region;
+    unsigned char bytes[sizeof(struct channel_region) + 2 * RING_SIZE];
+  } memory;
+  struct channel_region *region = &memory.region;
+  size_t size = channel_region_size(RING_SIZE);
+  struct channel channel;
+  int doorbell[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, doorbell)) fail("socketpair");
+  fcntl(doorbell[0], F_SETFL, O_NONBLOCK);
+
+  // Regions that don't describe themselves correctly are refused.
+  channel_region_init(region, RING_SIZE);
+  check(channel_attach(&channel, region, size, doorbell[0]));
+  check(!channel_attach(&channel, region, size - 1, doorbell[0]));
+  check(!channel_attach(&channel, region, sizeof(*region) - 1, doorbell[0]));
+  region->magic ^= 1;
+  check(!channel_attach(&channel, region, size, doorbell[0]));
+  channel_region_init(region, RING_SIZE);
+  region->version = CHANNEL_VERSION + 1;
+  check(!channel_attach(&channel, region, size, doorbell[0]));
+  channel_region_init(region, RING_SIZE - 1);
+  check(!channel_attach(&channel, region, size, doorbell[0]));
+  channel_region_init(region, CHANNEL_MESSAGE_HEADER_SIZE);
+  check(!channel_attach(&channel, region, size, doorbell[0]));
+
+  // The ring size is read once: changing it in the region afterwards has no effect.
+  channel_region_init(region, RING_SIZE);
+  check(channel_attach(&channel, region, size, doorbell[0]));
+  region->ring_size = 1u << 30;
+  check(channel_max_message(&channel) == RING_SIZE - CHANNEL_MESSAGE_HEADER_SIZE);
+
+  // Messages that can't fit are refused, without touching the ring.
+  unsigned char message[RING_SIZE];
+  memset(message, 'x', sizeof(message));
+  bool wake;
+  check(channel_try_send(&channel, CHANNEL_FROM_SANDBOX, message,
+                         channel_max_message(&channel) + 1, &wake) == -1);
+  errno = 0;
+  check(channel_send(&channel, message, RING_SIZE) == -1 && errno == EMSGSIZE);
+  check(atomic_load(&region->rings[CHANNEL_FROM_SANDBOX].head) == 0);
+
+  // A message too long for the buffer is truncated, and still consumed whole.
+  check(channel_try_send(&channel, CHANNEL_FROM_SANDBOX, message, 100, &wake) == 1);
+  check(channel_try_send(&channel, CHANNEL_FROM_SANDBOX, "next", 4, &wake) == 1);
+  unsigned char reply[RING_SIZE];
+  check(channel_recv(&channel, reply, 10) == 10);
+  check(channel_recv(&channel, reply, sizeof(reply)) == 4 && memcmp(reply, "next", 4) == 0);
+
+  // A corrupt length, whether from a bug or from the other side, is clamped to the ring.
+  struct channel_ring *ring = &region->rings[CHANNEL_FROM_SANDBOX];
+  uint32_t tail = atomic_load(&ring->tail);
+  uint32_t corrupt = UINT32_MAX;
+  unsigned char *data = channel_ring_data(&channel, CHANNEL_FROM_SANDBOX);
+  for (uint32_t i = 0; i < CHANNEL_MESSAGE_HEADER_SIZE; ++i) {
+    data[(tail + i) & (RING_SIZE - 1)] = ((unsigned char *) &corrupt)[i];
+  }
+  atomic_store(&ring->head, tail + CHANNEL_MESSAGE_HEADER_SIZE);
+  const unsigned char *first = NULL, *second = NULL;
+  uint32_t first_length = 0, second_length = 0;
+  bool closed;
+  check(channel_peek(&channel, CHANNEL_FROM_SANDBOX, &first, &first_length,
+                     &second, &second_length, &closed) == 1);
+  check(first_length + second_length == channel_max_message(&channel));
+  check(first >= data && first + first_length <= data + RING_SIZE);
+  check(second == data && second_length <= RING_SIZE);
+  printf("untrusted regions and messages: checked\n");
+
+  close(doorbell[0]);
+  close(doorbell[1]);
+}
+
+
+// Run exe with `--channel <value>` on an empty script, and return its exit status, or -1.
+static int run_with_channel(const char *exe, const char *script, const char *value) {
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == -1) fail("fork");
+  if (pid == 0) {
+    int null = open("/dev/null", O_WRONLY);
+    if (null == -1 || dup2(null, 1) == -1 || dup2(null, 2) == -1) fail("dup2");
+    execl(exe, exe, "--channel", value, script, (char *) NULL);
+    fail("exec");
+  }
+  int status;
+  if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status)) return -1;
+  return WEXITSTATUS(status);
+}
+
+
+static void test_command_line(const char *exe) {
+  int memfd = memfd_create("channel-ring-test", 0);
+  if (memfd == -1 || ftruncate(memfd, channel_region_size(RING_SIZE))) fail("memfd");
+  channel_region_init(map_region(memfd), RING_SIZE);
+  int doorbell[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, doorbell)) fail("socketpair");
+  char script[] = "/tmp/channel-ring-testXXXXXX";
+  int fd = mkstemp(script);
+  if (fd == -1) fail("mkstemp");
+  close(fd);
+
+  char value[64];
+  snprintf(value, sizeof(value), "c=%d:%d", memfd, doorbell[1]);
+  check(run_with_channel(exe, script, value) == 0);
+  // argp exits with 64 for values it refuses, before anything is opened.
+  snprintf(value, sizeof(value), "c=%d", memfd);
+  check(run_with_channel(exe, script, value) == 64);
+  snprintf(value, sizeof(value), "c=%d:", memfd);
+  check(run_with_channel(exe, script, value) == 64);
+  snprintf(value, sizeof(value), "c=:%d", doorbell[1]);
+  check(run_with_channel(exe, script, value) == 64);
+  snprintf(value, sizeof(value), "=%d:%d", memfd, doorbell[1]);
+  check(run_with_channel(exe, script, value) == 64);
+  snprintf(value, sizeof(value), "c=%d:%dx", memfd, doorbell[1]);
+  check(run_with_channel(exe, script, value) == 64);
+  snprintf(value, sizeof(value), "c=%d:99999999999999999999", memfd);
+  check(run_with_channel(exe, script, value) == 64);
+  check(run_with_channel(exe, script, "c") == 64);
+  printf("command line: checked\n");
+
+  unlink(script);
+  close(doorbell[0]);
+  close(doorbell[1]);
+  close(memfd);
+}
+
+
+int main(int argc, char **argv) {
+  const char *exe = argc > 1 ? argv[1] : "bin/exe";
+  signal(SIGPIPE, SIG_IGN); // Ringing the doorbell of an exited sandbox must fail, not kill.
+  test_untrusted();
+  test_round_trip();
+  test_command_line(exe);
+  if (failures != 0) fprintf(stderr, "%d checks failed\n", failures);
+  return failures != 0;
+}
@@ -0,0 +1,41 @@
+--! luajit-sandbox
+local function hex(s)
+  return (s:gsub(".", function (c) return string.format("%02x", c:byte()) end))
+end
+
+local function dump(v)
+  if type(v) ~= "table" then return type(v) == "string" and string.format("%q", v) or tostring(v) end
+  local keys = {}
+  for k in pairs(v) do keys[#keys + 1] = k end
+  table.sort(keys, function (a, b) return tostring(a) < tostring(b) end)
+  local parts = {}
+  for _, k in ipairs(keys) do parts[#parts + 1] = "[" .. dump(k) .. "]=" .. dump(v[k]) end
+  return "{" .. table.concat(parts, ",") .. "}"
+end
+
+-- Scalars use the smallest encoding that round-trips.
+for _, v in ipairs({0, 127, 128, 65536, 2^53, -1, -33, -2^31 - 1, 0.5, -0.0, 1/0, "abc", true}) do
+  local s = codec.pack(v)
+  local u, position = codec.unpack(s)
+  print(tostring(v), hex(s), u == v, position == #s + 1)
+end
+print(hex(codec.pack(nil)), hex(codec.pack({})), hex(codec.pack({1, 2})), hex(codec.pack({a = 1})))
+
+-- Nested tables, and a stream of values.
+print(dump(codec.unpack(codec.pack({1, "two", {three = 3, [4] = {true, false}}, x = {y = "z"}}))))
+local stream = codec.pack(1) .. codec.pack("two") .. codec.pack({3})
+local position, value = 1
+while position <= #stream do
+  value, position = codec.unpack(stream, position)
+  print(dump(value), position)
+end
+
+-- Errors.
+local cycle = {}
+cycle[1] = cycle
+print(pcall(codec.pack, print))
+print(pcall(codec.pack, cycle))
+print(pcall(codec.unpack, "\146\1"))
+print(pcall(codec.unpack, "\193"))
+print(pcall(codec.unpack, "\221\255\255\255\255"))
+print(pcall(codec.unpack, "\129\192\1"))
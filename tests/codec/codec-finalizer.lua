@@ -0,0 +1,20 @@
+-- codec.pack() called from finalizers that run while another codec.pack() allocates.
+local inner = {}
+for i = 1, 200 do inner[i] = string.rep("x", i) end
+
+local function finalize()
+  assert(codec.unpack(codec.pack(inner))[200] == inner[200])
+end
+
+collectgarbage("setpause", 0)
+collectgarbage("setstepmul", 1000)
+local outer = {}
+for i = 1, 500 do outer[i] = i * 0.5 end
+local expected = codec.pack(outer)
+local same = 0
+for round = 1, 200 do
+  for i = 1, 20 do getmetatable(newproxy(true)).__gc = finalize end
+  if codec.pack(outer) == expected then same = same + 1 end
+end
+collectgarbage()
+print("same", same)
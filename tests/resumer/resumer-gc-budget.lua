@@ -0,0 +1,67 @@
+-- With a GC budget, garbage is collected between switches instead of inside the slices that
+-- allocate, and the collector's own settings come back when it is turned off.
+collectgarbage("setpause", 150)
+collectgarbage("setstepmul", 300)
+print(resumer.gc_budget(), resumer.gc_budget(500), resumer.gc_budget())
+print((pcall(resumer.gc_budget, -1)))
+print(resumer.gc_budget(0))
+
+-- Which thread each finished cycle's finalizers ran on tells where the cycle was collected.
+local inside, between = 0, 0
+local churn_thread
+local function sentinel()
+  local proxy = newproxy(true)
+  getmetatable(proxy).__gc = function ()
+    if coroutine.running() == churn_thread then inside = inside + 1 else between = between + 1 end
+    sentinel()
+  end
+end
+
+local kept = {}
+local churn
+churn = resumer.Resumer(function ()
+  churn_thread = coroutine.running()
+  while true do
+    for i = 1, 2000 do
+      local t = {i, tostring(i)}
+      if i % 100 == 0 then kept[#kept + 1] = t end
+    end
+    churn()
+  end
+end)
+churn()
+sentinel()
+
+local function run_churn()
+  inside, between = 0, 0
+  local peak = 0
+  for i = 1, 250 do
+    churn()
+    peak = math.max(peak, collectgarbage("count"))
+  end
+  return peak
+end
+
+local peak = run_churn()
+print("without a budget, collected in slices:", inside > 0 and between == 0, peak < 4096)
+resumer.gc_budget(500)
+peak = run_churn()
+print("with a budget, collected between switches:", between > inside, peak < 4096)
+print("kept", #kept)
+
+local scheduler = resumer.Scheduler()
+local sum = 0
+for n = 1, 4 do
+  scheduler:spawn(function ()
+    for i = 1, 200 do
+      local s = string.rep("x", n) .. i
+      sum = sum + #s
+      scheduler:sleep(0)
+    end
+  end)
+end
+scheduler:run()
+print("sum", sum)
+
+print(resumer.gc_budget(0), resumer.gc_budget())
+print(collectgarbage("setpause", 200), collectgarbage("setstepmul", 200))
@@ -0,0 +1,28 @@
+-- Threads of finished Resumers are reused by new ones.
+print(resumer.pool_size())
+
+local function echo(...)
+  return ...
+end
+
+for i = 1, 3 do
+  print(resumer.Resumer(echo)(i, "a", "b"))
+end
+
+-- A recycled thread starts over with its new function and an empty stack.
+local talk
+talk = resumer.Resumer(function (input)
+  local reply = talk("got " .. input)
+  return "finished with " .. reply
+end)
+print(talk "first")
+print(talk "second")
+print(resumer.Resumer(echo)())
+
+-- And with the globals as its environment, whatever its last function set.
+print(resumer.Resumer(function () setfenv(0, {}) return "replaced" end)())
+print(resumer.Resumer(function () return getfenv(0) == _G end)())
+
+print(resumer.pool_size(0))
+print(resumer.Resumer(echo)("no pool"))
+print(resumer.pool_size())
@@ -0,0 +1,40 @@
+-- Resumer threads are charged for their time and allocations, and stopped by their quotas.
+local busy, hog
+busy = resumer.Resumer(function ()
+  while true do
+    local x = 0
+    for i = 1, 2e6 do x = x + i end
+    busy()
+  end
+end)
+hog = resumer.Resumer(function ()
+  local t = {}
+  while true do
+    for i = 1, 1000 do t[#t + 1] = {i} end
+    hog()
+  end
+end)
+print(resumer.usage(busy))
+print(resumer.usage(hog))
+for i = 1, 5 do
+  busy()
+  hog()
+end
+
+local busy_ms, busy_bytes = resumer.usage(busy)
+local hog_ms, hog_bytes = resumer.usage(hog)
+print("busy ran longer than hog:", busy_ms > hog_ms)
+print("hog allocated more than busy:", hog_bytes > 100000 and busy_bytes < 10000)
+
+resumer.set_quota(hog, nil, hog_bytes + 50000)
+print(pcall(hog))
+resumer.set_quota(busy, busy_ms / 2)
+print(pcall(busy))
+
+local unlimited = resumer.Resumer(function () return #string.rep("x", 1e6) end)
+print(pcall(unlimited))
+print(pcall(resumer.usage, unlimited))
+-- A different string, since an equal one that is still alive would be reused.
+local limited = resumer.Resumer(function () return #string.rep("y", 1e6) end)
+resumer.set_quota(limited, nil, 1000)
+print(pcall(limited))
@@ -0,0 +1,16 @@
+-- Any number of values can go either way through a switch.
+local function count(...) return select("#", ...), (select(select("#", ...), ...)) end
+
+local echo
+echo = resumer.Resumer(function (...)
+  local args = {...}
+  while true do
+    args = {echo(unpack(args))}
+  end
+end)
+
+for _, n in ipairs({1, 2, 19, 20, 21, 40, 200}) do
+  local values = {}
+  for i = 1, n do values[i] = i end
+  print(n, count(echo(unpack(values))))
+end
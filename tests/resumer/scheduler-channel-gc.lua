@@ -0,0 +1,18 @@
+-- A Channel outlives the Scheduler of the tasks blocked on it.
+local inbox = resumer.Channel(1)
+local outbox = resumer.Channel(1)
+outbox:send "queued"
+
+local scheduler = resumer.Scheduler()
+scheduler:spawn(function () print("received " .. tostring(inbox:recv())) end)
+scheduler:spawn(function () outbox:send "never sent" end)
+print("blocked tasks left: " .. scheduler:run())
+
+scheduler = nil
+collectgarbage()
+collectgarbage()
+
+inbox:send "after"
+print("buffered in inbox: " .. #inbox)
+print("from outbox: " .. outbox:recv())
+print("buffered in outbox: " .. #outbox)
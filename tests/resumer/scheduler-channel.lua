@@ -0,0 +1,31 @@
+-- A three-stage pipeline connected by channels, one unbuffered and one batched.
+local scheduler = resumer.Scheduler()
+local numbers = resumer.Channel()
+local squares = resumer.Channel(4)
+
+scheduler:spawn(function ()
+  for i = 1, 5 do numbers:send(i) end
+  numbers:send_many(6, 7, 8, 9, 10)
+  numbers:close()
+  print "producer done"
+end)
+
+scheduler:spawn(function ()
+  for n in numbers.recv, numbers do
+    squares:send(n * n)
+  end
+  squares:close()
+  print "squarer done"
+end)
+
+scheduler:spawn(function ()
+  while true do
+    local batch = {squares:recv_many(3)}
+    if batch[1] == nil then break end
+    print("consumer got " .. table.concat(batch, " "))
+  end
+  print "consumer done"
+end)
+
+print("blocked tasks left: " .. scheduler:run())
+print(pcall(squares.send, squares, 1))
@@ -0,0 +1,36 @@
+-- The same scenario as resumer-threads-4.lua, with the native scheduler.
+local scheduler = resumer.Scheduler()
+
+scheduler:spawn(function ()
+  print "main_thread creating threads 1-4"
+  local thread_1, thread_2, thread_3, thread_4
+  thread_1 = scheduler:spawn(function ()
+    print "thread_1 will create a new thread and wait for it"
+    local thread_1_child = scheduler:spawn(function ()
+      print "thread_1_child just exits"
+      return "child result"
+    end)
+    print("thread_1 joined its child: " .. scheduler:join(thread_1_child))
+    print "thread_1 resumed, and will exit"
+  end)
+  thread_2 = scheduler:spawn(function ()
+    print "thread_2 will wait for thread_1"
+    scheduler:join(thread_1)
+    print "thread_2 resumed, and will exit"
+  end)
+  thread_3 = scheduler:spawn(function ()
+    print "thread_3 will wait for thread_4"
+    scheduler:join(thread_4)
+    print "thread_3 resumed, and will exit"
+  end)
+  thread_4 = scheduler:spawn(function ()
+    print "thread_4 will wait for thread_2"
+    scheduler:join(thread_2)
+    print "thread_4 resumed, and will exit"
+    return 1, 2, 3
+  end)
+  print "main_thread exiting"
+  return thread_4
+end)
+
+print("blocked tasks left: " .. scheduler:run())
@@ -0,0 +1,22 @@
+-- An error raised by Scheduler:run() itself, rather than by a task, leaves the scheduler
+-- ready to run again. Here, the finished task's 5000 results don't fit on its joiner's stack.
+local values = {}
+for i = 1, 5000 do values[i] = i end
+local s = resumer.Scheduler()
+local big
+local joiner = s:spawn(function () return select("#", s:join(big)) end)
+big = s:spawn(function () return unpack(values) end)
+print(pcall(s.run, s))
+print(s:current())
+
+-- The task that was finishing is gone, and its joiner is left waiting.
+s:spawn(function () print("runs again") end)
+print(s:run())
+
+-- Nothing refers to the collected scheduler any more.
+s, big, joiner = nil
+collectgarbage()
+collectgarbage()
+local other = resumer.Scheduler()
+other:spawn(function () other:sleep(1) print("another scheduler") end)
+print(other:run())
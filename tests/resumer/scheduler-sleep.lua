@@ -0,0 +1,31 @@
+-- Sleeping tasks wake in deadline order, and timeouts and deadlines give up on slow tasks.
+local scheduler = resumer.Scheduler()
+
+for _, ms in ipairs({60, 20, 40}) do
+  scheduler:spawn(function ()
+    scheduler:sleep(ms)
+    print("woke after " .. ms .. " ms")
+  end)
+end
+
+scheduler:spawn(function ()
+  local slow = scheduler:spawn(function ()
+    scheduler:sleep(100)
+    return "slow result"
+  end)
+  print("join with timeout:", scheduler:join(slow, 1))
+  print("join without timeout:", scheduler:join(slow))
+
+  print("with_deadline in time:", scheduler:with_deadline(50, function (a, b)
+    scheduler:sleep(1)
+    return a + b
+  end, 1, 2))
+  print("with_deadline too late:", scheduler:with_deadline(5, function ()
+    scheduler:sleep(100)
+    print "this is never printed"
+  end))
+end)
+
+print("blocked tasks left: " .. scheduler:run())
+scheduler:sleep(1)
+print "slept outside a task"
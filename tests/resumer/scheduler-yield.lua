@@ -0,0 +1,34 @@
+local scheduler = resumer.Scheduler()
+
+local function worker(name, count)
+  for i = 1, count do
+    print(name .. " " .. i)
+    scheduler:yield()
+  end
+  return name .. " finished"
+end
+
+local a = scheduler:spawn(worker, "a", 3)
+local b = scheduler:spawn(worker, "b", 2)
+
+-- Resumers still work inside tasks, and yielding from inside one suspends the whole task.
+scheduler:spawn(function ()
+  local inner
+  inner = resumer.Resumer(function (value)
+    print("inner got " .. value)
+    scheduler:yield()
+    print("inner got " .. inner "inner yielded")
+    return "inner done"
+  end)
+  print("outer got " .. inner "hello")
+  print("outer got " .. inner "world")
+end)
+
+-- Tasks that never finish are reported by run().
+local x, y
+x = scheduler:spawn(function () scheduler:join(y) end)
+y = scheduler:spawn(function () scheduler:join(x) end)
+
+print(pcall(scheduler.run, scheduler))
+print(scheduler:join(a), scheduler:join(b))
+print(pcall(scheduler.yield, scheduler))
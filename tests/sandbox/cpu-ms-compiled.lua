@@ -0,0 +1,4 @@
+--! luajit-sandbox --cpu-ms 20 --err-to-stdout
+io.stdout:setvbuf "no"
+print "this program should terminate"
+while true do end
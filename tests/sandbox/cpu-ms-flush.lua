@@ -0,0 +1,16 @@
+--! luajit-sandbox --cpu-ms 50
+-- The budget error leaves the rest of the script to the interpreter.
+io.stdout:setvbuf "no"
+local function spin()
+  local x = 0
+  for i = 1, 1e5 do x = x + i end
+  return x
+end
+for i = 1, 100 do spin() end
+print((jit.status()))
+-- Only the inner loop is compiled, so its trace exits after every call and the hook runs.
+local function forever() while true do spin() end end
+jit.off(forever)
+local ok, message = pcall(forever)
+print(ok, (message:gsub("^.-: ", "")))
+print((jit.status()))
@@ -0,0 +1,6 @@
+--! luajit-sandbox --cpu-ms 20
+io.stdout:setvbuf "no"
+jit.off() -- Hooks don't run in compiled code, which would leave only the hard limit.
+print(sandbox.cpu_exceeded(), sandbox.remaining_cpu() > 0)
+print(pcall(function () while true do end end))
+print(sandbox.cpu_exceeded(), sandbox.remaining_cpu())
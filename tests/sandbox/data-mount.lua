@@ -0,0 +1,12 @@
+--! luajit-sandbox -m 1 --data self=tests/sandbox/data-mount.lua
+-- The script mounts itself, so its own bytes are the data.
+local self = sandbox.data.self
+print(#self, self:sub(1, 3), self:sub(-8, -2), self:byte(1, 3))
+print(self:u16le(1), self:u32le(1), self:i32le(2), self:sub(1000000) == "")
+print(pcall(self.u32le, self, #self - 2))
+print(pcall(self.u16le, self, 0))
+local ffi = require("ffi")
+local p = self:pointer()
+print(p[0], p[#self - 1])
+print(sandbox.data.missing)
+-- last
@@ -0,0 +1,3 @@
+--! luajit-sandbox
+-- The test runner's environment isn't visible to scripts.
+print(os.getenv("PATH"), os.getenv("HOME"))
@@ -0,0 +1,376 @@
+/*
+  Run scripts end to end through --serve and --batch, with and without --jobs, and check the
+  frames that come back, and through --serve --cache-dir, checking what lands in the cache.
+  Also run a script whose output outpaces the reader, which only a real pipe shows.
+  Run by `make test`, or as bin/frames-test [exe].
+*/
+
+#define _GNU_SOURCE
+
+#include "../../src/server.h"
+
+#include <fcntl.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define MAX_RESULTS 8
+
+
+static int failures = 0;
+
+#define check(condition) \
+  do { \
+    if (!(condition)) { \
+      fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, test, #condition); \
+      ++failures; \
+    } \
+  } while (0)
+
+
+// Everything sent for one id. `order` is the position of its exit frame among all of them.
+struct result {
+  uint32_t id;
+  char out[256];
+  size_t out_length;
+  char err[256];
+  size_t err_length;
+  int32_t exit_code;
+  int order;
+};
+
+struct results {
+  struct result results[MAX_RESULTS];
+  int count;
+  int exits;
+  bool malformed; // A frame didn't parse, came after its id's exit frame, or came between
+                  // the frames of another id: each script's frames are written out together.
+};
+
+
+static void fail(const char *message) {
+  perror(message);
+  exit(1);
+}
+
+
+static char *write_file(const char *contents) {
+  char *path = strdup("/tmp/frames-testXXXXXX");
+  int fd = mkstemp(path);
+  if (fd == -1 || write(fd, contents, strlen(contents)) != (ssize_t) strlen(contents)) {
+    fail("failed to write a script");
+  }
+  close(fd);
+  return path;
+}
+
+
+// Run exe with `args`, feeding it `input`, and return all of its stdout in `*output`.
+static size_t run(const char *exe, const char *const *args, const void *input,
+                  size_t input_length, char **output) {
+  int to_child[2], from_child[2];
+  if (pipe(to_child) || pipe(from_child)) fail("pipe");
+  pid_t pid = fork();
+  if (pid == -1) fail("fork");
+  if (pid == 0) {
+    if (dup2(to_child[0], 0) == -1 || dup2(from_child[1], 1) == -1) fail("dup2");
+    close(to_child[1]);
+    close(from_child[0]);
+    const char *argv[16] = {exe};
+    for (int i = 0; args[i] != NULL && i < 14; ++i) argv[i + 1] = args[i];
+    execv(exe, (char **) argv);
+    fail("exec");
+  }
+  close(to_child[0]);
+  close(from_child[1]);
+  // The requests are small enough to fit in the pipe before anything is read back.
+  if (input_length != 0 && write(to_child[1], input, input_length) != (ssize_t) input_length) {
+    fail("write");
+  }
+  close(to_child[1]);
+  size_t size = 0, capacity = 4096;
+  *output = malloc(capacity);
+  ssize_t n;
+  while ((n = read(from_child[0], *output + size, capacity - size)) > 0) {
+    size += n;
+    if (size == capacity) *output = realloc(*output, capacity *= 2);
+  }
+  close(from_child[0]);
+  int status;
+  if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "%s %s did not exit cleanly\n", exe, args[0]);
+    ++failures;
+  }
+  return size;
+}
+
+
+static void append(char *buffer, size_t *length, const char *data, size_t size) {
+  size_t n = size < 255 - *length ? size : 255 - *length;
+  memcpy(buffer + *length, data, n);
+  *length += n;
+  buffer[*length] = '\0';
+}
+
+
+static void parse_frames(const char *output, size_t size, struct results *results) {
+  memset(results, '\0', sizeof(*results));
+  size_t offset = 0;
+  struct result *previous = NULL;
+  while (offset < size) {
+    struct server_frame frame;
+    if (size - offset < sizeof(frame)) break;
+    memcpy(&frame, output + offset, sizeof(frame));
+    offset += sizeof(frame);
+    if (size - offset < frame.length) break;
+    const char *payload = output + offset;
+    offset += frame.length;
+
+    struct result *result = NULL;
+    for (int i = 0; i < results->count; ++i) {
+      if (results->results[i].id == frame.id) result = &results->results[i];
+    }
+    if (result == NULL) {
+      if (results->count == MAX_RESULTS) break;
+      result = &results->results[results->count++];
+      result->id = frame.id;
+    }
+    if (result->order != 0) break; // Already exited.
+    if (previous != NULL && previous != result && previous->order == 0) break;
+    previous = result;
+    if (frame.type == SERVER_FRAME_STDOUT) {
+      append(result->out, &result->out_length, payload, frame.length);
+    } else if (frame.type == SERVER_FRAME_STDERR) {
+      append(result->err, &result->err_length, payload, frame.length);
+    } else if (frame.type == SERVER_FRAME_EXIT && frame.length == sizeof(int32_t)) {
+      memcpy(&result->exit_code, payload, sizeof(int32_t));
+      result->order = ++results->exits;
+    } else {
+      break;
+    }
+  }
+  results->malformed = offset != size;
+}
+
+
+static const struct result *find(const struct results *results, uint32_t id) {
+  for (int i = 0; i < results->count; ++i) {
+    if (results->results[i].id == id) return &results->results[i];
+  }
+  return NULL;
+}
+
+
+// Append a request for `script` to `input`, and return the new length.
+static size_t add_request(char *input, size_t input_length, uint32_t id, const char *script) {
+  struct server_request request;
+  memset(&request, '\0', sizeof(request));
+  request.id = id;
+  request.script_length = strlen(script);
+  memcpy(input + input_length, &request, sizeof(request));
+  input_length += sizeof(request);
+  memcpy(input + input_length, script, request.script_length);
+  return input_length + request.script_length;
+}
+
+
+static void test_serve(const char *exe) {
+  const char *test = "serve";
+  char input[512];
+  size_t input_length = add_request(input, 0, 7, "x = 1 print('hi', x)");
+  input_length = add_request(input, input_length, 9, "print(x) error('no')");
+
+  char *output;
+  size_t size = run(exe, (const char *const[]) {"--serve", NULL}, input, input_length, &output);
+  struct results results;
+  parse_frames(output, size, &results);
+  check(!results.malformed && results.count == 2 && results.exits == 2);
+  const struct result *hi = find(&results, 7);
+  check(hi != NULL && hi->order == 1 && hi->exit_code == 0 && strcmp(hi->out, "hi\t1\n") == 0);
+  // Each request starts from the same state, whatever the one before it did.
+  const struct result *no = find(&results, 9);
+  check(no != NULL && no->order == 2 && no->exit_code != 0 && strcmp(no->out, "nil\n") == 0 &&
+        strstr(no->err, "no") != NULL);
+  free(output);
+  printf("%s: checked\n", test);
+}
+
+
+static void test_batch(const char *exe, const char *test, const char *const *args,
+                       bool manifest_order) {
+  char *first = write_file("x = 1\nio.write('one ', x, '\\n')\n");
+  char *second = write_file("io.stderr:write('two\\n')\nerror('failed')\n");
+  char *third = write_file("print(x, ('three'):upper())\n");
+  // Blank lines are skipped, but still count for the ids.
+  char manifest_text[256];
+  snprintf(manifest_text, sizeof(manifest_text), "%s\n\n%s\n%s\n", first, second, third);
+  char *manifest = write_file(manifest_text);
+
+  const char *argv[8] = {"--batch", manifest};
+  for (int i = 0; args[i] != NULL; ++i) argv[i + 2] = args[i];
+  char *output;
+  size_t size = run(exe, argv, NULL, 0, &output);
+  struct results results;
+  parse_frames(output, size, &results);
+  check(!results.malformed && results.count == 3 && results.exits == 3);
+  const struct result *one = find(&results, 1);
+  check(one != NULL && one->exit_code == 0 && strcmp(one->out, "one 1\n") == 0 &&
+        one->err_length == 0);
+  const struct result *two = find(&results, 3);
+  check(two != NULL && two->exit_code != 0 && two->out_length == 0 &&
+        strncmp(two->err, "two\n", 4) == 0 && strstr(two->err, "failed") != NULL);
+  const struct result *three = find(&results, 4);
+  check(three != NULL && three->exit_code == 0 && strcmp(three->out, "nil\tTHREE\n") == 0);
+  if (manifest_order && one != NULL && two != NULL && three != NULL) {
+    check(one->order == 1 && two->order == 2 && three->order == 3);
+  }
+  free(output);
+  printf("%s: checked\n", test);
+
+  unlink(first);
+  unlink(second);
+  unlink(third);
+  unlink(manifest);
+  free(first);
+  free(second);
+  free(third);
+  free(manifest);
+}
+
+
+// Serve `script` alone with --cache-dir `directory`, and parse what comes back.
+static void serve_cached(const char *exe, const char *directory, const char *script,
+                         struct results *results) {
+  char input[512];
+  size_t input_length = add_request(input, 0, 1, script);
+  char *output;
+  size_t size = run(exe, (const char *const[]) {"--serve", "--cache-dir", directory, NULL},
+                    input, input_length, &output);
+  parse_frames(output, size, results);
+  free(output);
+}
+
+
+// The path of the only image in `directory`, or an empty string if there isn't exactly one.
+static void find_image(const char *directory, char *path, size_t size) {
+  DIR *dir = opendir(directory);
+  if (dir == NULL) fail("opendir");
+  int count = 0;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (entry->d_name[0] == '.') continue;
+    snprintf(path, size, "%s/%s", directory, entry->d_name);
+    ++count;
+  }
+  closedir(dir);
+  if (count != 1) path[0] = '\0';
+}
+
+
+static void test_cache(const char *exe) {
+  const char *test = "cache";
+  char directory[] = "/tmp/frames-cacheXXXXXX";
+  if (mkdtemp(directory) == NULL) fail("mkdtemp");
+  const char *script = "print(('cached'):upper(), 1 + 1)";
+  char image[512];
+  struct stat before, after;
+  struct results results;
+  const struct result *result;
+
+  // A miss compiles and publishes the image, and a hit runs it in place, with the same output.
+  serve_cached(exe, directory, script, &results);
+  result = find(&results, 1);
+  check(!results.malformed && result != NULL && result->exit_code == 0 &&
+        strcmp(result->out, "CACHED\t2\n") == 0);
+  find_image(directory, image, sizeof(image));
+  check(image[0] != '\0' && stat(image, &before) == 0);
+  serve_cached(exe, directory, script, &results);
+  result = find(&results, 1);
+  check(!results.malformed && result != NULL && result->exit_code == 0 &&
+        strcmp(result->out, "CACHED\t2\n") == 0);
+  // Publishing again would have renamed a new file into place.
+  check(stat(image, &after) == 0 && after.st_ino == before.st_ino);
+
+  // A script that doesn't compile runs from source, fails as it would without the cache, and
+  // leaves nothing behind.
+  serve_cached(exe, directory, "print('broken'", &results);
+  result = find(&results, 1);
+  check(!results.malformed && result != NULL && result->exit_code != 0 &&
+        result->out_length == 0 && strstr(result->err, "syntax error") != NULL);
+  char only[512];
+  find_image(directory, only, sizeof(only));
+  check(strcmp(only, image) == 0);
+
+  // An image with a bad magic is ignored, compiled again and replaced.
+  int fd = open(image, O_WRONLY);
+  check(fd != -1 && pwrite(fd, "bad", 3, 0) == 3);
+  close(fd);
+  serve_cached(exe, directory, script, &results);
+  result = find(&results, 1);
+  check(!results.malformed && result != NULL && result->exit_code == 0 &&
+        strcmp(result->out, "CACHED\t2\n") == 0);
+  char magic[3] = {0};
+  fd = open(image, O_RDONLY);
+  check(fd != -1 && read(fd, magic, 3) == 3 && memcmp(magic, "\033LJ", 3) == 0);
+  close(fd);
+  printf("%s: checked\n", test);
+
+  unlink(image);
+  rmdir(directory);
+}
+
+
+/*
+  aio must not leave stdout non-blocking, or the buffered output behind it drops data. And when
+  the caller hands over a non-blocking stdout, the output waits for room instead of dropping.
+*/
+static void test_slow_reader(const char *exe, const char *test, bool nonblocking) {
+  char *script = write_file("aio.write(1, 'start\\n')\n"
+                            "io.write(string.rep('x', 4 * 1024 * 1024))\n");
+  int from_child[2];
+  if (pipe(from_child)) fail("pipe");
+  if (nonblocking) fcntl(from_child[1], F_SETFL, O_NONBLOCK);
+  pid_t pid = fork();
+  if (pid == -1) fail("fork");
+  if (pid == 0) {
+    if (dup2(from_child[1], 1) == -1) fail("dup2");
+    close(from_child[0]);
+    execl(exe, exe, script, (char *) NULL);
+    fail("exec");
+  }
+  close(from_child[1]);
+  sleep(1); // Long enough for the script to fill the pipe.
+  char buffer[65536];
+  size_t size = 0;
+  ssize_t n;
+  while ((n = read(from_child[0], buffer, sizeof(buffer))) > 0) size += n;
+  close(from_child[0]);
+  int status;
+  check(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  check(size == strlen("start\n") + 4 * 1024 * 1024);
+  printf("%s: checked\n", test);
+  unlink(script);
+  free(script);
+}
+
+
+int main(int argc, char **argv) {
+  const char *exe = argc > 1 ? argv[1] : "bin/exe";
+  test_serve(exe);
+  test_cache(exe);
+  test_batch(exe, "batch", (const char *const[]) {NULL}, true);
+  test_batch(exe, "batch --jobs 2", (const char *const[]) {"--jobs", "2", NULL}, true);
+  test_batch(exe, "batch --jobs 2 --completion-order",
+             (const char *const[]) {"--jobs", "2", "--completion-order", NULL}, false);
+  // More workers than scripts, each pinned.
+  test_batch(exe, "batch --jobs 5 --pin-cpus",
+             (const char *const[]) {"--jobs", "5", "--pin-cpus", NULL}, true);
+  test_slow_reader(exe, "slow reader", false);
+  test_slow_reader(exe, "slow reader, non-blocking", true);
+  if (failures != 0) fprintf(stderr, "%d checks failed\n", failures);
+  return failures != 0;
+}
@@ -0,0 +1,6 @@
+--! luajit-sandbox --jit off,short-lived,hotloop=2,on
+-- Settings apply in order, before the script loads: a loop this short only gets a trace with a
+-- low hotloop, and the JIT compiler ends up on.
+local sum = 0
+for i = 1, 20 do sum = sum + i end
+print(sum, (jit.status()), jit.util.traceinfo(1) ~= nil)
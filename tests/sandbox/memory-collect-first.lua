@@ -0,0 +1,14 @@
+--! luajit-sandbox -m 16
+-- An allocation over the limit first gets the garbage collected out of its way.
+local garbage = {}
+for i = 1, 6 do garbage[i] = string.rep(tostring(i), 2^20) end
+garbage = nil
+local big = string.rep("x", 5 * 2^20)
+print(#big)
+-- Without enough garbage, it still fails.
+local ok, message = pcall(function ()
+  local more = string.rep("y", 6 * 2^20)
+  return #more
+end)
+print(ok, (message:gsub("^.-: ", "")))
+print(#big)
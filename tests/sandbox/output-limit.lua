@@ -0,0 +1,8 @@
+--! luajit-sandbox --output-limit 64 --err-to-stdout
+-- Output past the limit is dropped, but the script keeps running and its writes succeed.
+-- The note about it and the script's error are the sandbox's own, and always get through.
+io.stdout:setvbuf "no"
+for i = 1, 10 do print("line " .. i .. " of the output") end
+assert(io.write(string.rep("x", 1000)))
+assert(io.stderr:write("dropped as well\n"))
+error("but the error is reported", 0)
@@ -0,0 +1,8 @@
+-- Modules built into the program load from memory with require, once per state.
+local json = require "json"
+print(json == require "json", package.loaded.json == json)
+local value = json.decode('{"list": [1, 2.5, "three", null, true], "empty": []}')
+print(#value.list, value.list[3], value.list[4] == json.null, json.encode(value.empty))
+print(json.encode({1, "two", {nested = false}}))
+print(select(2, pcall(json.decode, "[1, 2")))
+print(pcall(require, "no_such_module"))
@@ -0,0 +1,13 @@
+--! luajit-sandbox --profile-fd 1 --profile-interval 1000
+-- The report follows the script's output. How the samples fall is up to the timer, but the hot
+-- stacks of both threads must be there, with the thread's root first and the line last.
+jit.off()
+local function work(n)
+  local s = 0
+  for i = 1, n do s = s + #tostring(i) end
+  return s
+end
+local r = resumer.Resumer(function(n) return work(n) end)
+print(work(300000), r(300000))
+local ok, message = pcall(error, "still raised")
+print(ok, message)
@@ -0,0 +1,206 @@
+/*
+  Check that the compiled-in seccomp filters make the same decisions as the rules they
+  replaced, as built by libseccomp. Run by `make test`.
+*/
+
+#define _GNU_SOURCE
+
+#include "../../src/sandbox_filter.h"
+
+#include <errno.h>
+#include <linux/audit.h>
+#include <linux/seccomp.h>
+#include <seccomp.h> // libseccomp
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+
+enum filter { SANDBOX, BATCH_PARENT, BATCH_CHILD };
+
+
+static scmp_filter_ctx reference_rules(enum filter filter) {
+  // The rules exactly as sandbox_init() used to hand them to libseccomp.
+  if (filter == BATCH_CHILD) {
+    scmp_filter_ctx ctx = seccomp_init(SCMP_ACT_ALLOW);
+    seccomp_rule_add(ctx, SCMP_ACT_TRAP, SCMP_SYS(clone), 0);
+    seccomp_rule_add(ctx, SCMP_ACT_TRAP, SCMP_SYS(wait4), 0);
+    seccomp_rule_add(ctx, SCMP_ACT_TRAP, SCMP_SYS(pipe2), 0);
+    seccomp_rule_add(ctx, SCMP_ACT_TRAP, SCMP_SYS(setitimer), 0);
+    seccomp_rule_add(ctx, SCMP_ACT_TRAP, SCMP_SYS(prctl), 0);
+    return ctx;
+  }
+  scmp_filter_ctx ctx = seccomp_init(SCMP_ACT_TRAP);
+  seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(exit), 0);
+  seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(exit_group), 0);
+  seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(rt_sigreturn), 0);
+  seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(read), 0);
+  seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(write), 0);
+  seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(writev), 0);
+  seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(brk), 0);
+  seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(mmap), 0);
+  seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(mremap), 0);
+  seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(munmap), 0);
+  seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(fstat), 0);
+  seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(mprotect), 0);
+  seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(dup), 0);
+  seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(dup2), 0);
+  seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(dup3), 0);
+  seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(fcntl), 0);
+  seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(close), 0);
+  seccomp_rule_add(ctx, SCMP_ACT_ERRNO(EACCES), SCMP_SYS(access), 0);
+  seccomp_rule_add(ctx, SCMP_ACT_ERRNO(EACCES), SCMP_SYS(lstat), 0);
+  seccomp_rule_add(ctx, SCMP_ACT_ERRNO(EACCES), SCMP_SYS(open), 0);
+  seccomp_rule_add(ctx, SCMP_ACT_ERRNO(EACCES), SCMP_SYS(readlink), 0);
+  seccomp_rule_add(ctx, SCMP_ACT_ERRNO(EACCES), SCMP_SYS(stat), 0);
+  seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(getrlimit), 1, SCMP_A0(SCMP_CMP_EQ, RLIMIT_CPU));
+  seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(setrlimit), 1, SCMP_A0(SCMP_CMP_EQ, RLIMIT_CPU));
+  seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(ppoll), 1, SCMP_A3(SCMP_CMP_EQ, 0));
+  seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(getitimer), 1, SCMP_A0(SCMP_CMP_EQ, ITIMER_PROF));
+  seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(getrusage), 1, SCMP_A0(SCMP_CMP_EQ, RUSAGE_SELF));
+  seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(clock_gettime), 1, SCMP_A0(SCMP_CMP_EQ, CLOCK_MONOTONIC));
+  if (filter == BATCH_PARENT) {
+    seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(clone), 0);
+    seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(set_robust_list), 0);
+    seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(wait4), 0);
+    seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(pipe2), 0);
+    seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(setitimer), 1, SCMP_A0(SCMP_CMP_EQ, ITIMER_PROF));
+    seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(prctl), 1, SCMP_A0(SCMP_CMP_EQ, PR_SET_SECCOMP));
+  }
+  return ctx;
+}
+
+
+static struct sock_fprog export_reference(enum filter filter) {
+  scmp_filter_ctx ctx = reference_rules(filter);
+  int fd = memfd_create("reference", 0);
+  struct stat info;
+  if (ctx == NULL || fd == -1 || seccomp_export_bpf(ctx, fd) || fstat(fd, &info)) {
+    fputs("failed to build the reference filter with libseccomp\n", stderr);
+    exit(1);
+  }
+  struct sock_fprog program;
+  program.len = info.st_size / sizeof(struct sock_filter);
+  program.filter = malloc(info.st_size);
+  if (program.filter == NULL || pread(fd, program.filter, info.st_size, 0) != info.st_size) {
+    perror("failed to read the reference filter");
+    exit(1);
+  }
+  close(fd);
+  seccomp_release(ctx);
+  return program;
+}
+
+
+static uint32_t run(const struct sock_fprog *program, const struct seccomp_data *data) {
+  // Just enough of a classic BPF interpreter for seccomp filters.
+  uint32_t a = 0, x = 0, memory[BPF_MEMWORDS];
+  memset(memory, '\0', sizeof(memory));
+  for (unsigned int pc = 0; pc < program->len; ++pc) {
+    const struct sock_filter *op = &program->filter[pc];
+    uint32_t operand = BPF_SRC(op->code) == BPF_X ? x : op->k;
+    switch (BPF_CLASS(op->code)) {
+      case BPF_LD:
+        if (BPF_MODE(op->code) == BPF_ABS) memcpy(&a, (const char *) data + op->k, 4);
+        else if (BPF_MODE(op->code) == BPF_IMM) a = op->k;
+        else if (BPF_MODE(op->code) == BPF_MEM) a = memory[op->k];
+        else goto unknown;
+        break;
+      case BPF_LDX:
+        if (BPF_MODE(op->code) == BPF_IMM) x = op->k;
+        else if (BPF_MODE(op->code) == BPF_MEM) x = memory[op->k];
+        else goto unknown;
+        break;
+      case BPF_ST: memory[op->k] = a; break;
+      case BPF_STX: memory[op->k] = x; break;
+      case BPF_ALU:
+        switch (BPF_OP(op->code)) {
+          case BPF_AND: a &= operand; break;
+          case BPF_OR: a |= operand; break;
+          case BPF_ADD: a += operand; break;
+          case BPF_SUB: a -= operand; break;
+          default: goto unknown;
+        }
+        break;
+      case BPF_JMP: {
+        bool taken;
+        switch (BPF_OP(op->code)) {
+          case BPF_JA: pc += op->k; continue;
+          case BPF_JEQ: taken = a == operand; break;
+          case BPF_JGT: taken = a > operand; break;
+          case BPF_JGE: taken = a >= operand; break;
+          case BPF_JSET: taken = (a & operand) != 0; break;
+          default: goto unknown;
+        }
+        pc += taken ? op->jt : op->jf;
+        break;
+      }
+      case BPF_RET: return BPF_RVAL(op->code) == BPF_A ? a : op->k;
+      case BPF_MISC:
+        if (BPF_MISCOP(op->code) == BPF_TAX) x = a;
+        else a = x;
+        break;
+      default:
+      unknown:
+        fprintf(stderr, "unsupported BPF instruction 0x%04x\n", op->code);
+        exit(1);
+    }
+  }
+  fputs("BPF program ran off its end\n", stderr);
+  exit(1);
+}
+
+
+static int compare(const char *name, enum filter filter, const struct sock_fprog *compiled) {
+  // Every system call number of both ABIs, with the arguments the rules look at set to
+  // each of a range of values, in both halves.
+  static const uint64_t values[] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 15, 16, 22, 0xffffffff, 0x100000000, 0x100000001,
+    RLIMIT_CPU, ITIMER_PROF, RUSAGE_SELF, CLOCK_MONOTONIC, PR_SET_SECCOMP, UINT64_MAX,
+  };
+  static const uint32_t architectures[] = { AUDIT_ARCH_X86_64, AUDIT_ARCH_I386 };
+  struct sock_fprog reference = export_reference(filter);
+  unsigned long checked = 0, mismatches = 0;
+  for (size_t arch = 0; arch < sizeof(architectures) / sizeof(architectures[0]); ++arch) {
+    for (uint32_t nr = 0; nr < 1024 + 0x40000000; ++nr) {
+      if (nr == 1024) nr = 0x40000000 - 1; // then the x32 numbers
+      for (int arg = 0; arg < 6; ++arg) {
+        for (size_t v = 0; v < sizeof(values) / sizeof(values[0]); ++v) {
+          struct seccomp_data data;
+          memset(&data, '\0', sizeof(data));
+          data.nr = nr;
+          data.arch = architectures[arch];
+          data.args[arg] = values[v];
+          uint32_t expected = run(&reference, &data), actual = run(compiled, &data);
+          ++checked;
+          if (expected != actual && ++mismatches <= 10) {
+            fprintf(stderr, "%s: arch 0x%x, call %u, arg %d = 0x%llx: expected 0x%x, got 0x%x\n",
+                    name, data.arch, nr, arg, (unsigned long long) values[v], expected, actual);
+          }
+        }
+      }
+    }
+  }
+  free(reference.filter);
+  printf("%s: %lu cases, %lu mismatches\n", name, checked, mismatches);
+  return mismatches != 0;
+}
+
+
+int main(void) {
+  int failed = 0;
+  failed |= compare("sandbox_filter", SANDBOX, &sandbox_filter);
+  failed |= compare("sandbox_batch_filter", BATCH_PARENT, &sandbox_batch_filter);
+  failed |= compare("sandbox_child_filter", BATCH_CHILD, &sandbox_child_filter);
+  return failed;
+}
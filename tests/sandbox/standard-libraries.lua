@@ -0,0 +1,12 @@
+--! luajit-sandbox
+-- Every standard library is an ordinary global from the start, and the globals table has no
+-- metatable.
+print(getmetatable(_G), rawget(_G, "math") == math, package.loaded.table == table)
+local names = {}
+for _, name in ipairs({"table", "io", "os", "math", "debug", "bit", "string", "jit"}) do
+  if rawget(_G, name) ~= nil and package.loaded[name] == _G[name] then
+    names[#names + 1] = name
+  end
+end
+print(table.concat(names, " "))
+print(require("bit") == bit, type(require("ffi").new))
@@ -0,0 +1,4 @@
+--! luajit-sandbox --stats-fd 1
+-- A script that fails still gets its record, with the outcome saying so.
+print("before")
+error("stopped")
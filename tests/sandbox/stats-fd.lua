@@ -0,0 +1,9 @@
+--! luajit-sandbox --stats-fd 1
+-- The record follows the script's output. Times and sizes vary from run to run, so only the
+-- keys, the outcome and the counters this script is sure to move are checked.
+local r = resumer.Resumer(function(x) return x * 2 end)
+print(r(21))
+local t = {}
+for i = 1, 100000 do t[i % 100] = {i} end
+collectgarbage()
+print(#t)